@@ -11,4 +11,6 @@ cd $BINDIR
 ln -sf gtfold gtmfe
 ln -sf gtfold gtsubopt
 ln -sf gtfold gtboltzmann
+ln -sf gtfold gtfoldd
+ln -sf gtfold gtfold-client
 
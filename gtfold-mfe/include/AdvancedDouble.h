@@ -11,6 +11,14 @@ using namespace std;
 extern int g_bignumprecision;
 const int PRINT_DIGITS_AFTER_DECIMAL = 20;
 
+//natural logarithm of a bignum, exact even where the value itself does not fit in a double
+static inline double mpf_log(const mpf_t val){
+	if(mpf_sgn(val)<=0) return -INFINITY;
+	signed long int exp2;
+	double mantissa = mpf_get_d_2exp(&exp2, val);
+	return log(mantissa) + exp2*M_LN2;
+}
+
 class AdvancedDouble_Native{
 	private:
 		double value;
@@ -50,6 +58,12 @@ class AdvancedDouble_Native{
 			//fprintf(outFile, "%f", value);
 			fprintf(outFile, "%.20f", value);
 		}
+		double toDouble()const{
+			return value;
+		}
+		double toLog()const{
+			return value>0 ? log(value) : -INFINITY;
+		}
 		AdvancedDouble_Native operator*(const AdvancedDouble_Native &obj1) const {
 			return (AdvancedDouble_Native)(value*obj1.value);
 		}
@@ -237,6 +251,14 @@ class AdvancedDouble_BigNum{
 		void print(FILE* outFile)const{
 			if(bigValue!=0) gmp_fprintf(outFile, "%.*Ff", PRINT_DIGITS_AFTER_DECIMAL, *bigValue);
 		}
+		double toDouble()const{
+			if(bigValue!=0) return mpf_get_d(*bigValue);
+			return 0.0;
+		}
+		double toLog()const{
+			if(bigValue!=0) return mpf_log(*bigValue);
+			return -INFINITY;
+		}
 		AdvancedDouble_BigNum operator*(const AdvancedDouble_BigNum &obj1) const {
 			AdvancedDouble_BigNum res;
 			res.createBigNum();
@@ -406,6 +428,12 @@ class AdvancedDouble_BigNumOptimized{
 			//if(bigValue!=0) gmp_fprintf(outFile, "%.*Ff", PRINT_DIGITS_AFTER_DECIMAL, *bigValue);
 			gmp_fprintf(outFile, "%.*Ff", PRINT_DIGITS_AFTER_DECIMAL, bigValue);
 		}
+		double toDouble()const{
+			return mpf_get_d(bigValue);
+		}
+		double toLog()const{
+			return mpf_log(bigValue);
+		}
 		AdvancedDouble_BigNumOptimized operator*(const AdvancedDouble_BigNumOptimized &obj1) const {
 			AdvancedDouble_BigNumOptimized res;
 			mpf_mul(res.bigValue,this->bigValue, obj1.bigValue);
@@ -683,6 +711,16 @@ class AdvancedDouble_Hybrid{
 			else if(isBig=='n') fprintf(outFile, "%f", *smallValue);
 			else fprintf(outFile, "Unknown isBig = %c\n", isBig);
 		}
+		double toDouble()const{
+			if(isBig=='y') return mpf_get_d(*bigValue);
+			else if(isBig=='n') return *smallValue;
+			return 0.0;
+		}
+		double toLog()const{
+			if(isBig=='y') return mpf_log(*bigValue);
+			else if(isBig=='n' && *smallValue>0) return log(*smallValue);
+			return -INFINITY;
+		}
 		AdvancedDouble_Hybrid operator*(const AdvancedDouble_Hybrid &obj1) const {
 			if(this->isBig=='y'){
 				//case 1: this object is bigValue and obj1 is also bigValue -- result is bigValue
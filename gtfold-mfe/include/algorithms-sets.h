@@ -0,0 +1,47 @@
+#ifndef _ALGORITHMS_SETS_H
+#define _ALGORITHMS_SETS_H
+
+#include "param-set.h"
+
+/*
+ * MFE fill for several parameter sets, dangle treatments and SHAPE profiles in one sweep (gtmfe
+ * --compare, --dangle-modes and --shape-profiles).
+ *
+ * Each table set of the sweep has a parameter set, a treatment of dangling ends and a SHAPE
+ * profile. The recurrences of calculate() run once over the cells for all of them: the
+ * pairability mask (PP and the prefilter), the constraints checks and the enumeration of the
+ * internal loops are shared, and a loop is classified and its table indices worked out once
+ * before its energy is looked up in every distinct set. Only the SHAPE energy of the stacked
+ * pairs, the minima over the candidates, which add the V of the inner pair, and the multiloop
+ * and exterior loop terms are taken per table set. The tables are interleaved, so the values of
+ * all of them for a cell sit next to each other and the inner loops read them together.
+ *
+ * The table sets share the constraints, prefilter and --unafold, each of them gives exactly the
+ * energies and tables of calculate() with its parameters loaded, its dangle treatment set and its
+ * SHAPE energies in SHAPEenergies.
+ */
+
+#define SWEEP_TABLES_MAX 64
+
+/* the treatment of dangling ends of a table set */
+#define SWEEP_DANGLE_0        0 /* -d 0 */
+#define SWEEP_DANGLE_DEFAULT  1
+#define SWEEP_DANGLE_2        2 /* -d 2 */
+#define SWEEP_MISMATCH        3 /* -m, and --unafold */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Fills ntables (at most SWEEP_TABLES_MAX) table sets, energies[k] is the MFE with the parameters
+// sets[k], the dangle treatment modes[k], or the one of g_dangles, g_mismatch and g_unamode if
+// modes is NULL, and the SHAPE energies shapes[k] by position (NULL for none), or the ones read
+// by --useSHAPE if shapes is NULL. Uses PP and indx of the tables bound by create_tables.
+void calculate_sets(int len, int ntables, const struct param_set* const* sets, const int* modes,
+                    const int* const* shapes, int* energies);
+// Copies table set k into V, VM, VBI, W, WM and WMPrime, for trace()
+void load_set_tables(int len, int k);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,8 @@
 extern "C" {
 #endif
 	int calculate(int len);//, int nThreads, int unamode ,int t_mismatch);
+	void initializeMatrix(int len);
+	void prefilter(int len, int prefilter1, int prefilter2);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,50 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <string>
+
+#include "fasta-reader.h"
+
+/*
+ * Multi-record FASTA input for gtmfe, gtsubopt and gtboltzmann.
+ *
+ * The engine keeps one sequence in its globals, so a batch is folded by worker processes forked
+ * from the driver after option parsing. A worker stays alive and keeps asking batch_next for
+ * records, so it folds many of them one after another in the tables kept by create_tables and
+ * the partition function pools. Each record runs the usual single sequence path with its output
+ * files prefixed by the record ID.
+ *
+ * The driver streams the records from the fasta_reader and sends each one to its worker through
+ * a pipe, holding no more than BATCH_WINDOW records read ahead. Within that window records are
+ * started longest first. A record of at least BATCH_LONG_RECORD nt gets the whole thread budget
+ * for its wavefront, shorter records get one thread each so that many of them fold side by side
+ * (the last few share out the threads left over). A record is only started while the estimated
+ * size of the tables held by the workers stays within the memory budget. That includes the idle
+ * workers, whose pools keep the tables of the longest record they have folded: a record goes to
+ * the idle worker whose pools fit it best, and idle workers are retired, largest pools first,
+ * when it would not fit otherwise. An oversized record runs on its own. The output of a record
+ * is printed as one block under its record ID when it is done.
+ */
+
+#define BATCH_LONG_RECORD 1000
+#define BATCH_WINDOW 256
+
+// Parses the argument of --batchmem (MB), exits on a bad value
+void set_batch_memory(const char* mb);
+
+// Folds the records of input in worker processes, record holds the first record of input on the
+// first call. In a worker, returns true with the next record to fold and its thread count, and
+// false once there is none left. In the driver, schedules all records and returns false once
+// every record has been folded.
+// cellBytes estimates the table memory per (i,j) cell of the calling tool.
+bool batch_next(fasta_reader& input, int nthreads, double cellBytes, fasta_record& record,
+		int& threads);
+
+// Number of records that failed in the driver, once batch_next has returned false. The tools
+// exit non-zero when it is not 0.
+int batch_failed();
+
+// Output prefix of a record in a batch
+std::string batch_output_prefix(const std::string& prefix, const fasta_record& record);
+
+#endif
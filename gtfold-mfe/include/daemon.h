@@ -0,0 +1,45 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+/*
+ * gtfoldd, a folding server on a Unix domain socket, and gtfold-client, its command line client.
+ *
+ * gtfold-client [--socket PATH] gtmfe|gtboltzmann [OPTION]... FILE sends the command line and its
+ * working directory to gtfoldd together with its own stdout and stderr, so the run prints to
+ * them and writes its output files just like gtmfe or gtboltzmann would, and the client exits
+ * with the exit status of the run.
+ *
+ * The engine keeps its options and one sequence in globals, so each command line runs in a
+ * worker process forked by gtfoldd. A worker does not exit when its run is done but waits for
+ * the next command line of the same tool, from the same working directory, that differs from its
+ * own at most in a last argument not starting with '-' (the sequence file). It has parsed these
+ * options and read these parameters already, and folds the new file in the tables it kept
+ * (create_tables and the partition function pools) with the OpenMP threads it started. At most
+ * --workers workers are alive, the least recently used idle worker makes room for a command
+ * line that no idle worker can take, and the others wait in turn.
+ *
+ * A request is a daemon_header followed by the working directory and the arguments, each ended
+ * by '\0', with the client's stdout and stderr passed as SCM_RIGHTS. The reply is the exit
+ * status of the run as an int. gtfoldd passes requests on to its workers in the same form.
+ */
+
+#define GTFOLDD_SOCKET "/tmp/gtfoldd-%d.sock" /* by user ID, GTFOLDD_SOCKET in the environment overrides */
+#define GTFOLDD_VERSION 1
+#define GTFOLDD_MAX_REQUEST (1 << 20)
+
+struct daemon_header
+{
+	char magic[4];          /* GTFD */
+	unsigned int version;
+	unsigned int argc;
+	unsigned int size;      /* bytes of the working directory and the arguments */
+};
+
+int gtfoldd_main(int argc, char** argv);
+int gtfold_client_main(int argc, char** argv);
+
+// In a worker of gtfoldd, reports the run of the current command line as done and returns true
+// with the next one. Returns false right away in any other process.
+bool daemon_next(int& argc, char**& argv);
+
+#endif
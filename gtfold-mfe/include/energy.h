@@ -46,6 +46,8 @@ int Estacke(int i, int j);
 void create_tables(int len);
 void init_tables(int len);
 void free_tables(int len);
+// Frees the tables kept for reuse by free_tables
+void release_tables();
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,73 @@
+#ifndef _FASTA_READER_H_
+#define _FASTA_READER_H_
+
+#include <sys/types.h>
+#include <string>
+#include <unordered_set>
+
+/*
+ * Record by record reader for FASTA files of any size.
+ *
+ * A plain file is mapped and its lines are scanned in place, a .gz or .zst file is read from a
+ * gzip -dc or zstd -dc process through a pipe into a buffer of FASTA_READ_BUFFER bytes (grown
+ * only for a line that does not fit). The bases of a record are appended to the storage of the
+ * record passed to next, so a caller that reuses its record needs memory for the longest record
+ * only, whatever the size of the file.
+ *
+ * Record IDs name the output files, so a repeated ID is made unique anywhere in the file, not
+ * only within the records read ahead. For that the reader keeps a hash of every ID it has
+ * returned instead of the IDs themselves, some 40 bytes per record (40 MB for a million
+ * records). Two different IDs with the same hash only cost one of them a needless suffix.
+ */
+
+#define FASTA_READ_BUFFER (1 << 20)
+
+struct fasta_record
+{
+	std::string id;    /* first word of the header, made safe for file names and unique */
+	std::string seq;
+};
+
+class fasta_reader
+{
+	public:
+		fasta_reader();
+		~fasta_reader();
+
+		// Opens a plain, .gz or .zst file, returns FAILURE if it cannot be read
+		int open(const char* filename);
+		// Reads the next record into record, returns false when there is none left.
+		// Lines before the first header are a record of their own, with an empty id when the
+		// file has no other record.
+		bool next(fasta_record& record);
+		// True when no record is left
+		bool at_end();
+		void close();
+		// Drops the file in a forked process, the parent keeps reading it
+		void release();
+
+	private:
+		std::string name;
+		int fd;
+		pid_t decompressor;
+		char* map;
+		size_t mapSize;
+		char* buf;
+		size_t bufSize;
+		const char* pos;
+		const char* end;
+		bool eof;            /* nothing left to read beyond end */
+		const char* held;    /* a line read ahead by at_end or next */
+		size_t heldSize;
+		bool holding;
+		size_t count;
+		std::unordered_set<size_t> seen;    /* hashes of the IDs returned */
+
+		bool line(const char*& s, size_t& n);
+		bool refill();
+
+		fasta_reader(const fasta_reader&);
+		fasta_reader& operator = (const fasta_reader&);
+};
+
+#endif
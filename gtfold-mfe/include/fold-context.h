@@ -0,0 +1,93 @@
+#ifndef _FOLD_CONTEXT_H_
+#define _FOLD_CONTEXT_H_
+
+#include <string>
+
+/*
+ * Library interface to the MFE engine (libgtfold.a). FoldContext is a wrapper around the
+ * engine's globals, not a re-entrant engine: one fold runs at a time per process.
+ *
+ * A FoldContext keeps what one fold needs: its options, the encoded sequence, the DP tables,
+ * constraints and SHAPE data, and the MFE structure. Several contexts can be alive at once,
+ * there is no init_fold/free_fold pairing. The recurrences in energy.c, algorithms.c and
+ * traceback.c address all of this through the globals, so mfe() and trace() copy the state of
+ * their context into them and back, under a process wide lock, and reload the thermodynamic
+ * parameters when the bound context asks for a different set (the default sets come from the
+ * snapshots compiled into the library). Calls from different threads are therefore safe but
+ * run one after the other; the OpenMP fill of a fold uses the thread budget of its context.
+ * The partition function and stochastic sampling are not covered, they still run on the
+ * globals directly and must not run during a call of a context.
+ *
+ * Not done yet: folds running concurrently in one process. That needs the tables (with PP
+ * and indx), the options, the constraint and SHAPE state and a pointer to the parameter set
+ * passed through calculate(), trace(), PartitionFunctionD2 and StochasticTracebackD2 in
+ * place of the globals.
+ *
+ * The tables of a context come from the pool kept by create_tables. setSequence refolds a context
+ * with a new sequence in the tables it already has, and the tables of destroyed contexts are kept
+ * for the next ones until releaseTables. Destroying a context only frees its state, it does not
+ * load parameters.
+ */
+
+struct FoldOptions
+{
+	int dangles;            /* 0 or 2, -1 for the default treatment of dangling ends */
+	bool unamode;           /* --unafold */
+	bool rnamode;           /* --rnafold */
+	bool mismatch;          /* -m */
+	int nthreads;           /* OpenMP threads for the fill, -1 for the OpenMP default */
+	int prefilter;          /* --prefilter helix length, 0 to disable */
+	int contactDistance;    /* -l, -1 for no limit */
+	std::string paramDir;   /* -p directory or snapshot, empty for the default set */
+	std::string constraintsFile;
+	std::string shapeFile;
+
+	FoldOptions() : dangles(-1), unamode(false), rnamode(false), mismatch(false), nthreads(-1),
+		prefilter(0), contactDistance(-1) {}
+};
+
+struct fold_state;
+
+class FoldContext
+{
+	public:
+		// Exits like the command line tools on an invalid sequence or unreadable input files
+		FoldContext(const std::string& seq, const FoldOptions& opt = FoldOptions());
+		~FoldContext();
+
+		// Replaces the sequence, the options, constraints and SHAPE files stay the same
+		void setSequence(const std::string& seq);
+		// Frees the tables kept for reuse, contexts that are alive keep theirs
+		static void releaseTables();
+
+		// Fills the tables, returns the MFE in units of 10 cal/mol
+		int mfe();
+		// Traces the MFE structure back from the filled tables
+		void trace(bool energyDecompose = false, const std::string& decomposeFile = "");
+
+		int length() const { return len; }
+		const std::string& sequence() const { return seq; }
+		int energy() const { return mfeEnergy; }
+		// partner of base i (1 based), 0 if unpaired
+		int pair(int i) const;
+		std::string dotBracket() const;
+		void saveCT(const std::string& fileName) const;
+
+	private:
+		std::string seq;
+		FoldOptions opt;
+		int len;
+		int mfeEnergy;
+		bool filled;
+		fold_state* state;
+
+		void load();
+		void unload();
+		void bind();
+		void unbind();
+
+		FoldContext(const FoldContext&);
+		FoldContext& operator = (const FoldContext&);
+};
+
+#endif
@@ -46,7 +46,8 @@ void print_gtfold_usage_help();
 
 #ifdef __cplusplus
 int read_sequence_file(const char* filename, std::string& seq);
-bool encodeSequence(string seq);
+bool encodeSequence(const char* seq, int len);
+bool encodeSequence(const string& seq);
 void save_ct_file(string outputFile, string seq, int energy) ;
 void save_ct_file(string outputFile, string seq, int energy, int *structure1); 
 #endif
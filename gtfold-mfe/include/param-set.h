@@ -0,0 +1,71 @@
+#ifndef _PARAM_SET_H_
+#define _PARAM_SET_H_
+
+#include "constants.h"
+
+/*
+ * A parameter set held next to the tables in data.h, for folding with several sets at once
+ * (gtmfe --compare).
+ *
+ * The loader, the snapshots and most of the engine read and write the global tables of data.h,
+ * so a set is loaded through readThermodynamicParameters and captured from the globals, and bound
+ * back into them for the code that reads them (trace, energy decomposition). The sweep in
+ * algorithms-sets.c reads the sets themselves. Every table the loader sets (those kept in the
+ * snapshots) has a member of the same name and type here.
+ */
+
+#define PARAM_SETS_MAX 16
+
+struct param_set
+{
+	char name[256];     /* what it was read from, as EN_DATADIR */
+
+	int poppen[5];
+	int maxpen;
+	int eparam[11];
+	int multConst[3];
+	int dangle[4][4][4][2];
+	int inter[31];
+	int bulge[31];
+	int hairpin[31];
+	int stack[256];
+	int tstkh[256];
+	int tstki[256];
+	int tloop[maxtloop + 1][2];
+	int numoftloops;
+	int iloop22[5][5][5][5][5][5][5][5];
+	int iloop21[5][5][5][5][5][5][5];
+	int iloop11[5][5][5][5][5][5];
+	int auend;
+	int gubonus;
+	int cint;
+	int cslope;
+	int c3;
+	int efn2a;
+	int efn2b;
+	int efn2c;
+	int triloop[maxtloop + 1][2];
+	int numoftriloops;
+	int init;
+	int gail;
+	float prelog;
+
+	int tstackm[5][5][6][6];
+	int tstacke[5][5][6][6];
+	int tstacki23[5][5][5][5];
+};
+
+#ifdef __cplusplus
+#include <string>
+
+// Reads a set like -p does (a directory or a snapshot), "default" for the set used without -p.
+// The globals hold the set afterwards.
+param_set* load_param_set(const std::string& source, int unamode, int rnamode, int mismatch);
+// Copies the tables loaded now into a new set
+param_set* capture_param_set(const std::string& name);
+// Copies a set into the global tables
+void bind_param_set(const param_set* set);
+void free_param_set(param_set* set);
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _PARAM_SNAPSHOT_H_
+#define _PARAM_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <string>
+
+/*
+ * Binary snapshots of the thermodynamic parameter tables filled by readThermodynamicParameters,
+ * written by gtfold-compile-params and mapped by the loader instead of parsing the .DAT files.
+ *
+ * header  : magic "GTPS", version, flags, length of the name of the parameter set, payload size
+ *           (uint32), FNV-1a checksum of the payload (uint64), name bytes. Little endian.
+ * payload : number of tables, then for every table in the fixed order of param-snapshot.cc its
+ *           number of entries and the entries as runs of (run length, zigzag value), all varints.
+ *
+ * The tables are mostly INFINITY_ (the 2x2 internal loop table has 9216 finite entries out of
+ * 390625), so a run length snapshot of Turner99 is a few tens of KB. The Turner99 and RNAParams
+ * sets are compiled into gtfold at build time and used when no parameter directory is given.
+ */
+
+#define PARAM_SNAPSHOT_VERSION 1
+
+#define PARAM_SNAPSHOT_UNAMODE  1 /* int11/int21/int22 from the UNAfold files, has tstacki23 */
+#define PARAM_SNAPSHOT_MISMATCH 2 /* has the terminal mismatch tables tstackm and tstacke */
+
+// Serialises the current parameter tables
+void param_snapshot_encode(std::string name, int flags, std::string& blob);
+// Loads a snapshot into the parameter tables. Returns false with the reason in err if it is
+// corrupt, was written by another version, or lacks the tables unamode/mismatch need.
+bool param_snapshot_decode(const unsigned char* blob, size_t size, int unamode, int mismatch, std::string& name, std::string& err);
+
+void save_param_snapshot(std::string fileName, std::string name, int flags);
+// Writes the snapshot as a C array param_snapshot_<name> for linking into gtfold
+void save_param_snapshot_source(std::string fileName, std::string name, int flags);
+bool is_param_snapshot(std::string fileName);
+// Maps fileName and loads it, exits on error
+void load_param_snapshot(std::string fileName, int unamode, int mismatch);
+// Loads the parameter set compiled into the binary, false if it has not been linked in
+bool load_builtin_params(std::string name, int unamode, int mismatch);
+// Checksum of the parameter tables as they are loaded now, whatever they were read from
+unsigned long long param_tables_checksum();
+
+#endif
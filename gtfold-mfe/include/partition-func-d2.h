@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
 
 //#include "MyDouble.cc"
 /*
@@ -56,9 +57,18 @@ class PartitionFunctionD2{
 		void calc_up_serial_and_approximate(int i, int j);
 		void calc_up_parallel_and_approximate(int i, int j);
 		void calc_up_parallel(int i, int j);
-		//general utility functions
-		MyDouble **mallocTwoD(int r, int c);
-		void freeTwoD(MyDouble** arr, int r, int c);
+		//the arrays of a finished partition function go back to a pool and are handed to the
+		//next one of the same MyDouble, grown to the longest sequence they have held
+		struct table_set{
+			int cap;//part_len+2 the arrays have room for
+			MyDouble* block[7];
+			size_t size[7];
+			MyDouble** rows[7];
+		};
+		table_set* tables;
+		static std::vector<table_set*>& table_pool();
+		static void grow_table_set(table_set* t, int len);
+		MyDouble **bindTwoD(int k, int r, int c);
 		//void printMatrix(MyDouble** u, int part_len);
 		void printMatrix(MyDouble** u, int part_len, FILE* pfarraysoutputfile);//pfarraysoutputfile can be stdin in order to make it to print to standard output
 	public:
@@ -90,6 +100,7 @@ class PartitionFunctionD2{
 		//Functions to calculate partition, and other partition function related utilities exposed to outside world
 		MyDouble calculate_partition(int len, int pf_count_mode, int no_dangle_mode, bool PF_D2_UP_APPROX_ENABLED, double scaleFactor);
 		void free_partition();
+		void free_partition_table(int k);//k in the order of table_set, 0=u, 1=up, 2=upm, 3=s1, 4=s2, 5=s3, 6=u1
 		void printAllMatrixes();
 		void printAllMatrixesToFile(std::string pfArraysOutputFile);
 };
@@ -476,6 +487,7 @@ void PartitionFunctionD2<MyDouble>::printAllMatrixesToFile(string pfArraysOutput
 template<class MyDouble>
 PartitionFunctionD2<MyDouble>::PartitionFunctionD2(){
 	PF_D2_UP_APPROX_ENABLED=true;
+	tables=0;
 	u=0;
 	up=0;
 	upm=0;
@@ -669,91 +681,104 @@ void PartitionFunctionD2<MyDouble>::init_partition_arrays()
 	}
 }
 
+//start of row i of an array with c columns, rows start at the diagonal with MEMORY_OPTIMIZATION_ENABLED
+static inline size_t pf_d2_row_offset(int i, int c){
+	#if MEMORY_OPTIMIZATION_ENABLED
+	return (size_t)i*c - (size_t)i*(i-1)/2;
+	#else
+	return (size_t)i*c;
+	#endif
+}
+
 template<class MyDouble>
-void PartitionFunctionD2<MyDouble>::create_partition_arrays()
+std::vector<typename PartitionFunctionD2<MyDouble>::table_set*>& PartitionFunctionD2<MyDouble>::table_pool()
 {
-	int len = part_len + 2;
-	u = mallocTwoD(len,len);
-	up = mallocTwoD(len,len);
-	upm = mallocTwoD(len,len);
-	s1 = mallocTwoD(len,len);
-	s2 = mallocTwoD(len,len);
-	s3 = mallocTwoD(len,len);
-	u1 = mallocTwoD(len+1,len+1);
+	static std::vector<table_set*> pool;
+	return pool;
 }
 
 template<class MyDouble>
-void PartitionFunctionD2<MyDouble>::free_partition_arrays()
+void PartitionFunctionD2<MyDouble>::grow_table_set(table_set* t, int len)
 {
-	int len = part_len + 2;
-	freeTwoD(u,len,len);
-	freeTwoD(up,len,len);
-	freeTwoD(upm,len,len);
-	freeTwoD(s1,len,len);
-	freeTwoD(s2,len,len);
-	freeTwoD(s3,len,len);
-	freeTwoD(u1,len+1,len+1);
+	for(int k=0; k<7; ++k){
+		for(size_t e=0; e<t->size[k]; ++e) t->block[k][e].deallocate();
+		free(t->block[k]);
+		free(t->rows[k]);
+
+		int dim = (k == 6) ? len+1 : len;//u1 is one larger
+		t->size[k] = pf_d2_row_offset(dim, dim);
+		t->block[k] = (MyDouble *)malloc(t->size[k]*sizeof(MyDouble));
+		t->rows[k] = (MyDouble **)malloc(dim*sizeof(MyDouble*));
+		if(t->block[k] == NULL || t->rows[k] == NULL){
+			perror("Cannot allocate the partition function arrays");
+			exit(-1);
+		}
+		for(size_t e=0; e<t->size[k]; ++e) t->block[k][e].init();
+	}
+	t->cap = len;
 }
 
-//general utility functions
 template<class MyDouble>
-MyDouble** PartitionFunctionD2<MyDouble>::mallocTwoD(int r, int c) {
-    MyDouble** arr = (MyDouble **)malloc(r*sizeof(MyDouble));
-    int i,j;
-    for(i=0; i<r; i++) {
-	#if MEMORY_OPTIMIZATION_ENABLED
-        arr[i] = (MyDouble *)malloc((c-i)*sizeof(MyDouble));
-        #else
-	arr[i] = (MyDouble *)malloc(c*sizeof(MyDouble));
-	#endif
-
-        // failed allocating a row, so free all previous rows, free the main
-        // array, and return NULL
-        if(arr[i] == NULL) {
-            for(j=0; j<i; j++)
-                free(arr[j]);
-            free(arr);
-            return NULL;
-        }
-    }
+MyDouble** PartitionFunctionD2<MyDouble>::bindTwoD(int k, int r, int c)
+{
+	//rows are packed for this length, init_part_arrays_negatives resets all of them
+	for(int i=0; i<r; ++i) tables->rows[k][i] = tables->block[k] + pf_d2_row_offset(i, c);
+	return tables->rows[k];
+}
 
-    for(i=0; i<r; ++i){
-	#if MEMORY_OPTIMIZATION_ENABLED
-	for(j=i; j<c; ++j){
-	#else
-	for(j=0; j<c; ++j){
-	#endif
-		#if MEMORY_OPTIMIZATION_ENABLED
-		arr[i][j-i].init();
-		#else
-		arr[i][j].init();
-		#endif
+template<class MyDouble>
+void PartitionFunctionD2<MyDouble>::create_partition_arrays()
+{
+	int len = part_len + 2;
+	std::vector<table_set*>& pool = table_pool();
+	//the smallest pooled set that fits, else the largest one grown to len
+	int best = -1;
+	for(int k=0; k<(int)pool.size(); ++k){
+		int cap = pool[k]->cap;
+		if(best < 0 || (pool[best]->cap < len ? cap > pool[best]->cap : cap >= len && cap < pool[best]->cap))
+			best = k;
 	}
-    }
-
-    return arr;
+	if(best >= 0){
+		tables = pool[best];
+		pool.erase(pool.begin()+best);
+	}
+	else{
+		tables = new table_set;
+		memset(tables, 0, sizeof(table_set));
+	}
+	if(tables->cap < len) grow_table_set(tables, len);
+
+	u = bindTwoD(0,len,len);
+	up = bindTwoD(1,len,len);
+	upm = bindTwoD(2,len,len);
+	s1 = bindTwoD(3,len,len);
+	s2 = bindTwoD(4,len,len);
+	s3 = bindTwoD(5,len,len);
+	u1 = bindTwoD(6,len+1,len+1);
 }
 
+//frees one array for good while the others are still read, the set goes back to the pool
+//empty and is grown again by the next partition function that takes it
 template<class MyDouble>
-void PartitionFunctionD2<MyDouble>::freeTwoD(MyDouble** arr, int r, int c) {
-    int i,j;
-     for(i=0; i<r; ++i){
-	#if MEMORY_OPTIMIZATION_ENABLED
-        for(j=i; j<c; ++j){
-	#else
-        for(j=0; j<c; ++j){
-	#endif
-		#if MEMORY_OPTIMIZATION_ENABLED
-        	arr[i][j-i].deallocate();
-		#else
-        	arr[i][j].deallocate();
-		#endif
-        }
-    }
+void PartitionFunctionD2<MyDouble>::free_partition_table(int k)
+{
+	MyDouble*** arrays[7] = {&u, &up, &upm, &s1, &s2, &s3, &u1};
+	for(size_t e=0; e<tables->size[k]; ++e) tables->block[k][e].deallocate();
+	free(tables->block[k]);
+	free(tables->rows[k]);
+	tables->block[k] = 0;
+	tables->rows[k] = 0;
+	tables->size[k] = 0;
+	tables->cap = 0;
+	*arrays[k] = 0;
+}
 
-    for(i=0; i<r; i++)
-        free(arr[i]);
-    free(arr);
+template<class MyDouble>
+void PartitionFunctionD2<MyDouble>::free_partition_arrays()
+{
+	if(tables == 0) return;
+	table_pool().push_back(tables);
+	tables = 0;
 }
 
 template<class MyDouble>
@@ -0,0 +1,41 @@
+#ifndef _RESULT_CACHE_H_
+#define _RESULT_CACHE_H_
+
+#include <string>
+
+/*
+ * On-disk cache of folding results (--cache-dir), shared between runs and between the workers
+ * of a batch.
+ *
+ * A key is the kind of result, the encoded sequence (so T and U, upper and lower case give the
+ * same key), the checksum of the loaded parameter tables and every option the caller adds that
+ * changes the result, input files by their content. An entry is a file named by the FNV-1a hash
+ * of its key and holds the whole key, so a hash collision reads as a miss. Entries are written to
+ * a temporary file in the cache directory and renamed into place, so a reader never sees a
+ * partial entry. A hit touches the entry, and once the entries take more than the size cap
+ * (--cache-size) the least recently used ones are removed.
+ */
+
+#define RESULT_CACHE_VERSION 1
+#define RESULT_CACHE_SIZE 1024 /* MB */
+
+// Parses the argument of --cache-dir, creating the directory if needed
+void set_cache_dir(const char* dir);
+// Parses the argument of --cache-size (MB), exits on a bad value
+void set_cache_size(const char* mb);
+bool cache_enabled();
+
+// Starts the key of a result of the given kind for seq
+std::string cache_key(const char* kind, const std::string& seq);
+// Takes the checksum of the parameter tables again for the next keys, after they are read again
+void cache_params_changed();
+// Adds an option to a key
+void cache_key_add(std::string& key, const char* name, long long value);
+// Adds the content of a file to a key
+void cache_key_add_file(std::string& key, const char* name, const std::string& fileName);
+
+// Reads the data of key, false if it is not cached
+bool cache_get(const std::string& key, std::string& data);
+void cache_put(const std::string& key, const std::string& data);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _SAMPLE_ARCHIVE_H_
+#define _SAMPLE_ARCHIVE_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+ * Indexed binary archive of stochastically sampled structures.
+ *
+ * header  : magic "GTSA", version, sequence length, dangle mode, scale factor, sequence bytes
+ * records : energy (int32, units of 10 cal/mol), boltzmann probability (float64), number of
+ *           pairs (varint), then for every pair i<j in increasing i, (i - previous i) and
+ *           (j - i) as varints
+ * index   : file offset (uint64) of every record, in sample order
+ * trailer : record count (uint64), index offset (uint64), magic "GTSI"
+ *
+ * All fixed width fields are little endian, so archives can be moved between machines.
+ */
+
+#define SAMPLE_ARCHIVE_VERSION 1
+
+struct sample_archive_header
+{
+	int version;
+	int length;
+	int dangles;
+	double scale_factor;
+	std::string seq;
+};
+
+// Appends the encoded record for one sampled structure to buf, so that the
+// encoding can be done by the sampling thread and only the write is serialized.
+void sample_archive_encode(const int* structure, int length, double energy, double probability, std::string& buf);
+
+class SampleArchiveWriter
+{
+	public:
+		SampleArchiveWriter();
+		~SampleArchiveWriter();
+		void open(std::string fileName, std::string seq, int dangles, double scaleFactor);
+		void append(const std::string& record);
+		void close();
+		bool isOpen() const { return outfile != NULL; }
+		unsigned long long count() const { return offsets.size(); }
+	private:
+		FILE* outfile;
+		std::string fileName;
+		std::vector<unsigned long long> offsets;
+		unsigned long long pos;
+};
+
+class SampleArchiveReader
+{
+	public:
+		SampleArchiveReader();
+		~SampleArchiveReader();
+		void open(std::string fileName);
+		void close();
+		const sample_archive_header& header() const { return hdr; }
+		unsigned long long count() const { return offsets.size(); }
+		// structure must hold length+1 ints, pairs are stored as structure[i]=j, structure[j]=i
+		void read(unsigned long long index, int* structure, double& energy, double& probability);
+	private:
+		FILE* infile;
+		std::string fileName;
+		sample_archive_header hdr;
+		std::vector<unsigned long long> offsets;
+};
+
+bool is_sample_archive(std::string fileName);
+
+// Writes records first..last (1 based, inclusive) of the archive either as
+// dot-bracket lines to outFile, or as one CT file per record under ctDir.
+void sample_archive_export(std::string archiveFile, unsigned long long first, unsigned long long last, std::string outFile, bool ctFormat, std::string ctDir);
+
+#endif
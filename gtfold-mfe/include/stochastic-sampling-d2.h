@@ -6,13 +6,24 @@
 #include <fstream>
 #include <stdio.h>
 #include <stack>
+#include <map>
+#include <vector>
 #include <stdlib.h>
 #include "partition-func-d2.h"
 #include "energy.h"
+#include "sample-archive.h"
 #include <math.h>
+#include <stdarg.h>
 #include <random>
 
 using namespace std;
+
+//log(exp(a)+exp(b)) without leaving the log domain
+static inline double log_add(double a, double b){
+	if(a < b){ double t = a; a = b; b = t; }
+	if(b == -INFINITY) return a;
+	return a + log1p(exp(b - a));
+}
 //#include "MyDouble.cc"
 /*
 #ifdef __cplusplus
@@ -55,7 +66,7 @@ public:
 			}
 		};
 	private:		
-		std::mt19937 random_engine;
+		std::vector<std::mt19937> random_engines;//one engine per thread, samples and their branches are traced back concurrently
 		pf_shel_check fraction;
 		bool checkFraction;
 		bool PF_D2_UP_APPROX_ENABLED;
@@ -64,38 +75,94 @@ public:
 
 		PartitionFunctionD2<MyDouble> pf_d2;
 
+		//natural logarithms of the partition function arrays, converted once after the fill, so
+		//that every traceback decision is computed in native doubles whatever MyDouble the fill needed.
+		//Only j>=i-2 is stored, each MyDouble array is freed as soon as it is converted.
+		double** log_u;
+		double** log_up;
+		double** log_upm;
+		double** log_s1;
+		double** log_s2;
+		double** log_s3;
+		double** log_u1;
+		int log_arrays_len;
+		MyDouble pf_u;//u(1,length), for the probabilities of the samples once the arrays are freed
+		bool keep_pf_arrays;//for printPfMatrixesToFile
+		typedef MyDouble (PartitionFunctionD2<MyDouble>::*pf_table_get)(int i, int j);
+		double** create_log_array(int k, pf_table_get get, int len);
+		void create_log_arrays();
+		void free_log_arrays();
+
 		int print_energy_decompose;
 		FILE* energy_decompose_outfile;
+		//when sampling in parallel, every thread collects the decomposition of the sample
+		//it is tracing back in its own buffer, the buffers are written out in sample order
+		bool energy_decompose_buffered;
+		std::vector<std::string> energy_decompose_thread;
 		//std::stack<base_pair> g_stack;
 		//double energy;
 		int length;
                 int PF_COUNT_MODE;
                 int NO_DANGLE_MODE;
+		double scale_factor;
+
+		//binary sample archive, used instead of the text samples file when enabled
+		SampleArchiveWriter sample_archive;
+		std::string sample_archive_file;
+		std::string sample_archive_seq;
+		int sample_archive_dangles;
+
+		//non-redundant sampling: every traceback decision taken so far is a node of a prefix tree
+		//over the decision sequence, children are keyed by the index of the alternative taken.
+		//covered is the probability mass, conditional on reaching the node, of the structures
+		//already returned below it, the weight of every alternative is discounted by it.
+		struct nr_node
+		{
+			double covered;
+			std::map<int,int> children;
+			nr_node() : covered(0.0) {}
+		};
+		bool nonredundant;
+		std::vector<nr_node> nr_tree;
+		int nr_cur;//node of the decision being made
+		int nr_alt;//index of the next alternative of that decision
+		double nr_alt_p;//undiscounted probability of the last alternative considered
+		double nr_sum;//discounted probability of the alternatives of the decision considered so far
+		bool nr_failed;//the draw fell through all alternatives, the sample is abandoned
+		std::vector<std::pair<int,double> > nr_path;//nodes reached and probability of the decision leading to them
 
  
-		MyDouble randdouble();
+		double randdouble();
+		double nr_rand();
+		double nr_term(double p);
+		void nr_take();
+		bool nr_fail();
+		void nr_begin();
+		bool nr_finish();
                 bool feasible(int i, int j);
 		
-		MyDouble U_0(int i, int j);
-		MyDouble U_ihj(int i, int h, int j);
-		MyDouble U_s1_ihj(int i, int h, int j);
+		double U_0(int i, int j);
+		double U_ihj(int i, int h, int j);
+		double U_s1_ihj(int i, int h, int j);
 
-		MyDouble S1_ihlj(int i, int h, int l, int j);
+		double S1_ihlj(int i, int h, int l, int j);
 
-		MyDouble Q_H_ij(int i, int j);
-		MyDouble Q_S_ij(int i, int j);
-		MyDouble Q_M_ij(int i, int j);
-		MyDouble Q_BI_ihlj(int i, int h, int l, int j);
+		double Q_H_ij(int i, int j);
+		double Q_S_ij(int i, int j);
+		double Q_M_ij(int i, int j);
+		double Q_BI_ihlj(int i, int h, int l, int j);
 
-		MyDouble UPM_S2_ihj(int i, int h, int j);
+		double UPM_S2_ihj(int i, int h, int j);
 
-		MyDouble S2_ihlj(int i, int h, int l, int j);
+		double S2_ihlj(int i, int h, int l, int j);
 
-		MyDouble U1_s3_ihj(int i, int h, int j);
+		double U1_s3_ihj(int i, int h, int j);
 
-		MyDouble S3_ihlj(int i, int h, int l, int j);
-		MyDouble S3_MB_ihlj(int i, int h, int l, int j);
+		double S3_ihlj(int i, int h, int l, int j);
+		double S3_MB_ihlj(int i, int h, int l, int j);
 
+		void decompose_printf(const char* format, ...);
+		void printEnergyDecomposeSummary(int* structure, std::string ensemble, int length, double energy);
 		void set_single_stranded(int i, int j, int* structure);
 		void set_base_pair(int i, int j, int* structure);
 		void rnd_u(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack);
@@ -107,18 +174,28 @@ public:
 		void rnd_u1(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack);
 		void rnd_s3(int i, int h, int j, int* structure, double & energy, std::stack<base_pair>& g_stack);
 		void rnd_s3_mb(int i, int h, int l, int j, int* structure, double & energy, std::stack<base_pair>& g_stack);
+		void rnd_step(const base_pair& bp, int* structure, double & energy, std::stack<base_pair>& g_stack);
+		void rnd_subtree_task(base_pair bp, int* structure, double* energy);
 		double rnd_structure(int* structure);
 		double rnd_structure_parallel(int* structure, int threads_for_one_sample);
 		void updateBppFreq(std::string struc_str, int struc_freq, int ** bpp_freq, int length, int& total_bpp_freq);
 		void printEnergyAndStructureInDotBracketAndTripletNotation(int* structure, std::string ensemble, int length, double energy, ostream& outfile);
+		std::string getEnergyAndStructureLine(int* structure, std::string ensemble, int length, double energy);
+		double boltzmannProbability(double energy, MyDouble U);
+		void openSampleOutput(std::string samplesOutputFile, ofstream& outfile);
+		void closeSampleOutput(std::string samplesOutputFile, ofstream& outfile);
 		std::string getStructureStringInTripletNotation(int* structure, int length);
 		std::string getStructureStringInTripletNotation(const char* ensemble, int length);
 	public:
+		StochasticTracebackD2() : keep_pf_arrays(false) {}
 		void initialize(int length1, int PF_COUNT_MODE1, int NO_DANGLE_MODE1, int print_energy_decompose, bool PF_D2_UP_APPROX_ENABLED, bool checkFraction1, std::string energy_decompose_output_file, double scaleFactor);
 		void free_traceback();
+		void enableSampleArchive(std::string archiveFile, std::string seq, int dangles);
+		void enableNonRedundantSampling();
 		void batch_sample(int num_rnd, bool ST_D2_ENABLE_SCATTER_PLOT, bool ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION, bool ST_D2_ENABLE_UNIFORM_SAMPLE, double ST_D2_UNIFORM_SAMPLE_ENERGY, bool ST_D2_ENABLE_BPP_PROBABILITY, std::string sampleOutFile, std::string estimateBppOutputFile, std::string scatterPlotOutputFile);
 		void batch_sample_parallel(int num_rnd, bool ST_D2_ENABLE_SCATTER_PLOT, bool ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION, bool ST_D2_ENABLE_BPP_PROBABILITY, std::string sampleOutFile, std::string estimateBppOutputFile, std::string scatterPlotOutputFile);
 		void batch_sample_and_dump(int num_rnd, std::string ctFileDumpDir, std::string stochastic_summery_file_name, std::string seq, std::string seqfile);
+		void enablePfArraysOutput();
 		void printPfMatrixesToFile(std::string pfArraysOutputFile);
 };
 
@@ -146,9 +223,17 @@ template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::initialize(int length1, int PF_COUNT_MODE1, int NO_DANGLE_MODE1, int print_energy_decompose1, bool PF_D2_UP_APPROX_ENABLED1, bool checkFraction1, std::string energy_decompose_output_file, double scaleFactor){
 	checkFraction = checkFraction1;
 	length = length1;
-	random_engine.seed(time(NULL));
+	int engine_count = MAX(omp_get_max_threads(), g_nthreads);
+	random_engines.resize(engine_count);
+	for(int t=0; t<engine_count; ++t){
+		std::seed_seq seeds{(unsigned int)time(NULL), (unsigned int)t};
+		random_engines[t].seed(seeds);
+	}
 	//if(checkFraction) fraction = pf_shel_check(length);
 	print_energy_decompose = print_energy_decompose1; 
+	energy_decompose_buffered = false;
+	nonredundant = false;
+	nr_failed = false;
 	if(print_energy_decompose==1){
 		//open file handler with file energy_decompose_output_file
 		//FILE* energy_decompose_outfile;
@@ -165,11 +250,65 @@ void StochasticTracebackD2<MyDouble>::initialize(int length1, int PF_COUNT_MODE1
 	PF_COUNT_MODE = PF_COUNT_MODE1;
 	NO_DANGLE_MODE = NO_DANGLE_MODE1;
 	PF_D2_UP_APPROX_ENABLED = PF_D2_UP_APPROX_ENABLED1;
+	scale_factor = scaleFactor;
 	pf_d2.calculate_partition(length,PF_COUNT_MODE,NO_DANGLE_MODE, PF_D2_UP_APPROX_ENABLED, scaleFactor);
+	create_log_arrays();
+}
+
+//Row i holds the columns from i-2 on, the traceback reads u(i+1,i), u1(i+1,i) and u1(i+2,i)
+//below the diagonal, the rows are packed into one block and shifted so that [i][j] indexes them.
+//Array k of the partition function is freed once it is converted, unless it is printed later.
+template <class MyDouble>
+double** StochasticTracebackD2<MyDouble>::create_log_array(int k, pf_table_get get, int len){
+	size_t size = 0;
+	for(int i=0; i<len; ++i) size += len - MAX(0, i-2);
+	double* block = new double[size];
+	double** arr = new double*[len];
+	size_t off = 0;
+	for(int i=0; i<len; ++i){
+		int start = MAX(0, i-2);
+		arr[i] = block + off - start;
+		off += len - start;
+	}
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for private(i) schedule(guided)
+	#endif
+	for(i=0; i<len; ++i){
+		for(int j=MAX(0, i-2); j<len; ++j) arr[i][j] = (pf_d2.*get)(i,j).toLog();
+	}
+	if(!keep_pf_arrays) pf_d2.free_partition_table(k);
+	return arr;
+}
+
+//Every decision probability of the traceback is a ratio of entries of these arrays times
+//Boltzmann factors of loop energies, so it is evaluated as exp of a sum of logarithms.
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::create_log_arrays(){
+	int len = length + 2;
+	log_arrays_len = len;
+	pf_u = pf_d2.get_u(1,length);
+	log_u = create_log_array(0, &PartitionFunctionD2<MyDouble>::get_u, len);
+	log_up = create_log_array(1, &PartitionFunctionD2<MyDouble>::get_up, len);
+	log_upm = create_log_array(2, &PartitionFunctionD2<MyDouble>::get_upm, len);
+	log_s1 = create_log_array(3, &PartitionFunctionD2<MyDouble>::get_s1, len);
+	log_s2 = create_log_array(4, &PartitionFunctionD2<MyDouble>::get_s2, len);
+	log_s3 = create_log_array(5, &PartitionFunctionD2<MyDouble>::get_s3, len);
+	log_u1 = create_log_array(6, &PartitionFunctionD2<MyDouble>::get_u1, len+1);
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::free_log_arrays(){
+	double** arrays[7] = {log_u, log_up, log_upm, log_s1, log_s2, log_s3, log_u1};
+	for(int k=0; k<7; ++k){
+		delete[] arrays[k][0];//row 0 starts the block
+		delete[] arrays[k];
+	}
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::free_traceback(){
+	free_log_arrays();
 	pf_d2.free_partition();
 	if(print_energy_decompose==1){
 		fclose(energy_decompose_outfile);
@@ -178,10 +317,138 @@ void StochasticTracebackD2<MyDouble>::free_traceback(){
 }
 
 template <class MyDouble>
-inline MyDouble StochasticTracebackD2<MyDouble>::randdouble()
+void StochasticTracebackD2<MyDouble>::enableSampleArchive(std::string archiveFile, std::string seq, int dangles){
+	sample_archive_file = archiveFile;
+	sample_archive_seq = seq;
+	sample_archive_dangles = dangles;
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::enableNonRedundantSampling(){
+	nonredundant = true;
+	nr_tree.clear();
+	nr_tree.push_back(nr_node());
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::openSampleOutput(std::string samplesOutputFile, ofstream& outfile){
+	if(!sample_archive_file.empty()){
+		sample_archive.open(sample_archive_file, sample_archive_seq, sample_archive_dangles, scale_factor);
+		return;
+	}
+	outfile.open(samplesOutputFile.c_str());
+	if(!outfile.good()){
+		cerr<<"Error in opening file: "<<samplesOutputFile<<endl;
+		exit(-1);
+	}
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::closeSampleOutput(std::string samplesOutputFile, ofstream& outfile){
+	if(sample_archive.isOpen()){
+		printf("\nStochastic samples (%llu) saved to archive %s\n", sample_archive.count(), sample_archive_file.c_str());
+		sample_archive.close();
+		return;
+	}
+	printf("\nStochastic samples saved to %s\n", samplesOutputFile.c_str());
+	outfile.close();
+}
+
+template <class MyDouble>
+double StochasticTracebackD2<MyDouble>::boltzmannProbability(double energy, MyDouble U){
+	MyDouble actual_p;
+	actual_p = (pf_d2.myExp(-(energy*100)/(RT)))/U;
+	return actual_p.toDouble();
+}
+
+template <class MyDouble>
+inline double StochasticTracebackD2<MyDouble>::randdouble()
+{
+	std::mt19937& random_engine = random_engines[omp_get_thread_num() % random_engines.size()];
+	return (double)(random_engine() - random_engine.min()) / (double)(random_engine.max() - random_engine.min());
+
+}
+
+//Every rnd_* decision draws its random number with nr_rand(), passes the probability of each
+//alternative through nr_term() and calls nr_take() on the alternative it picks. In the default
+//mode these are no-ops. In non-redundant mode the draw is scaled to the mass of the node not yet
+//covered and every alternative is weighted by the part of its subtree not yet returned, so that
+//a structure is never drawn twice and the others keep their relative Boltzmann probabilities.
+template <class MyDouble>
+inline double StochasticTracebackD2<MyDouble>::nr_rand()
 {
-	return MyDouble( (double)(random_engine() - random_engine.min()) / (double)(random_engine.max() - random_engine.min()) );
+	if(!nonredundant) return randdouble();
+	nr_alt = 0;
+	nr_sum = 0.0;
+	return randdouble() * (1.0 - nr_tree[nr_cur].covered);
+}
 
+template <class MyDouble>
+inline double StochasticTracebackD2<MyDouble>::nr_term(double p)
+{
+	if(!nonredundant) return p;
+	nr_alt_p = p;
+	std::map<int,int>::iterator it = nr_tree[nr_cur].children.find(nr_alt++);
+	if(it == nr_tree[nr_cur].children.end()){
+		nr_sum += nr_alt_p;
+		return p;
+	}
+	nr_sum += nr_alt_p * (1.0 - nr_tree[it->second].covered);
+	return p * (1.0 - nr_tree[it->second].covered);
+}
+
+template <class MyDouble>
+inline void StochasticTracebackD2<MyDouble>::nr_take()
+{
+	if(!nonredundant) return;
+	int child;
+	std::map<int,int>::iterator it = nr_tree[nr_cur].children.find(nr_alt-1);
+	if(it == nr_tree[nr_cur].children.end()){
+		child = nr_tree.size();
+		nr_tree.push_back(nr_node());
+		nr_tree[nr_cur].children[nr_alt-1] = child;
+	}
+	else child = it->second;
+	nr_cur = child;
+	nr_path.push_back(std::make_pair(child, nr_alt_p));
+}
+
+//Close to exhaustion the covered mass of a node and the discounted mass of its alternatives
+//differ by rounding, and the draw can fall through all of them. The node then takes the mass
+//actually left under it as its covered mass and the sample is traced back again from scratch.
+template <class MyDouble>
+bool StochasticTracebackD2<MyDouble>::nr_fail()
+{
+	if(!nonredundant) return false;
+	nr_tree[nr_cur].covered = MIN(1.0, MAX(0.0, 1.0 - nr_sum));
+	nr_failed = true;
+	return true;
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::nr_begin()
+{
+	nr_cur = 0;
+	nr_failed = false;
+	nr_path.clear();
+	nr_path.push_back(std::make_pair(0, 1.0));
+}
+
+//Marks the structure just traced back as returned, the node after its last decision is fully
+//covered and every node above it gains the probability of the rest of the path below it.
+//Returns false if the sample was abandoned by nr_fail() and has to be drawn again.
+template <class MyDouble>
+bool StochasticTracebackD2<MyDouble>::nr_finish()
+{
+	if(nr_failed) return false;
+	double prob = 1.0;
+	for(int k = (int)nr_path.size()-1; k >= 0; --k){
+		nr_node& node = nr_tree[nr_path[k].first];
+		node.covered += prob;
+		if(node.covered > 1.0) node.covered = 1.0;
+		prob *= nr_path[k].second;
+	}
+	return true;
 }
 
 template <class MyDouble>
@@ -192,86 +459,89 @@ inline bool StochasticTracebackD2<MyDouble>::feasible(int i, int j)
 
 //Probability calculation functions
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::U_0(int i, int j){
+double StochasticTracebackD2<MyDouble>::U_0(int i, int j){
 	//return (MyDouble(1.0))/pf_d2.get_u(i,j);
-	return pf_d2.myExp( pf_d2.get_M_RT()*(j-i+1) / RT) /pf_d2.get_u(i,j);
+	return exp(pf_d2.get_M_RT()*(j-i+1)/RT - log_u[i][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::U_ihj(int i, int h, int j){
+double StochasticTracebackD2<MyDouble>::U_ihj(int i, int h, int j){
 	//return (feasible(h,j) == true) ? (pf_d2.get_up(h,j)) * (pf_d2.myExp(-((pf_d2.ED5_new(h,j,h-1))+(pf_d2.ED3_new(h,j,j+1))+(pf_d2.auPenalty_new(h,j)))/RT)) / (pf_d2.get_u(i,j)) : MyDouble(0.0);
-	return (feasible(h,j) == true) ? (pf_d2.get_up(h,j)) * (pf_d2.myExp(-((pf_d2.ED5_new(h,j,h-1))+(pf_d2.ED3_new(h,j,j+1))+(pf_d2.auPenalty_new(h,j))-pf_d2.get_M_RT()*(h-i))/RT)) / (pf_d2.get_u(i,j)) : MyDouble(0.0);
+	return (feasible(h,j) == true) ? exp(log_up[h][j] - ((pf_d2.ED5_new(h,j,h-1))+(pf_d2.ED3_new(h,j,j+1))+(pf_d2.auPenalty_new(h,j))-pf_d2.get_M_RT()*(h-i))/RT - log_u[i][j]) : 0.0;
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::U_s1_ihj(int i, int h, int j){
+double StochasticTracebackD2<MyDouble>::U_s1_ihj(int i, int h, int j){
 	//return (pf_d2.get_s1(h,j)) / (pf_d2.get_u(i,j));
-	return (pf_d2.get_s1(h,j)) * (pf_d2.myExp(pf_d2.get_M_RT()*(h-i)/RT)) / (pf_d2.get_u(i,j));
+	return exp(log_s1[h][j] + pf_d2.get_M_RT()*(h-i)/RT - log_u[i][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::S1_ihlj(int i, int h, int l, int j){
+double StochasticTracebackD2<MyDouble>::S1_ihlj(int i, int h, int l, int j){
 	//return (feasible(h,l) == true) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.ED5_new(h,l,h-1))+(pf_d2.ED3_new(h,l,l+1))+(pf_d2.auPenalty_new(h,l)))/RT)) * (pf_d2.get_u(l+1,j)) / (pf_d2.get_s1(h,j)) : MyDouble(0.0);
-	return (feasible(h,l) == true) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.ED5_new(h,l,h-1))+(pf_d2.ED3_new(h,l,l+1))+(pf_d2.auPenalty_new(h,l)))/RT)) * (pf_d2.get_u(l+1,j)) / (pf_d2.get_s1(h,j)) : MyDouble(0.0);
+	return (feasible(h,l) == true) ? exp(log_up[h][l] - ((pf_d2.ED5_new(h,l,h-1))+(pf_d2.ED3_new(h,l,l+1))+(pf_d2.auPenalty_new(h,l)))/RT + log_u[l+1][j] - log_s1[h][j]) : 0.0;
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::Q_H_ij(int i, int j){
+double StochasticTracebackD2<MyDouble>::Q_H_ij(int i, int j){
 	//return (pf_d2.myExp(-(pf_d2.eH_new(i,j))/RT)) / (pf_d2.get_up(i,j));
-	return (pf_d2.myExp(-(pf_d2.eH_new(i,j)-pf_d2.get_M_RT()*(j-i+1))/RT)) / (pf_d2.get_up(i,j));
+	return exp(-(pf_d2.eH_new(i,j)-pf_d2.get_M_RT()*(j-i+1))/RT - log_up[i][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::Q_S_ij(int i, int j){
+double StochasticTracebackD2<MyDouble>::Q_S_ij(int i, int j){
 	//return (pf_d2.myExp(-(pf_d2.eS_new(i,j))/RT)) * (pf_d2.get_up(i+1,j-1)) / (pf_d2.get_up(i,j));
-	return (pf_d2.myExp(-(pf_d2.eS_new(i,j)-pf_d2.get_M_RT()*2)/RT)) * (pf_d2.get_up(i+1,j-1)) / (pf_d2.get_up(i,j));
+	return exp(-(pf_d2.eS_new(i,j)-pf_d2.get_M_RT()*2)/RT + log_up[i+1][j-1] - log_up[i][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::Q_M_ij(int i, int j){
+double StochasticTracebackD2<MyDouble>::Q_M_ij(int i, int j){
 	//return (pf_d2.get_upm(i,j)) / (pf_d2.get_up(i,j));
-	return (pf_d2.get_upm(i,j)) / (pf_d2.get_up(i,j));
+	return exp(log_upm[i][j] - log_up[i][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::Q_BI_ihlj(int i, int h, int l, int j){
+double StochasticTracebackD2<MyDouble>::Q_BI_ihlj(int i, int h, int l, int j){
 	//return feasible(h,l) ? (pf_d2.myExp(-1*(pf_d2.eL_new(i,j,h,l))/RT)) * (pf_d2.get_up(h,l)) / (pf_d2.get_up(i,j)) : MyDouble(0.0);
-	return feasible(h,l) ? (pf_d2.myExp(-1*(pf_d2.eL_new(i,j,h,l)-pf_d2.get_M_RT()*(h-i+j-l))/RT)) * (pf_d2.get_up(h,l)) / (pf_d2.get_up(i,j)) : MyDouble(0.0);
+	return feasible(h,l) ? exp(-1*(pf_d2.eL_new(i,j,h,l)-pf_d2.get_M_RT()*(h-i+j-l))/RT + log_up[h][l] - log_up[i][j]) : 0.0;
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::UPM_S2_ihj(int i, int h, int j){
+double StochasticTracebackD2<MyDouble>::UPM_S2_ihj(int i, int h, int j){
 	//return (pf_d2.get_s2(h,j)) * (pf_d2.myExp(-((pf_d2.EA_new())+ 2*(pf_d2.EC_new()) + (h-i-1)*(pf_d2.EB_new()) + (pf_d2.auPenalty_new(i,j)) + (pf_d2.ED5_new(j,i,j-1)) + (pf_d2.ED3_new(j,i,i+1)))/RT)) / (pf_d2.get_upm(i,j)); //TODO: Old impl, using ed3(j,i) instead of ed3(i,j), similarly in ed5
-	return (pf_d2.get_s2(h,j)) * (pf_d2.myExp(-((pf_d2.EA_new())+ 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new()) + (pf_d2.auPenalty_new(i,j)) + (pf_d2.ED5_new(j,i,j-1)) + (pf_d2.ED3_new(j,i,i+1))-pf_d2.get_M_RT()*(h-i))/RT)) / (pf_d2.get_upm(i,j)); //TODO: Old impl, using ed3(j,i) instead of ed3(i,j), similarly in ed5
 	//return (pf_d2.get_s2(h,j)) * (pf_d2.myExp(-((pf_d2.EA_new())+ 2*(pf_d2.EC_new()) + (h-i-1)*(pf_d2.EB_new()) + (pf_d2.auPenalty_new(i,j)) + (pf_d2.ED5_new(i,j,j-1)) + (pf_d2.ED3_new(i,j,i+1)))/RT)) / (pf_d2.get_upm(i,j)); //TODO: New impl, using ed3(i,j) instead of ed3(j,i), similarly in ed5
 	//return exp((-1)*ED3_new(j,i,i+1)/RT)* (s2[h][j] * exp((-1)*(EA_new()+2*EC_new()+(h-i-1)*EB_new())/RT))/upm[i][j];//TODO: New impl
+	return exp(log_s2[h][j] - ((pf_d2.EA_new())+ 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new()) + (pf_d2.auPenalty_new(i,j)) + (pf_d2.ED5_new(j,i,j-1)) + (pf_d2.ED3_new(j,i,i+1))-pf_d2.get_M_RT()*(h-i))/RT - log_upm[i][j]); //TODO: Old impl, using ed3(j,i) instead of ed3(i,j), similarly in ed5
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::S2_ihlj(int i, int h, int l, int j){
+double StochasticTracebackD2<MyDouble>::S2_ihlj(int i, int h, int l, int j){
 	//return feasible(h,l) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1)))/RT)) * (pf_d2.get_u1(l+1,j-1)) / pf_d2.get_s2(h,j) : MyDouble(0.0);
-	return feasible(h,l) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1))-pf_d2.get_M_RT())/RT)) * (pf_d2.get_u1(l+1,j-1)) / pf_d2.get_s2(h,j) : MyDouble(0.0);
+	return feasible(h,l) ? exp(log_up[h][l] - ((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1))-pf_d2.get_M_RT())/RT + log_u1[l+1][j-1] - log_s2[h][j]) : 0.0;
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::U1_s3_ihj(int i, int h, int j){
+double StochasticTracebackD2<MyDouble>::U1_s3_ihj(int i, int h, int j){
 	//return (pf_d2.get_s3(h,j)) * (pf_d2.myExp((-1)*((pf_d2.EC_new())+(h-i)*(pf_d2.EB_new()))/RT)) / (pf_d2.get_u1(i,j));
 	//return (pf_d2.get_s3(h,j)) * (pf_d2.myExp((-1)*((pf_d2.EC_new())+(h-i)*(pf_d2.EB_new())-pf_d2.get_M_RT()*(h-i))/RT)) / (pf_d2.get_u1(i,j));
-	return (pf_d2.get_s3(h,j)) * (pf_d2.myExp((-1)*((pf_d2.EB_new())+(h-i)*(pf_d2.EC_new())-pf_d2.get_M_RT()*(h-i))/RT)) / (pf_d2.get_u1(i,j));//Manoj111
+	return exp(log_s3[h][j] - ((pf_d2.EB_new())+(h-i)*(pf_d2.EC_new())-pf_d2.get_M_RT()*(h-i))/RT - log_u1[i][j]);//Manoj111
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::S3_ihlj(int i, int h, int l, int j){
+double StochasticTracebackD2<MyDouble>::S3_ihlj(int i, int h, int l, int j){
 	//return feasible(h,l) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1)))/RT)) * ( (pf_d2.myExp(-(j-l)*(pf_d2.EB_new())/RT)) * (pf_d2.f(j+1,h,l)) + (pf_d2.get_u1(l+1,j)) ) / (pf_d2.get_s3(h,j)) : MyDouble(0.0);
-	return feasible(h,l) ? (pf_d2.get_up(h,l)) * (pf_d2.myExp(-((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1)))/RT)) * ( (pf_d2.myExp(-(j-l)*(pf_d2.EC_new()-pf_d2.get_M_RT())/RT)) * (pf_d2.f(j+1,h,l)) + (pf_d2.get_u1(l+1,j)) ) / (pf_d2.get_s3(h,j)) : MyDouble(0.0);
+	if(!feasible(h,l)) return 0.0;
+	double term1 = -(j-l)*(pf_d2.EC_new()-pf_d2.get_M_RT())/RT;
+	double term2 = log_u1[l+1][j];
+	return exp(log_up[h][l] - ((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1)))/RT + log_add(term1, term2) - log_s3[h][j]);
 }
 
 template <class MyDouble>
-MyDouble StochasticTracebackD2<MyDouble>::S3_MB_ihlj(int i, int h, int l, int j){
-	MyDouble term1 =  (pf_d2.myExp(-(j-l)*(pf_d2.EB_new())/RT)) * (pf_d2.f(j+1,h,l));
+double StochasticTracebackD2<MyDouble>::S3_MB_ihlj(int i, int h, int l, int j){
 	//MyDouble term2 = (pf_d2.get_u1(l+1,j);
-	MyDouble term2 = (pf_d2.get_u1(l+1,j)*pf_d2.myExp(pf_d2.get_M_RT()*(l-j)/RT));
-	return  term1 / (term1+term2);
+	double term1 = -(j-l)*(pf_d2.EB_new())/RT;
+	double term2 = log_u1[l+1][j] + pf_d2.get_M_RT()*(l-j)/RT;
+	return 1.0/(1.0 + exp(term2 - term1));
 }
 
 /*
@@ -291,11 +561,12 @@ MyDouble StochasticTracebackD2<MyDouble>::S3_MB_ihlj(int i, int h, int l, int j)
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_u(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
-	cum_prob = cum_prob + U_0(i,j);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
+	cum_prob = cum_prob + nr_term(U_0(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction){
 			//printf("U_0(i, j)");
 			//printf("\n");
@@ -306,9 +577,10 @@ void StochasticTracebackD2<MyDouble>::rnd_u(int i, int j, int* structure, double
 
 	for (int h = i; h < j; ++h)
 	{
-		cum_prob = cum_prob + U_ihj(i,h,j);
+		cum_prob = cum_prob + nr_term(U_ihj(i,h,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("U_ihj(i, h, j)");
 				//printf("\n");
@@ -317,8 +589,8 @@ void StochasticTracebackD2<MyDouble>::rnd_u(int i, int j, int* structure, double
 			}
 			double e2 = ( (pf_d2.ED5_new(h,j,h-1)) + (pf_d2.ED3_new(h,j,j+1)) + (pf_d2.auPenalty_new(h,j)) );
 			if (print_energy_decompose == 1) {
-				fprintf(energy_decompose_outfile, " (pf_d2.ED5_new(h,j,h-1))=%f, (pf_d2.ED3_new(h,j,j+1))=%f, (pf_d2.auPenalty_new(h,j))=%f\n", (pf_d2.ED5_new(h,j,h-1))/100.0, (pf_d2.ED3_new(h,j,j+1))/100.0, (pf_d2.auPenalty_new(h,j))/100.0);
-				fprintf(energy_decompose_outfile, " U_ihj(i=%d,h=%d,j=%d)= %lf\n",i,h,j, e2/100.0);
+				decompose_printf(" (pf_d2.ED5_new(h,j,h-1))=%f, (pf_d2.ED3_new(h,j,j+1))=%f, (pf_d2.auPenalty_new(h,j))=%f\n", (pf_d2.ED5_new(h,j,h-1))/100.0, (pf_d2.ED3_new(h,j,j+1))/100.0, (pf_d2.auPenalty_new(h,j))/100.0);
+				decompose_printf(" U_ihj(i=%d,h=%d,j=%d)= %lf\n",i,h,j, e2/100.0);
 				
 			}
 			energy += e2;
@@ -333,9 +605,10 @@ void StochasticTracebackD2<MyDouble>::rnd_u(int i, int j, int* structure, double
 	int h1 = -1;
 	for (int h = i;  h < j-1; ++h)
 	{
-		cum_prob = cum_prob + U_s1_ihj(i,h,j);
+		cum_prob = cum_prob + nr_term(U_s1_ihj(i,h,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("U_s1_ihj(i, h, j)");
 				//printf("\n");
@@ -348,18 +621,20 @@ void StochasticTracebackD2<MyDouble>::rnd_u(int i, int j, int* structure, double
 		}
 	}
 	//printf("rnd=");rnd.print();printf(",cum_prob=");cum_prob.print();
+	if(nr_fail()) return;
 	assert (0) ;
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_s1(int i, int h, int j, int* structure, double & energy, std::stack<base_pair>& g_stack){
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	for (int l = h+1; l < j; ++l)
 	{
-		cum_prob = cum_prob + S1_ihlj(i,h,l,j);
+		cum_prob = cum_prob + nr_term(S1_ihlj(i,h,l,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("S1_ihlj(i,h,l,j)");
 				//printf("\n");
@@ -369,8 +644,8 @@ void StochasticTracebackD2<MyDouble>::rnd_s1(int i, int h, int j, int* structure
 			}
 			double e2 = (pf_d2.ED5_new(h,l,h-1))+ (pf_d2.auPenalty_new(h,l)) + (pf_d2.ED3_new(h,l,l+1));
 			if (print_energy_decompose == 1) {
-				fprintf(energy_decompose_outfile, "(pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
-				fprintf(energy_decompose_outfile, "(%d %d) %lf\n",i,j, e2/100.0);
+				decompose_printf("(pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
+				decompose_printf("(%d %d) %lf\n",i,j, e2/100.0);
 			}
 			energy += e2;
 			base_pair bp1(h,l,UP);
@@ -380,14 +655,15 @@ void StochasticTracebackD2<MyDouble>::rnd_s1(int i, int h, int j, int* structure
 			return ;
 		}
 	}
+	if(nr_fail()) return;
 	assert(0);
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	assert(structure[i] == 0);
 	assert(structure[j] == 0);
 
@@ -399,9 +675,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 		//for (int l = h+1; l < j; ++l)
 		{
 			if (h == i+1 && l == j-1) continue;
-			cum_prob = cum_prob + Q_BI_ihlj(i,h,l,j);
+			cum_prob = cum_prob + nr_term(Q_BI_ihlj(i,h,l,j));
 			if (rnd < cum_prob)
 			{
+				nr_take();
 				if(checkFraction) {
 					//printf("Q_BI_ihlj(i, h, l, j)");
 					//printf("\n");
@@ -410,7 +687,7 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 				}
 				double e2 = (pf_d2.eL_new(i,j,h,l));
 				if (print_energy_decompose == 1) 
-					fprintf(energy_decompose_outfile, "IntLoop(%d %d) %lf\n",i,j, e2/100.0);
+					decompose_printf("IntLoop(%d %d) %lf\n",i,j, e2/100.0);
 				energy += e2;
 				base_pair bp(h,l,UP);
 				g_stack.push(bp);
@@ -419,9 +696,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 			}
 		}
 
-	cum_prob = cum_prob + Q_H_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_H_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction){
 			//printf("Q_H_ij(i, j)");
 			//printf("\n");
@@ -429,16 +707,17 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 		}
 		double e2 = (pf_d2.eH_new(i,j));
 		if (print_energy_decompose == 1) 
-			fprintf(energy_decompose_outfile, "Hairpin(%d %d) %lf\n",i,j, e2/100.0);
+			decompose_printf("Hairpin(%d %d) %lf\n",i,j, e2/100.0);
 		energy += e2;
 		//set_single_stranded(i+1,j-1,structure);
 		
 		return ;
 	}
 
-	cum_prob = cum_prob + Q_S_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_S_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction) {
 			//printf("Q_S_ij(i,j)");
 			//printf("\n");
@@ -447,7 +726,7 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 		}
 		double e2 = (pf_d2.eS_new(i,j));
 		if (print_energy_decompose == 1) 
-			fprintf(energy_decompose_outfile, "Stack(%d %d) %lf\n",i,j, e2/100.0);
+			decompose_printf("Stack(%d %d) %lf\n",i,j, e2/100.0);
 		energy+=e2;
 		base_pair bp(i+1,j-1,UP);
 		g_stack.push(bp);
@@ -455,9 +734,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 		return ;
 	}
 
-	cum_prob = cum_prob + Q_M_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_M_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction) {
 			//printf("Q_M_ij(i,j)");
 			//printf("\n");
@@ -472,9 +752,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 		for (int l = h+1; l < j; ++l)
 		{
 			if (h == i+1 && l == j-1) continue;
-			cum_prob = cum_prob + Q_BI_ihlj(i,h,l,j);
+			cum_prob = cum_prob + nr_term(Q_BI_ihlj(i,h,l,j));
 			if (rnd < cum_prob)
 			{
+				nr_take();
 				if(checkFraction) {
 					//printf("Q_BI_ihlj(i,h,l,j)");
 					//printf("\n");
@@ -483,7 +764,7 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 				}
 				double e2 = (pf_d2.eL_new(i,j,h,l));
 				if (print_energy_decompose == 1) 
-					fprintf(energy_decompose_outfile, "IntLoop(%d %d) %lf\n",i,j, e2/100.0);
+					decompose_printf("IntLoop(%d %d) %lf\n",i,j, e2/100.0);
 				energy += e2;
 				base_pair bp(h,l,UP);
 				g_stack.push(bp);
@@ -491,14 +772,15 @@ void StochasticTracebackD2<MyDouble>::rnd_up(int i, int j, int* structure, doubl
 			}
 		}
 */
+	if(nr_fail()) return;
 	assert(0);
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	assert(structure[i] == 0);
 	assert(structure[j] == 0);
 
@@ -511,9 +793,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
 		int maxq = (p==(i+1))?(j-2):(j-1);
 		for (int q = minq; q <=maxq ; ++q)
 		{
-			cum_prob = cum_prob + Q_BI_ihlj(i,p,q,j);
+			cum_prob = cum_prob + nr_term(Q_BI_ihlj(i,p,q,j));
 			if (rnd < cum_prob)
 			{
+				nr_take();
 				if(checkFraction) {
                                         //printf("Q_BI_ihlj(i, h, l, j)");
                                         //printf("\n");
@@ -522,7 +805,7 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
                                 }
 				double e2 = (pf_d2.eL_new(i,j,p,q));
 				if (print_energy_decompose == 1) 
-					fprintf(energy_decompose_outfile, "IntLoop(%d %d) %lf\n",i,j, e2/100.0);
+					decompose_printf("IntLoop(%d %d) %lf\n",i,j, e2/100.0);
 			
 				energy += e2;
 				base_pair bp(p,q,UP);
@@ -532,9 +815,10 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
 		}
 	}
 
-	cum_prob = cum_prob + Q_H_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_H_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction){
                         //printf("Q_H_ij(i, j)");
                         //printf("\n");
@@ -542,15 +826,16 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
                 }
 		double e2 = (pf_d2.eH_new(i,j));
 		if (print_energy_decompose == 1) 
-			fprintf(energy_decompose_outfile, "Hairpin(%d %d) %lf\n",i,j, e2/100.0);
+			decompose_printf("Hairpin(%d %d) %lf\n",i,j, e2/100.0);
 		energy += e2;
 		//set_single_stranded(i+1,j-1,structure);
 		return ;
 	}
 
-	cum_prob = cum_prob + Q_S_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_S_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction) {
 			//printf("Q_S_ij(i,j)");
 			//printf("\n");
@@ -559,16 +844,17 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
 		}
 		double e2 = (pf_d2.eS_new(i,j));
 		if (print_energy_decompose == 1) 
-			fprintf(energy_decompose_outfile, "Stack(%d %d) %lf\n",i,j, e2/100.0);
+			decompose_printf("Stack(%d %d) %lf\n",i,j, e2/100.0);
 		energy+=e2;
 		base_pair bp(i+1,j-1,UP);
 		g_stack.push(bp);
 		return ;
 	}
 
-	cum_prob = cum_prob + Q_M_ij(i,j);
+	cum_prob = cum_prob + nr_term(Q_M_ij(i,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction) {
 			//printf("Q_M_ij(i,j)");
 			//printf("\n");
@@ -579,6 +865,7 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
 		return;
 	}
 
+	if(nr_fail()) return;
 	assert(0);
 }
 
@@ -586,16 +873,17 @@ void StochasticTracebackD2<MyDouble>::rnd_up_approximate(int i, int j, int* stru
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_u1(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 
 	int h1 = -1;
 	//for (int h = i+1; h < j-1; ++h)//TODO OLD 
 	for (int h = i; h < j; ++h)//TODO NEW 
 	{
-		cum_prob = cum_prob + U1_s3_ihj(i,h,j);
+		cum_prob = cum_prob + nr_term(U1_s3_ihj(i,h,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("U1_s3_ihj(i,h,j)");
 				//printf("\n");
@@ -604,8 +892,8 @@ void StochasticTracebackD2<MyDouble>::rnd_u1(int i, int j, int* structure, doubl
 			}
 			double e2 = (pf_d2.EB_new()) + (h-i)*(pf_d2.EC_new());
 			if (print_energy_decompose == 1){ 
-				fprintf(energy_decompose_outfile, "(pf_d2.EB_new())=%f (h-i)*(pf_d2.EC_new())=%f\n",(pf_d2.EB_new())/100.0, (h-i)*(pf_d2.EC_new())/100.0);
-				fprintf(energy_decompose_outfile, "U1_s3_ihj(%d %d %d) %lf\n",i,h,j, e2/100.0);
+				decompose_printf("(pf_d2.EB_new())=%f (h-i)*(pf_d2.EC_new())=%f\n",(pf_d2.EB_new())/100.0, (h-i)*(pf_d2.EC_new())/100.0);
+				decompose_printf("U1_s3_ihj(%d %d %d) %lf\n",i,h,j, e2/100.0);
 			}
 			energy += e2;
 			h1 = h;
@@ -613,19 +901,21 @@ void StochasticTracebackD2<MyDouble>::rnd_u1(int i, int j, int* structure, doubl
 			return;
 		}
 	}
+	if(nr_fail()) return;
 	assert(0);
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_s3(int i, int h, int j, int* structure, double & energy, std::stack<base_pair>& g_stack){
 	// sample l given h1 
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	for (int l = h+1; l <= j &&  l+1<=length ; ++l)
 	{
-		cum_prob = cum_prob +  S3_ihlj(i,h,l,j);
+		cum_prob = cum_prob + nr_term(S3_ihlj(i,h,l,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("S3_ihlj(i,h,l,j)");
 				//printf("\n");
@@ -635,8 +925,8 @@ void StochasticTracebackD2<MyDouble>::rnd_s3(int i, int h, int j, int* structure
 			}
 			double e2 = ((pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1)));
 			if (print_energy_decompose == 1) {
-				fprintf(energy_decompose_outfile, "(pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
-				fprintf(energy_decompose_outfile, "S3_ihlj(%d %d %d %d) %lf\n",i,h,l,j,e2/100.0);
+				decompose_printf("(pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
+				decompose_printf("S3_ihlj(%d %d %d %d) %lf\n",i,h,l,j,e2/100.0);
 			}
 			energy += e2;
 			base_pair bp(h,l,UP);
@@ -645,16 +935,18 @@ void StochasticTracebackD2<MyDouble>::rnd_s3(int i, int h, int j, int* structure
 			return;
 		}
 	}
+	if(nr_fail()) return;
 	assert(0);
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_s3_mb(int i, int h, int l, int j, int* structure, double & energy, std::stack<base_pair>& g_stack){//shel's document call this method with arguments i,h,l,j+1 therefore one will see difference of 1 in this code and shel's document
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
-	cum_prob = cum_prob +  S3_MB_ihlj(i,h,l,j);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
+	cum_prob = cum_prob + nr_term(S3_MB_ihlj(i,h,l,j));
 	if (rnd < cum_prob)
 	{
+		nr_take();
 		if(checkFraction) {
 			//printf("S3_MB_ihlj(i,h,l,j)");
 			//printf("\n");
@@ -663,14 +955,20 @@ void StochasticTracebackD2<MyDouble>::rnd_s3_mb(int i, int h, int l, int j, int*
 		double tt =  0;//(j == l)? 0 : (pf_d2.ED3_new(h,l,l+1));//this term is corresponding to f(j+1,h,l)
 		double e2 = tt + (j-l)*(pf_d2.EC_new());
 		if (print_energy_decompose == 1){
-			fprintf(energy_decompose_outfile, "j=%d,l=%d,tt=(j == l)?0:(pf_d2.ED3_new(h,l,l+1))=%f,(j-l)*(pf_d2.EC_new())=%f\n",j,l,tt/100.0,(j-l)*(pf_d2.EC_new())/100.0);
-			fprintf(energy_decompose_outfile, "S3_MB_ihlj(%d %d %d %d) %lf\n",i,h,l,j, e2/100.0);
+			decompose_printf("j=%d,l=%d,tt=(j == l)?0:(pf_d2.ED3_new(h,l,l+1))=%f,(j-l)*(pf_d2.EC_new())=%f\n",j,l,tt/100.0,(j-l)*(pf_d2.EC_new())/100.0);
+			decompose_printf("S3_MB_ihlj(%d %d %d %d) %lf\n",i,h,l,j, e2/100.0);
 		}
 		energy += e2;
 		
 		return;
 	}
 	else{
+		if(nonredundant){
+			//the rest of the mass may be exhausted as well
+			cum_prob = cum_prob + nr_term(1.0 - S3_MB_ihlj(i,h,l,j));
+			if(rnd >= cum_prob && nr_fail()) return;
+			nr_take();
+		}
 		base_pair bp1(l+1,j,U1);
 		g_stack.push(bp1);
 		return;
@@ -681,17 +979,18 @@ void StochasticTracebackD2<MyDouble>::rnd_s3_mb(int i, int h, int l, int j, int*
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_upm(int i, int j, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	if (print_energy_decompose == 1)
-		fprintf(energy_decompose_outfile, "Multiloop (%d %d)\n",i,j);
+		decompose_printf("Multiloop (%d %d)\n",i,j);
 
 	int h1 = -1;
 	for (int h = i+1; h < j-1; ++h)
 	{
-		cum_prob = cum_prob + UPM_S2_ihj(i,h,j);
+		cum_prob = cum_prob + nr_term(UPM_S2_ihj(i,h,j));
 		if (rnd < cum_prob )
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("UPM_S2_ihj(i,h,j)");
 				//printf("\n");
@@ -703,27 +1002,29 @@ void StochasticTracebackD2<MyDouble>::rnd_upm(int i, int j, int* structure, doub
 			energy += e2;
 			h1 = h;
 			if (print_energy_decompose == 1) {
-				fprintf(energy_decompose_outfile, "(pf_d2.EA_new())=%f, (pf_d2.EC_new())=%f, (pf_d2.EB_new())=%f\n",(pf_d2.EA_new())/100.0, (pf_d2.EC_new())/100.0, (pf_d2.EB_new())/100.0);
-				fprintf(energy_decompose_outfile, "(pf_d2.EA_new()) + 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new())=%f, (pf_d2.auPenalty_new(i,j))=%f, (pf_d2.ED5_new(j,i,j-1))=%f, (pf_d2.ED3_new(j,i,i+1))=%f\n",((pf_d2.EA_new()) + 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new()))/100.0, (pf_d2.auPenalty_new(i,j))/100.0, (pf_d2.ED5_new(j,i,j-1))/100.0, (pf_d2.ED3_new(j,i,i+1))/100.0);
-				fprintf(energy_decompose_outfile, "%s(%d %d %d) %lf\n", "UPM_S2_ihj",i,h1,j,e2/100.0);
+				decompose_printf("(pf_d2.EA_new())=%f, (pf_d2.EC_new())=%f, (pf_d2.EB_new())=%f\n",(pf_d2.EA_new())/100.0, (pf_d2.EC_new())/100.0, (pf_d2.EB_new())/100.0);
+				decompose_printf("(pf_d2.EA_new()) + 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new())=%f, (pf_d2.auPenalty_new(i,j))=%f, (pf_d2.ED5_new(j,i,j-1))=%f, (pf_d2.ED3_new(j,i,i+1))=%f\n",((pf_d2.EA_new()) + 2*(pf_d2.EB_new()) + (h-i-1)*(pf_d2.EC_new()))/100.0, (pf_d2.auPenalty_new(i,j))/100.0, (pf_d2.ED5_new(j,i,j-1))/100.0, (pf_d2.ED3_new(j,i,i+1))/100.0);
+				decompose_printf("%s(%d %d %d) %lf\n", "UPM_S2_ihj",i,h1,j,e2/100.0);
 			}
 			rnd_s2(i,h1,j, structure, energy, g_stack);
 			return;
 		}
 	}
 	//assert(h1!=-1);
+	if(nr_fail()) return;
 	assert(0);
 }
 
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::rnd_s2(int i, int h, int j, int* structure, double & energy, std::stack<base_pair>& g_stack){
-	MyDouble rnd = randdouble();
-	MyDouble cum_prob(0.0);
+	double rnd = nr_rand();
+	double cum_prob = 0.0;
 	for (int l = h+1; l < j; ++l)
 	{
-		cum_prob = cum_prob + S2_ihlj(i,h,l,j);
+		cum_prob = cum_prob + nr_term(S2_ihlj(i,h,l,j));
 		if (rnd < cum_prob)
 		{
+			nr_take();
 			if(checkFraction) {
 				//printf("S2_ihlj(i,h,l,j)");
 				//printf("\n");
@@ -734,8 +1035,8 @@ void StochasticTracebackD2<MyDouble>::rnd_s2(int i, int h, int j, int* structure
 			double e2 = (pf_d2.auPenalty_new(h,l)) + (pf_d2.ED5_new(h,l,h-1)) + (pf_d2.ED3_new(h,l,l+1));       
 			energy += e2;
 			if (print_energy_decompose == 1){
-				fprintf(energy_decompose_outfile, "(pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
-				fprintf(energy_decompose_outfile, "%s(%d %d %d %d) %lf\n"," S2_ihlj",i,h,l,j, e2/100.0);
+				decompose_printf("(pf_d2.auPenalty_new(h,l))=%f, (pf_d2.ED5_new(h,l,h-1))=%f, (pf_d2.ED3_new(h,l,l+1))=%f\n",(pf_d2.auPenalty_new(h,l))/100.0, (pf_d2.ED5_new(h,l,h-1))/100.0, (pf_d2.ED3_new(h,l,l+1))/100.0);
+				decompose_printf("%s(%d %d %d %d) %lf\n"," S2_ihlj",i,h,l,j, e2/100.0);
 			}
 			base_pair bp1(h,l,UP);
 			base_pair bp2(l+1,j-1,U1);
@@ -745,6 +1046,7 @@ void StochasticTracebackD2<MyDouble>::rnd_s2(int i, int h, int j, int* structure
 			return;
 		}
 	}
+	if(nr_fail()) return;
 	assert(0);
 }
 
@@ -759,20 +1061,12 @@ double StochasticTracebackD2<MyDouble>::rnd_structure(int* structure)
 	g_stack.push(first);
 	double energy = 0.0;
 	if(checkFraction) fraction = pf_shel_check(length);
-	while (!g_stack.empty())
+	while (!g_stack.empty() && !nr_failed)
 	{
 		base_pair bp = g_stack.top();
 		//   std::cout << bp;
 		g_stack.pop();
-
-		if (bp.type() == U)
-			rnd_u(bp.i,bp.j, structure, energy, g_stack);
-		else if (bp.type() == UP){
-			if(pf_d2.PF_D2_UP_APPROX_ENABLED) {rnd_up_approximate(bp.i,bp.j, structure, energy, g_stack);}
-			else rnd_up(bp.i,bp.j, structure, energy, g_stack);
-		}
-		else if (bp.type() == U1)
-			rnd_u1(bp.i,bp.j, structure, energy, g_stack);
+		rnd_step(bp, structure, energy, g_stack);
 	}
 	if(checkFraction){
 		int remains = fraction.count();
@@ -784,75 +1078,67 @@ double StochasticTracebackD2<MyDouble>::rnd_structure(int* structure)
 }
 
 template <class MyDouble>
-double StochasticTracebackD2<MyDouble>::rnd_structure_parallel(int* structure, int threads_for_one_sample)
+inline void StochasticTracebackD2<MyDouble>::rnd_step(const base_pair& bp, int* structure, double & energy, std::stack<base_pair>& g_stack)
 {
-	//printf("%lf %lf %lf\n", EA_new(), EB_new(), EC_new());
-	srand(rand());
-	//MyDouble U = pf_d2.get_u(1,len);
-	base_pair first(1,length,U);
-	//std::stack<base_pair> g_stack;
-	std::stack<base_pair> g_stack;
-	g_stack.push(first);
-	double energy = 0.0;
-	std::stack<base_pair> g_stack_threads[threads_for_one_sample];
-	double* energy_threads = new double[threads_for_one_sample];
-	for(int index=0; index<threads_for_one_sample; ++index)energy_threads[index]=0.0;
+	if (bp.type() == U)
+		rnd_u(bp.i,bp.j, structure, energy, g_stack);
+	else if (bp.type() == UP){
+		if(pf_d2.PF_D2_UP_APPROX_ENABLED) rnd_up_approximate(bp.i,bp.j, structure, energy, g_stack);
+		else rnd_up(bp.i,bp.j, structure, energy, g_stack);
+	}
+	else if (bp.type() == U1)
+		rnd_u1(bp.i,bp.j, structure, energy, g_stack);
+}
 
+//Branches pushed by the traceback (exterior loop components, multiloop children) are
+//independent of each other, so every branch spanning at least ST_D2_TASK_MIN_SPAN bases
+//is handed to the OpenMP task pool, where idle threads pick it up. Shorter branches are
+//cheaper to trace back in place than to schedule.
+#define ST_D2_TASK_MIN_SPAN 64
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::rnd_subtree_task(base_pair bp, int* structure, double* energy)
+{
+	std::stack<base_pair> g_stack;
+	double local_energy = 0.0;
+	rnd_step(bp, structure, local_energy, g_stack);
 	while (!g_stack.empty())
 	{
-		if(g_stack.size()%threads_for_one_sample != 0){
-			base_pair bp = g_stack.top();
-			//   std::cout << bp;
-			g_stack.pop();
-
-			if (bp.type() == U)
-				rnd_u(bp.i,bp.j, structure, energy, g_stack);
-			else if (bp.type() == UP){
-				if(pf_d2.PF_D2_UP_APPROX_ENABLED) { rnd_up_approximate(bp.i,bp.j, structure, energy, g_stack);}
-				else rnd_up(bp.i,bp.j, structure, energy, g_stack);
-			}
-			else if (bp.type() == U1)
-				rnd_u1(bp.i,bp.j, structure, energy, g_stack);
-		}
-		else{
-			std::deque<base_pair> g_deque;
-			while(!g_stack.empty()){
-				base_pair bp = g_stack.top();
-				g_stack.pop();
-				g_deque.push_back(bp);
-			}
-			int index;
-			
+		base_pair child = g_stack.top();
+		g_stack.pop();
+		if (child.j - child.i >= ST_D2_TASK_MIN_SPAN) {
 			#ifdef _OPENMP
-			//#pragma omp parallel for private(index) shared(energy_threads, g_stack_threads, structure) schedule(guided) num_threads(threads_for_one_sample)
-			#pragma omp parallel for private(index) shared(energy_threads, g_stack_threads, structure) schedule(dynamic) num_threads(threads_for_one_sample)
-			//#pragma omp parallel for private(index) shared(energy_threads, g_stack_threads, structure) schedule(guided)
+			#pragma omp task firstprivate(child)
 			#endif
-			for (index = 0; index < (int)g_deque.size(); ++index) {
-				int thdId = omp_get_thread_num();
-				base_pair bp = g_deque[index];
-				if (bp.type() == U)
-					rnd_u(bp.i,bp.j, structure, energy_threads[thdId], g_stack_threads[thdId]);
-				else if (bp.type() == UP){
-					if(pf_d2.PF_D2_UP_APPROX_ENABLED) rnd_up_approximate(bp.i,bp.j, structure, energy_threads[thdId], g_stack_threads[thdId]);
-					else rnd_up(bp.i,bp.j, structure, energy_threads[thdId], g_stack_threads[thdId]);
-				}
-				else if (bp.type() == U1)
-					rnd_u1(bp.i,bp.j, structure, energy_threads[thdId], g_stack_threads[thdId]);
-			}
-
-			for(index=0; index<threads_for_one_sample; ++index){
-				energy += energy_threads[index];
-				energy_threads[index] = 0.0;
-				while(!g_stack_threads[index].empty()){
-					base_pair bp = g_stack_threads[index].top();
-					g_stack_threads[index].pop();
-					g_stack.push(bp);
-				}
-			}
+			rnd_subtree_task(child, structure, energy);
 		}
+		else rnd_step(child, structure, local_energy, g_stack);
+	}
+	#ifdef _OPENMP
+	#pragma omp atomic
+	#endif
+	*energy += local_energy;
+}
+
+template <class MyDouble>
+double StochasticTracebackD2<MyDouble>::rnd_structure_parallel(int* structure, int threads_for_one_sample)
+{
+	base_pair first(1,length,U);
+	double energy = 0.0;
+	#ifdef _OPENMP
+	if (omp_in_parallel()) {
+		//called from a sampling task, the branches join the pool of the enclosing team
+		#pragma omp taskgroup
+		rnd_subtree_task(first, structure, &energy);
 	}
-	delete[] energy_threads;
+	else {
+		#pragma omp parallel num_threads(threads_for_one_sample)
+		#pragma omp single
+		rnd_subtree_task(first, structure, &energy);
+	}
+	#else
+	rnd_subtree_task(first, structure, &energy);
+	#endif
 	return (double)energy/100.0;
 }
 
@@ -935,11 +1221,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 	MyDouble U;
 	
 	ofstream outfile;
-        outfile.open(samplesOutputFile.c_str());
-	if(!outfile.good()){
-                cerr<<"Error in opening file: "<<samplesOutputFile<<endl;
-                exit(-1);
-        }
+	openSampleOutput(samplesOutputFile, outfile);
 
 	/*if(PF_D2_UP_APPROX_ENABLED){
 	  double t1 = get_seconds();
@@ -953,7 +1235,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 	  }
 	  else U = pf_d2.get_u(1,length);*/
 	//U = pf_d2.get_u(1,length);
-	U = pf_d2.unscale(1,length,pf_d2.get_u(1,length));
+	U = pf_d2.unscale(1,length,pf_u);
 	srand(time(NULL));
 
 	int threads_for_one_sample = 1;
@@ -978,6 +1260,14 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 		int count, nsamples =0;
 		for (count = 1; count <= num_rnd; ++count) 
 		{
+			if(nonredundant){
+				if(1.0 - nr_tree[0].covered < 1e-12){
+					printf("Non-redundant sampling: the ensemble is exhausted after %d structures\n", nsamples);
+					num_rnd = nsamples;
+					break;
+				}
+				nr_begin();
+			}
 			nsamples++;
 			memset(structure, 0, (length+1)*sizeof(int));
 			double energy;
@@ -987,6 +1277,11 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 			else{
 				energy = rnd_structure(structure);
 			}
+			if(nonredundant && !nr_finish()){
+				count--;
+				nsamples--;
+				continue;
+			}
 
 			std::string ensemble(length+1,'.');
 			for (int i = 1; i <= (int)length; ++ i) {
@@ -1016,7 +1311,13 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 
 			//if(!ST_D2_ENABLE_SCATTER_PLOT){
 				//std::cout << ensemble.substr(1) << ' ' << energy << std::endl;
-				printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, outfile);
+				if(sample_archive.isOpen()){
+					std::string record;
+					sample_archive_encode(structure, length, energy, boltzmannProbability(energy, U), record);
+					sample_archive.append(record);
+					if(print_energy_decompose==1) printEnergyDecomposeSummary(structure, ensemble, (int)length, energy);
+				}
+				else printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, outfile);
 			//}
 		}
 		//std::cout << nsamples << std::endl;
@@ -1072,6 +1373,9 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 		else{
 			//printf("nsamples=%d\n",nsamples);
 		}
+		if(nonredundant){
+			printf("Non-redundant sampling: %d distinct structures, cumulative Boltzmann probability covered %.10f\n", nsamples, nr_tree[0].covered);
+		}
 		if(ST_D2_ENABLE_BPP_PROBABILITY){
 			ofstream estimateBppoutfile;
                         estimateBppoutfile.open(estimateBppOutputFile.c_str());
@@ -1107,8 +1411,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample(int num_rnd, bool ST_D2_ENABL
 
 	}
 	delete[] structure;
-	printf("\nStochastic samples saved to %s\n", samplesOutputFile.c_str());
-        outfile.close();
+	closeSampleOutput(samplesOutputFile, outfile);
 }
 
 template <class MyDouble>
@@ -1138,11 +1441,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample_parallel(int num_rnd, bool ST
 	//MyDouble U = pf_d2.get_u(1,length);
 	MyDouble U;
 	ofstream outfile;
-        outfile.open(samplesOutputFile.c_str());
-	if(!outfile.good()){
-		cerr<<"Error in opening file: "<<samplesOutputFile<<endl;
-		exit(-1);
-	}
+	openSampleOutput(samplesOutputFile, outfile);
 	/*if(PF_D2_UP_APPROX_ENABLED){
 	  double t1 = get_seconds();
 	  PartitionFunctionD2 pf_d2_exact_up;
@@ -1156,7 +1455,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample_parallel(int num_rnd, bool ST
 	  else U = pf_d2.get_u(1,length);
 	 */
 	//U = pf_d2.get_u(1,length);
-	U = pf_d2.unscale(1,length,pf_d2.get_u(1,length));
+	U = pf_d2.unscale(1,length,pf_u);
 
 	srand(time(NULL));
 	/*
@@ -1190,172 +1489,96 @@ void StochasticTracebackD2<MyDouble>::batch_sample_parallel(int num_rnd, bool ST
 		}
 	}
 	#endif
-	int threads_for_counts = total_used_threads;
-	int threads_for_one_sample = 1;
-
-	if(ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION){
-		int sample_count_per_thread = num_rnd/total_used_threads;
-		if(total_used_threads%2 !=0 || total_used_threads < 4 || length < 200 || sample_count_per_thread > 40){
-			threads_for_counts = total_used_threads;
-			threads_for_one_sample = 1;
-		}
-		else if(total_used_threads%4 !=0 || total_used_threads < 8 || length < 600 || sample_count_per_thread > 20 ){
-			threads_for_counts = total_used_threads/2;
-			threads_for_one_sample = 2;
-		}
-		else if(total_used_threads%8 !=0 || total_used_threads < 16 || length < 1500 || sample_count_per_thread > 10){
-			threads_for_counts = total_used_threads/4;
-			threads_for_one_sample = 4;
-		}
-		else if(total_used_threads%16 !=0 || total_used_threads < 32 || length < 3000 || sample_count_per_thread > 5 ){
-			threads_for_counts = total_used_threads/8;
-			threads_for_one_sample = 8;
-		}
-		else if(total_used_threads%32 !=0 || total_used_threads < 64 || length < 6000 || sample_count_per_thread > 2 ){
-			threads_for_counts = total_used_threads/16;
-			threads_for_one_sample = 16;
-		}
-		else{
-			threads_for_counts = total_used_threads/32;
-			threads_for_one_sample = 32;
-		}
-
-		fprintf(stdout,"Stochastic Traceback: Thread count for one sample parallelization: %3d \n",threads_for_one_sample);
-	}
-	fprintf(stdout,"Stochastic Traceback: Thread count for counts parallelization: %3d \n",threads_for_counts);
-
-
+	//Samples and the independent branches inside each sample are all scheduled as tasks of
+	//one thread team, so a few samples of a long sequence still keep every thread busy.
+	fprintf(stdout,"Stochastic Traceback: Thread count: %3d \n",total_used_threads);
 
 	std::map<std::string,std::pair<int,double> >  uniq_structs;
-	//std::map<std::string,std::pair<int,double> >  uniq_structs_thread[g_nthreads];
-	//g_nthreads=4;//TODO remove this line
-	//cout<<"Manoj after: g_nthreads="<<g_nthreads<<endl;
-	std::map<std::string,std::pair<int,double> > *  uniq_structs_thread = new std::map<std::string,std::pair<int,double> >[threads_for_counts];
-	int* structures_thread = new int[threads_for_counts*(length+1)];
+	std::map<std::string,std::pair<int,double> > *  uniq_structs_thread = new std::map<std::string,std::pair<int,double> >[total_used_threads];
 
 	if (num_rnd > 0 ) {
 		printf("\nSampling structures...\n");
-		int count;// nsamples =0;
-		int* countArr = new int [threads_for_counts];
-		for(int ind=0; ind<threads_for_counts; ind++) countArr[ind]=0;
-		#ifdef _OPENMP
-		//#pragma omp parallel for private (count) shared(structures_thread) schedule(guided) num_threads(threads_for_counts)
-		#pragma omp parallel for private (count) shared(structures_thread, countArr, uniq_structs_thread, outfile) schedule(guided) num_threads(threads_for_counts)
-		#endif
-		for (count = 1; count <= num_rnd; ++count) 
+		//Samples are generated in batches, each sample is formatted into its own buffer
+		//and the buffers are then written out by one thread in sample order, so the
+		//output never gets intermixed between threads.
+		const int batch_size = 16*total_used_threads;
+		std::vector<std::string> sample_buf(batch_size);
+		std::vector<std::string> decompose_buf(print_energy_decompose==1 ? batch_size : 0);
+		int* structures_batch = new int[batch_size*(length+1)];
+		if(print_energy_decompose==1){
+			energy_decompose_thread.resize(total_used_threads);
+			energy_decompose_buffered = true;
+		}
+		bool archive_enabled = sample_archive.isOpen();
+		for (int batch_start = 1; batch_start <= num_rnd; batch_start += batch_size)
 		{
-			//nsamples++;
-			int thdId = omp_get_thread_num();
-			countArr[thdId]++;
-			//cout<<"thdId="<<thdId<<endl;
-			int* structure = structures_thread + thdId*(length+1);
-			memset(structure, 0, (length+1)*sizeof(int));
-			//double energy = rnd_structure(structure);
-			double energy;
-			if(ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION){
-				energy = rnd_structure_parallel(structure, threads_for_one_sample);
-			}
-			else{
-				energy = rnd_structure(structure);
-			}
-
-			std::string ensemble(length+1,'.');
-			for (int i = 1; i <= (int)length; ++ i) {
-				if (structure[i] > 0 && ensemble[i] == '.')
-				{
-					ensemble[i] = '(';
-					ensemble[structure[i]] = ')';
-				}
-			}
-			/*
-			//Below line of codes is for finding samples with particular energy
-			double myEnegry = -92.1;//-91.3;//-94.8;//dS=-88.4;//d2=-93.1
-			if (fabs(energy-myEnegry)>0.0001){ count--;continue;} //TODO: debug
-			 */
-
-			if(ST_D2_ENABLE_SCATTER_PLOT){
-				std::map<std::string,std::pair<int,double> >::iterator iter ;
-				if ((iter =uniq_structs_thread[thdId].find(ensemble.substr(1))) != uniq_structs_thread[thdId].end())
+			int batch_count = MIN(batch_size, num_rnd - batch_start + 1);
+			#ifdef _OPENMP
+			#pragma omp parallel shared(structures_batch, uniq_structs_thread, sample_buf, decompose_buf) num_threads(total_used_threads)
+			#pragma omp single
+			#endif
+			for (int count = 0; count < batch_count; ++count) 
+			{
+				#ifdef _OPENMP
+				#pragma omp task firstprivate(count)
+				#endif
 				{
-					std::pair<int,double>& pp = iter->second;
-					pp.first++;
-					//cout<<"energy="<<energy<<",pp.second="<<pp.second<<endl;
-					assert(energy==pp.second);
-				}
-				else{
-					std::pair< std::string, std::pair<int,double> > new_pp = make_pair(ensemble.substr(1),std::pair<int,double>(1,energy));
-					uniq_structs_thread[thdId].insert(new_pp); 
-				}
-			}
-			//uniq_structs_thread[thdId].insert(make_pair(ensemble.substr(1),std::pair<int,double>(1,energy))); 
-
-			//if(!ST_D2_ENABLE_SCATTER_PLOT){
-				//std::cout << ensemble.substr(1) << ' ' << energy << std::endl;
-				//printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, std::cout);
-				printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, outfile);
-			//}
-		}
+					int* structure = structures_batch + count*(length+1);
+					memset(structure, 0, (length+1)*sizeof(int));
+					int thdId = omp_get_thread_num();
+					double energy;
+					if(print_energy_decompose==1){
+						//traced back by this thread alone, so its buffer holds exactly this sample
+						energy_decompose_thread[thdId].clear();
+						energy = rnd_structure(structure);
+					}
+					else energy = rnd_structure_parallel(structure, total_used_threads);
+
+					std::string ensemble(length+1,'.');
+					for (int i = 1; i <= (int)length; ++ i) {
+						if (structure[i] > 0 && ensemble[i] == '.')
+						{
+							ensemble[i] = '(';
+							ensemble[structure[i]] = ')';
+						}
+					}
 
-		int finalCount=0;
-		for(int ind=0; ind<threads_for_counts; ind++) finalCount+=countArr[ind];
-		for (count = finalCount+1; count <= num_rnd; ++count) 
-		{
-			//nsamples++;
-			int thdId = 0;//omp_get_thread_num();
-			//countArr[thdId]++;
-			//cout<<"thdId="<<thdId<<endl;
-			int* structure = structures_thread + thdId*(length+1);
-			memset(structure, 0, (length+1)*sizeof(int));
-			//double energy = rnd_structure(structure);
-			double energy;
-			if(ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION){
-				energy = rnd_structure_parallel(structure, threads_for_one_sample);
-			}
-			else{
-				energy = rnd_structure(structure);
-			}
+					if(ST_D2_ENABLE_SCATTER_PLOT){
+						std::map<std::string,std::pair<int,double> >::iterator iter ;
+						if ((iter =uniq_structs_thread[thdId].find(ensemble.substr(1))) != uniq_structs_thread[thdId].end())
+						{
+							std::pair<int,double>& pp = iter->second;
+							pp.first++;
+							assert(energy==pp.second);
+						}
+						else{
+							std::pair< std::string, std::pair<int,double> > new_pp = make_pair(ensemble.substr(1),std::pair<int,double>(1,energy));
+							uniq_structs_thread[thdId].insert(new_pp); 
+						}
+					}
 
-			std::string ensemble(length+1,'.');
-			for (int i = 1; i <= (int)length; ++ i) {
-				if (structure[i] > 0 && ensemble[i] == '.')
-				{
-					ensemble[i] = '(';
-					ensemble[structure[i]] = ')';
+					sample_buf[count].clear();
+					if(archive_enabled) sample_archive_encode(structure, length, energy, boltzmannProbability(energy, U), sample_buf[count]);
+					else sample_buf[count] = getEnergyAndStructureLine(structure, ensemble, (int)length, energy);
+					if(print_energy_decompose==1){
+						printEnergyDecomposeSummary(structure, ensemble, (int)length, energy);
+						decompose_buf[count].swap(energy_decompose_thread[thdId]);
+					}
 				}
 			}
-			/*
-			//Below line of codes is for finding samples with particular energy
-			double myEnegry = -92.1;//-91.3;//-94.8;//dS=-88.4;//d2=-93.1
-			if (fabs(energy-myEnegry)>0.0001){ count--;continue;} //TODO: debug
-			 */
 
-			std::map<std::string,std::pair<int,double> >::iterator iter ;
-			if ((iter =uniq_structs_thread[thdId].find(ensemble.substr(1))) != uniq_structs_thread[thdId].end())
+			for (int count = 0; count < batch_count; ++count)
 			{
-				std::pair<int,double>& pp = iter->second;
-				pp.first++;
-				//cout<<"energy="<<energy<<",pp.second="<<pp.second<<endl;
-				assert(energy==pp.second);
+				if(archive_enabled) sample_archive.append(sample_buf[count]);
+				else outfile << sample_buf[count];
+				if(print_energy_decompose==1) fputs(decompose_buf[count].c_str(), energy_decompose_outfile);
 			}
-			else {
-				if(ST_D2_ENABLE_SCATTER_PLOT){
-					std::pair< std::string, std::pair<int,double> > new_pp = make_pair(ensemble.substr(1),std::pair<int,double>(1,energy));
-					uniq_structs_thread[thdId].insert(new_pp); 
-				}
-				//uniq_structs_thread[thdId].insert(make_pair(ensemble.substr(1),std::pair<int,double>(1,energy))); 
-			}
-
-			//if(!ST_D2_ENABLE_SCATTER_PLOT){
-				//std::cout << ensemble.substr(1) << ' ' << energy << std::endl;
-				//printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, std::cout);
-				printEnergyAndStructureInDotBracketAndTripletNotation(structure, ensemble, (int)length, energy, outfile);
-			//}
 		}
-
-
+		delete [] structures_batch;
+		energy_decompose_buffered = false;
 
 		if(ST_D2_ENABLE_SCATTER_PLOT){
-			for(int thd_id=0; thd_id<threads_for_counts; thd_id++){
+			for(int thd_id=0; thd_id<total_used_threads; thd_id++){
 				std::map<std::string,std::pair<int,double> >::iterator thd_iter ;
 				for (thd_iter = uniq_structs_thread[thd_id].begin(); thd_iter != uniq_structs_thread[thd_id].end();  ++thd_iter)
 				{
@@ -1464,10 +1687,8 @@ void StochasticTracebackD2<MyDouble>::batch_sample_parallel(int num_rnd, bool ST
 			estimateBppoutfile.close();
                 }
 	}
-	delete [] structures_thread;
 	delete [] uniq_structs_thread;
-	printf("\nStochastic samples saved to %s\n", samplesOutputFile.c_str());
-        outfile.close();
+	closeSampleOutput(samplesOutputFile, outfile);
 }
 
 
@@ -1488,7 +1709,7 @@ void StochasticTracebackD2<MyDouble>::batch_sample_and_dump(int num_rnd, std::st
        }
         else U = pf_d2.get_u(1,length);
 	*/
-         U = pf_d2.get_u(1,length);
+         U = pf_u;
 	//data dump preparation code starts here
 	if(ctFileDumpDir.compare("")==0){
 		char abspath[1000];
@@ -1618,8 +1839,45 @@ void StochasticTracebackD2<MyDouble>::printEnergyAndStructureInDotBracketAndTrip
 	printline << ensemble.substr(1) << "\t" << energy << "\t" << tripletNotationStructureString<<endl;
 	outfile << printline.str();
 	if(print_energy_decompose==1){
-		fprintf(energy_decompose_outfile, "%s\t%f\t%s\n\n\n", ensemble.substr(1).c_str(), energy, tripletNotationStructureString.c_str());
+		decompose_printf("%s\t%f\t%s\n\n\n", ensemble.substr(1).c_str(), energy, tripletNotationStructureString.c_str());
+	}
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::printEnergyDecomposeSummary(int* structure, std::string ensemble, int length, double energy){
+	std::string tripletNotationStructureString = getStructureStringInTripletNotation(structure, length);
+	decompose_printf("%s\t%f\t%s\n\n\n", ensemble.substr(1).c_str(), energy, tripletNotationStructureString.c_str());
+}
+
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::decompose_printf(const char* format, ...){
+	va_list args;
+	va_start(args, format);
+	if(!energy_decompose_buffered){
+		vfprintf(energy_decompose_outfile, format, args);
+		va_end(args);
+		return;
+	}
+	std::string& buf = energy_decompose_thread[omp_get_thread_num()];
+	char line[512];
+	va_list args_copy;
+	va_copy(args_copy, args);
+	int n = vsnprintf(line, sizeof(line), format, args);
+	if(n < (int)sizeof(line)) buf.append(line, n);
+	else{
+		std::vector<char> longline(n+1);
+		vsnprintf(&longline[0], n+1, format, args_copy);
+		buf.append(&longline[0], n);
 	}
+	va_end(args_copy);
+	va_end(args);
+}
+
+template <class MyDouble>
+std::string StochasticTracebackD2<MyDouble>::getEnergyAndStructureLine(int* structure, std::string ensemble, int length, double energy){
+	stringstream printline;
+	printline << ensemble.substr(1) << "\t" << energy << "\t" << getStructureStringInTripletNotation(structure, length)<<endl;
+	return printline.str();
 }
 
 template <class MyDouble>
@@ -1683,6 +1941,11 @@ std::string StochasticTracebackD2<MyDouble>::getStructureStringInTripletNotation
 	return getStructureStringInTripletNotation(structure, length);
 }
 
+template <class MyDouble>
+void StochasticTracebackD2<MyDouble>::enablePfArraysOutput(){
+	keep_pf_arrays = true;
+}
+
 template <class MyDouble>
 void StochasticTracebackD2<MyDouble>::printPfMatrixesToFile(std::string pfArraysOutputFile){
 	pf_d2.printAllMatrixesToFile(pfArraysOutputFile);
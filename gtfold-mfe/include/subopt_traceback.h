@@ -34,6 +34,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <new>
 
 //#define UNIQUE_MULTILOOP_DECOMPOSITION
 extern int UNIQUE_MULTILOOP_DECOMPOSITION;
@@ -86,51 +87,165 @@ struct segment
 typedef segment SEG;
 typedef std::stack<segment>  SEGSTACK;
 
+/*
+ * Partial structures are persistent: their base pairs and pending segment stacks are
+ * immutable singly linked lists of reference counted cells. Copying a pstruct for a new
+ * branch is O(1), and siblings on the gstack share the cells they have in common.
+ * Cells come from a per-thread free list which is refilled a block at a time. Reference
+ * counts are updated atomically, since with parallel enumeration a stolen partial
+ * structure keeps sharing its cells with the branches left on the victim's deque.
+ */
+template <class T>
+struct ps_cell
+{
+	T val;
+	ps_cell* next;
+	int ref;
+};
+
+template <class T>
+class ps_arena
+{
+	public:
+		static ps_cell<T>* alloc()
+		{
+			ps_cell<T>*& free_list = head();
+			if (free_list == NULL) refill(free_list);
+			ps_cell<T>* c = free_list;
+			free_list = c->next;
+			return c;
+		}
+
+		static void release(ps_cell<T>* c)
+		{
+			ps_cell<T>*& free_list = head();
+			c->next = free_list;
+			free_list = c;
+		}
+
+	private:
+		static const int BLOCK_CELLS = 4096;
+
+		static ps_cell<T>*& head()
+		{
+			static thread_local ps_cell<T>* free_list = NULL;
+			return free_list;
+		}
+
+		static void refill(ps_cell<T>*& free_list)
+		{
+			ps_cell<T>* block = (ps_cell<T>*) malloc(BLOCK_CELLS * sizeof(ps_cell<T>));
+			if (block == NULL) {
+				perror("Cannot allocate partial structure cells");
+				exit(-1);
+			}
+			for (int k = 0; k < BLOCK_CELLS; ++k)
+				block[k].next = (k+1 < BLOCK_CELLS) ? &block[k+1] : free_list;
+			free_list = block;
+		}
+};
+
+template <class T>
+class ps_list
+{
+	public:
+		ps_list() : head_(NULL) {}
+
+		ps_list(const ps_list& l) : head_(l.head_)
+		{
+			if (head_) __sync_add_and_fetch(&head_->ref, 1);
+		}
+
+		~ps_list()
+		{
+			release(head_);
+		}
+
+		ps_list& operator = (const ps_list& l)
+		{
+			if (l.head_) __sync_add_and_fetch(&l.head_->ref, 1);
+			release(head_);
+			head_ = l.head_;
+			return *this;
+		}
+
+		bool empty() const { return head_ == NULL; }
+
+		const T& top() const { return head_->val; }
+
+		const ps_cell<T>* begin() const { return head_; }
+
+		void push(const T& v)
+		{
+			ps_cell<T>* c = ps_arena<T>::alloc();
+			new (&c->val) T(v);
+			c->next = head_; // the reference held by this list moves to the new cell
+			c->ref = 1;
+			head_ = c;
+		}
+
+		void pop()
+		{
+			ps_cell<T>* c = head_;
+			head_ = c->next;
+			if (head_) __sync_add_and_fetch(&head_->ref, 1);
+			release(c);
+		}
+
+	private:
+		ps_cell<T>* head_;
+
+		static void release(ps_cell<T>* c)
+		{
+			while (c != NULL && __sync_sub_and_fetch(&c->ref, 1) == 0) {
+				ps_cell<T>* next = c->next;
+				c->val.~T();
+				ps_arena<T>::release(c);
+				c = next;
+			}
+		}
+};
+
+struct ps_pair
+{
+	int i;
+	int j;
+	char c1;
+	char c2;
+};
+
 struct pstruct
 {
-	std::string str;
-	SEGSTACK st_segment;
-	SEGSTACK st_v; /* used for backtracking in traceWM */
+	ps_list<ps_pair> pairs;
+	ps_list<segment> st_segment;
+	ps_list<segment> st_v; /* used for backtracking in traceWM */
 	
 	int ae_;
 	int le_;
+	int len_;
 
 	int total() const { return ae_ + le_; }
 
-	pstruct() {}
-	
-	pstruct(const pstruct& ps)
-	{
-		str = ps.str;
-		st_segment = ps.st_segment;
-		st_v = ps.st_v;
-		ae_ = ps.ae_;
-		le_ = ps.le_;
-	}
+	pstruct() : ae_(0), le_(0), len_(0) {}
 
-	pstruct& operator = (const pstruct& ps)
+	pstruct(int ae, int len) : ae_(ae), le_(0), len_(len) {}
+
+	/* dot bracket string of the pairs fixed so far */
+	std::string str() const
 	{
-		if (&ps != this)
+		std::string s(len_, '.');
+		for (const ps_cell<ps_pair>* c = pairs.begin(); c != NULL; c = c->next)
 		{
-			str = ps.str;
-			st_segment = ps.st_segment;
-			st_v = ps.st_v;
-			ae_ = ps.ae_;
-			le_ = ps.le_;
+			s[c->val.i-1] = c->val.c1;
+			s[c->val.j-1] = c->val.c2;
 		}
-		return *this;
+		return s;
 	}
 
-
 	void update(int i, int j, char c1, char c2)
 	{
-		str[i-1] = c1; str[j-1] = c2;	
-	}
-
-	pstruct(int ae, int len) : ae_(ae) 
-	{
-		le_ = 0;
-		str = std::string(len, '.');
+		ps_pair p = {i, j, c1, c2};
+		pairs.push(p);
 	}
 
 	void accumulate(int en)
@@ -152,15 +267,13 @@ struct pstruct
 
 	void pop()
 	{
-		segment seg = st_segment.top();
-		le_ -= seg.en_;
+		le_ -= st_segment.top().en_;
 		st_segment.pop();
 	}
 
 	void pop_v()
 	{
-		segment seg = st_v.top();
-		le_ -= seg.en_;
+		le_ -= st_v.top().en_;
 		st_v.pop();
 	}
 
@@ -187,24 +300,14 @@ struct pstruct
 
 	void print() const
 	{
-		SEGSTACK st = st_segment;
 		std::cout <<'[' << ' ' ;
-		while (!st.empty())
-		{
-			segment seg = st.top();
-			std::cout << seg << ' '; 
-			st.pop();	
-		}
+		for (const ps_cell<segment>* c = st_segment.begin(); c != NULL; c = c->next)
+			std::cout << c->val << ' '; 
 
-		st = st_v;
 		std::cout << ']' << ' ' << '[' ;
-		while (!st.empty())
-		{
-			segment seg = st.top();
-			std::cout << seg << ' '; 
-			st.pop();	
-		}
-		std::cout << ']' << ' ' << str << ' ' ;
+		for (const ps_cell<segment>* c = st_v.begin(); c != NULL; c = c->next)
+			std::cout << c->val << ' '; 
+		std::cout << ']' << ' ' << str() << ' ' ;
 		std::cout << " ae=" << ae_ << " le=" << le_ << " te=" << ae_+le_  ;
 	}
 };
@@ -221,10 +324,65 @@ typedef std::map<std::string, pstruct> ps_map_t;
 /* secondary structure map */
 typedef std::map<std::string, int> ss_map_t;	
 
+class SuboptWriter;
+
 void push_to_gstack(ps_stack_t & gs, const ps_t& v);
 
 //ss_map_t subopt_traceback(int len, int gap);
-ss_map_t subopt_traceback(int len, int gap, std::string suboptFile, int is_check_for_duplicates_enabled, int max_structure_count);
+// Streams the structures within gap of the MFE to writer and returns their number.
+// topk > 0 enumerates best first and writes the topk lowest energy structures within gap
+// (no limit if gap < 0) in increasing energy order. The structures are also collected
+// in subopt_data if the caller passes a map.
+int subopt_traceback(int len, int gap, SuboptWriter& writer, int is_check_for_duplicates_enabled, int max_structure_count, int topk, ss_map_t* subopt_data = NULL);
+
+/*
+ * Pull based enumeration. next() resumes the depth first search where the previous call
+ * left it and returns the next structure, in the order subopt_traceback writes them.
+ * The filter sees every partial structure before it is expanded and drops it with its
+ * whole subtree by returning false, e.g. once it holds a forbidden pair. Filter and visit
+ * also get the pairs fixed so far as an array, structure[i] = j and structure[j] = i if
+ * i.j is paired and 0 otherwise, so a pair is looked up in O(1). The array is kept in
+ * step with the search: partial structures share the tail of their pair list, and only
+ * the pairs that differ from the previous one are undone and applied. The cursor uses
+ * the MFE tables and the traceback's global state, so only one can be active at a time.
+ */
+typedef bool (*subopt_filter_t)(const ps_t& ps, const int* structure, void* data);
+typedef bool (*subopt_visit_t)(const ps_t& ps, const int* structure, void* data);
+
+class SuboptCursor
+{
+	public:
+		SuboptCursor(int len, int gap, subopt_filter_t filter = NULL, void* data = NULL);
+		~SuboptCursor();
+		// false once every structure has been returned
+		bool next(ps_t& structure);
+		// pairing array of the structure last returned by next(), indexed 1..len
+		const int* structure() const { return &pairing[0]; }
+
+	private:
+		ps_stack_t gstack;
+		subopt_filter_t filter;
+		void* data;
+
+		std::vector<int> pairing;
+		// pair cells behind pairing, oldest first, and the position of each in applied
+		std::vector<const ps_cell<ps_pair>*> applied;
+		std::vector<int> applied_at;
+		ps_list<ps_pair> held;	// keeps the cells in applied alive
+
+		void sync(const ps_t& ps);
+
+		SuboptCursor(const SuboptCursor&);
+		SuboptCursor& operator = (const SuboptCursor&);
+};
+
+// Calls visit for every structure within gap of the MFE until it returns false,
+// returns the number of structures visited.
+int subopt_enumerate(int len, int gap, subopt_visit_t visit, void* data, subopt_filter_t filter = NULL);
+
+// Writes the number of structures in every 0.1 kcal/mol bin up to gap above the MFE,
+// counted over the unique multiloop decomposition without enumerating them
+void subopt_dos(int len, int gap, std::string dosFile);
 
 void traceV(int i, int j, ps_t & ps, ps_stack_t & gs); 
 void traceVBI(int i, int j, ps_t & ps, ps_stack_t & gs);
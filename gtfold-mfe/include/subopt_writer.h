@@ -0,0 +1,108 @@
+#ifndef _SUBOPT_WRITER_H_
+#define _SUBOPT_WRITER_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "subopt_traceback.h"
+
+/*
+ * Streaming output of suboptimal structures.
+ *
+ * text    : header "count", sequence, MFE, then one line per structure with its number,
+ *           dot-bracket string and energy, tab separated
+ * binary  : magic "GTSS", version, sequence length, MFE (int32, units of 10 cal/mol),
+ *           sequence bytes, then per structure: energy (int32), number of pairs (varint),
+ *           and for every pair i<j in increasing i, (i - previous i) and (j - i) as varints.
+ *           Fixed width fields are little endian, records are numbered by their position.
+ *
+ * Records are formatted into a large buffer which a background thread writes out while
+ * the next one fills. The duplicate check keeps a 128 bit fingerprint of the pair list of
+ * every structure in an open addressing table, instead of the structure itself.
+ */
+
+#define SUBOPT_BINARY_VERSION 1
+
+struct subopt_fingerprint
+{
+	unsigned long long hi;
+	unsigned long long lo;
+};
+
+class SuboptWriter
+{
+	public:
+		SuboptWriter();
+		~SuboptWriter();
+		void open(std::string fileName, std::string seq, int mfe, bool binary);
+		void close();
+		bool isBinary() const { return binary; }
+
+		// Appends the record of ps without its number to rec. Formatting is thread safe,
+		// so the parallel enumeration encodes in the worker threads.
+		void encode(const pstruct& ps, std::string& rec) const;
+		void write(int count, const pstruct& ps);
+		// rec is an encoded record, count is only written in text mode
+		void writeEncoded(int count, const char* rec, size_t n);
+		void append(const char* data, size_t n);
+
+		// Records the fingerprint of ps, returns true if it had been seen before. Not thread safe.
+		bool seen(const pstruct& ps);
+
+	private:
+		static const size_t FLUSH_SIZE = 1 << 20;
+
+		FILE* outfile;
+		std::string fileName;
+		bool binary;
+		std::string scratch;
+
+		std::string cur;
+		std::string pending;
+		bool has_pending;
+		bool stop;
+		std::mutex lock;
+		std::condition_variable cv;
+		std::thread flusher;
+
+		std::vector<subopt_fingerprint> table;
+		size_t table_used;
+
+		void handoff();
+		void flush_loop();
+		void grow_table();
+};
+
+// Reads the structures of a binary subopt file back in the order they were written
+class SuboptReader
+{
+	public:
+		SuboptReader();
+		~SuboptReader();
+		void open(std::string fileName);
+		void close();
+		const std::string& sequence() const { return seq; }
+		int mfe() const { return mfe_; }
+		// structure must hold length+1 ints, pairs are stored as structure[i]=j, structure[j]=i.
+		// Returns false after the last structure.
+		bool next(int* structure, int& energy);
+	private:
+		FILE* infile;
+		std::string fileName;
+		std::string seq;
+		int mfe_;
+
+		unsigned int get_u32();
+		bool get_varint(unsigned int& v);
+		void truncated();
+};
+
+// Writes the binary subopt file binFile as the text file gtsubopt writes without --binary.
+// Returns the number of structures.
+int subopt_binary_export(std::string binFile, std::string outFile);
+
+#endif
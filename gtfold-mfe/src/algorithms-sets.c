@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "constants.h"
+#include "utils.h"
+#include "energy.h"
+#include "global.h"
+#include "algorithms.h"
+#include "algorithms-sets.h"
+#include "constraints.h"
+#include "shapereader.h"
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+/* the values of the K tables for a cell are adjacent, table k has the parameters of
+   sets[set_of[k]], the dangle treatment mode[k] and the SHAPE energies shape[k] */
+static int K, nsets;
+static const struct param_set* sets[SWEEP_TABLES_MAX];
+static int set_of[SWEEP_TABLES_MAX], mode[SWEEP_TABLES_MAX];
+static const int* shape[SWEEP_TABLES_MAX];
+static int *no_shape = NULL;
+static int cap_shape = 0;
+static int *VK, *VMK, *VBIK, *WK, *WMK, *WMPrimeK;
+static size_t cap_tri = 0, cap_full = 0, cap_w = 0;
+static int width; /* len+1, the row length of WM and WMPrime */
+
+#define TRI(t,i,j) ((t) + (size_t)(indx[j]+(i))*K)
+#define FULL(t,i,j) ((t) + ((size_t)(i)*width+(j))*K)
+
+/* auPen() without the energy, the set adds its auend */
+#define AU_PAIR(a, b) ((((a)==BASE_U || (b)==BASE_U) && ((a)==BASE_A || (a)==BASE_G || (b)==BASE_A || (b)==BASE_G)))
+
+#define AU_PEN(S,i,j) (AU_PAIR(RNA[i], RNA[j]) ? (S)->auend : 0)
+#define ED3(S,i,j,k) ((S)->dangle[RNA[i]][RNA[j]][RNA[k]][1])
+#define ED5(S,i,j,k) ((S)->dangle[RNA[i]][RNA[j]][RNA[k]][0])
+#define ESTACKM(S,i,j) ((S)->tstackm[RNA[i]][RNA[j]][RNA[(i)+1]][RNA[(j)-1]])
+#define ESTACKE(S,i,j) ((S)->tstacke[RNA[i]][RNA[j]][RNA[(i)+1]][RNA[(j)-1]])
+#define EA(S) ((S)->multConst[0])
+#define EB(S) ((S)->multConst[2])
+#define EC(S) ((S)->multConst[1])
+
+/* the SHAPE pseudo-energy of a stacked pair in table k, getShapeEnergy() for its profile */
+#define ESHAPE(k,i,j,p,q) (shape[k][i] + shape[k][j] + shape[k][p] + shape[k][q])
+
+static int *alloc_set_table(int *t, size_t cells, const char *name) {
+  free(t);
+  t = (int *) malloc(cells * sizeof(int));
+  if (t == NULL) {
+    fprintf(stderr, "Cannot allocate variable '%s': ", name);
+    perror("");
+    exit(-1);
+  }
+  return t;
+}
+
+/* the tables grow to the largest fold and are kept for the next ones */
+static void create_set_tables(int len) {
+  size_t tri = ((size_t)len*(len+1)/2 + 1) * K;
+  size_t full = (size_t)(len+1)*(len+1) * K;
+  size_t w = (size_t)(len+1) * K;
+  size_t c;
+
+  if (tri > cap_tri) {
+    VK = alloc_set_table(VK, tri, "V");
+    VMK = alloc_set_table(VMK, tri, "VM");
+    VBIK = alloc_set_table(VBIK, tri, "VBI");
+    cap_tri = tri;
+  }
+  if (full > cap_full) {
+    WMK = alloc_set_table(WMK, full, "WM");
+    WMPrimeK = alloc_set_table(WMPrimeK, full, "WMPrime");
+    cap_full = full;
+  }
+  if (w > cap_w) {
+    WK = alloc_set_table(WK, w, "W");
+    cap_w = w;
+  }
+  width = len+1;
+
+  for (c = 0; c < tri; c++) VK[c] = VMK[c] = VBIK[c] = INFINITY_;
+  for (c = 0; c < full; c++) WMK[c] = WMPrimeK[c] = INFINITY_;
+  for (c = 0; c < w; c++) WK[c] = INFINITY_;
+}
+
+/* eS() for every set, without the SHAPE energy */
+static void eS_sets(int i, int j, int *e) {
+  int idx = fourBaseIndex(RNA[i], RNA[j], RNA[i+1], RNA[j-1]);
+  int k;
+  for (k = 0; k < nsets; k++)
+    e[k] = sets[k]->stack[idx] + sets[k]->eparam[1];
+}
+
+/* eH() for every set */
+static void eH_sets(int i, int j, int *e) {
+  int size = j - i - 1;
+  int idx, key = 0, index, polyC, ggg, k;
+  double lg = 0;
+
+  if (size == 0) {
+    for (k = 0; k < nsets; k++) e[k] = INFINITY_;
+    return;
+  }
+  idx = fourBaseIndex(RNA[i], RNA[j], RNA[i+1], RNA[j-1]);
+  if (size > 30) lg = log(((double) size) / 30.0);
+
+  if (size == 4) {
+    /* tetraloop */
+    for (index = 0; index < 6; ++index) {
+      int kmult;
+      switch (RNA[i + index]) {
+        case BASE_A: kmult = 1; break;
+        case BASE_C: kmult = 2; break;
+        case BASE_G: kmult = 3; break;
+        case BASE_U: kmult = 4; break;
+        default:
+          kmult = 0;
+          fprintf(stderr, "ERROR: in tetraloop calculation\n");
+      }
+      key += kmult * (int) pow(10.0, 5 - index);
+    }
+  }
+
+  /* GGG bonus and poly-C loop */
+  ggg = i > 2 && RNA[i-2] == BASE_G && RNA[i-1] == BASE_G && RNA[i] == BASE_G && RNA[j] == BASE_U;
+  polyC = 1;
+  for (index = 1; index <= size && polyC; ++index)
+    if (RNA[i + index] != BASE_C) polyC = 0;
+
+  for (k = 0; k < nsets; k++) {
+    const struct param_set *S = sets[k];
+    int energy;
+
+    if (size > 30) {
+      energy = S->hairpin[30] + (int) (S->prelog * lg) + S->tstkh[idx] + S->eparam[4];
+    } else if (size > 4) {
+      energy = S->hairpin[size] + S->tstkh[idx] + S->eparam[4];
+    } else if (size == 4) {
+      int count, tlink = 0;
+      for (count = 1; count < S->numoftloops && tlink == 0; ++count)
+        if (key == S->tloop[count][0]) tlink = S->tloop[count][1];
+      energy = tlink + S->hairpin[size] + S->tstkh[idx] + S->eparam[4];
+    } else if (size == 3) {
+      energy = S->hairpin[size] + AU_PEN(S, i, j);
+    } else {
+      energy = S->hairpin[size] + S->eparam[4];
+      if ((RNA[i] == BASE_A && RNA[j] == BASE_U) || (RNA[i] == BASE_U && RNA[j] == BASE_A))
+        energy += 6;
+    }
+
+    if (ggg) energy += S->gubonus;
+    if (polyC) energy += size == 3 ? S->c3 : S->cint + size * S->cslope;
+    e[k] = energy;
+  }
+}
+
+/* eL() for every set, eL1() in unafold mode, without the SHAPE energy. Returns 1 for a bulge of
+   one, which takes the SHAPE energy of a stack */
+static int eL_sets(int i, int j, int ip, int jp, int *e) {
+  int size1 = ip - i - 1;
+  int size2 = j - jp - 1;
+  int size = size1 + size2;
+  double lg = size > 30 ? log((double) size / 30.0) : 0;
+  int k;
+
+  if (size1 == 0 || size2 == 0) {
+    int au = AU_PAIR(RNA[i], RNA[j]) + AU_PAIR(RNA[ip], RNA[jp]);
+    if (size == 1) {
+      int idx = fourBaseIndex(RNA[i], RNA[j], RNA[ip], RNA[jp]);
+      for (k = 0; k < nsets; k++)
+        e[k] = sets[k]->stack[idx] + sets[k]->bulge[1] + sets[k]->eparam[2];
+      return 1;
+    } else {
+      for (k = 0; k < nsets; k++) {
+        const struct param_set *S = sets[k];
+        int loginc = size > 30 ? (int) floor(S->prelog * lg) : 0;
+        e[k] = S->bulge[MIN(size, 30)] + S->eparam[2] + loginc + au * S->auend;
+      }
+    }
+    return 0;
+  }
+
+  if (size <= 30) {
+    /* the special internal loops, the offsets into the tables are the same for every set */
+    const int *table = NULL;
+    size_t off = 0;
+    if (size1 == 2 && size2 == 2) {
+      off = (((((((RNA[i]*5 + RNA[ip])*5 + RNA[j])*5 + RNA[jp])*5 + RNA[i+1])*5 + RNA[i+2])*5 + RNA[j-1])*5 + RNA[j-2]);
+      table = &sets[0]->iloop22[0][0][0][0][0][0][0][0];
+    } else if (size1 == 1 && size2 == 2) {
+      off = ((((((RNA[i]*5 + RNA[j])*5 + RNA[i+1])*5 + RNA[j-1])*5 + RNA[j-2])*5 + RNA[ip])*5 + RNA[jp]);
+      table = &sets[0]->iloop21[0][0][0][0][0][0][0];
+    } else if (size1 == 2 && size2 == 1) {
+      off = ((((((RNA[jp]*5 + RNA[ip])*5 + RNA[j-1])*5 + RNA[i+2])*5 + RNA[i+1])*5 + RNA[j])*5 + RNA[i]);
+      table = &sets[0]->iloop21[0][0][0][0][0][0][0];
+    } else if (size == 2) {
+      off = (((((RNA[i]*5 + RNA[i+1])*5 + RNA[ip])*5 + RNA[j])*5 + RNA[j-1])*5 + RNA[jp]);
+      table = &sets[0]->iloop11[0][0][0][0][0][0];
+    }
+    if (table) {
+      size_t shift = (const char *) table - (const char *) sets[0];
+      for (k = 0; k < nsets; k++)
+        e[k] = ((const int *) ((const char *) sets[k] + shift))[off];
+      return 0;
+    }
+    if (g_unamode && ((size1 == 2 && size2 == 3) || (size1 == 3 && size2 == 2))) {
+      for (k = 0; k < nsets; k++)
+        e[k] = sets[k]->tstacki23[RNA[i]][RNA[j]][RNA[i+1]][RNA[j-1]] +
+          sets[k]->tstacki23[RNA[jp]][RNA[ip]][RNA[jp+1]][RNA[ip-1]];
+      return 0;
+    }
+  }
+
+  {
+    /* general internal loops, and the grossly asymmetric ones for the sets with gail */
+    int lopsided = abs(size1 - size2);
+    int m = MIN(2, MIN(size1, size2));
+    int one = size1 == 1 || size2 == 1;
+    int idx1 = fourBaseIndex(RNA[i], RNA[j], RNA[i+1], RNA[j-1]);
+    int idx2 = fourBaseIndex(RNA[jp], RNA[ip], RNA[jp+1], RNA[ip-1]);
+    int idxa1 = fourBaseIndex(RNA[i], RNA[j], BASE_A, BASE_A);
+    int idxa2 = fourBaseIndex(RNA[jp], RNA[ip], BASE_A, BASE_A);
+    for (k = 0; k < nsets; k++) {
+      const struct param_set *S = sets[k];
+      int loginc = size > 30 ? (int) floor(S->prelog * lg) : 0;
+      int t = one && S->gail ? S->tstki[idxa1] + S->tstki[idxa2] : S->tstki[idx1] + S->tstki[idx2];
+      e[k] = t + S->inter[MIN(size, 30)] + loginc + S->eparam[3] + MIN(S->maxpen, (lopsided * S->poppen[m]));
+    }
+  }
+  return 0;
+}
+
+static void calcVBI_sets(int i, int j, int *vbi) {
+  int p, q, k;
+  int e[SWEEP_TABLES_MAX];
+
+  for (k = 0; k < K; k++) vbi[k] = INFINITY_;
+  for (p = i+1; p <= MIN(j-2-TURN,i+MAXLOOP+1) ; p++) {
+    int minq = j-i+p-MAXLOOP-2;
+    if (minq < p+1+TURN) minq = p+1+TURN;
+    int maxq = (p==(i+1))?(j-2):(j-1);
+
+    for (q = minq; q <= maxq; q++) {
+      const int *v;
+      if (PP[p][q]==0) continue;
+      if (!canILoop(i,j,p,q)) continue;
+      v = TRI(VK, p, q);
+      if (eL_sets(i, j, p, q, e)) {
+        for (k = 0; k < K; k++) vbi[k] = MIN(e[set_of[k]] + ESHAPE(k,i,j,p,q) + v[k], vbi[k]);
+      } else {
+        for (k = 0; k < K; k++) vbi[k] = MIN(e[set_of[k]] + v[k], vbi[k]);
+      }
+    }
+  }
+}
+
+/* the cell (i,j) of V, VM, VBI, WMPrime and WM for every set, as in calculate() */
+static void calc_cell_sets(int i, int j, int len) {
+  int *v = TRI(VK, i, j), *vm = TRI(VMK, i, j), *vbi = TRI(VBIK, i, j);
+  int *wmp = FULL(WMPrimeK, i, j);
+  int h, k;
+
+  if (PP[i][j] == 1) {
+    int eh[SWEEP_TABLES_MAX], es[SWEEP_TABLES_MAX];
+    int stack = canStack(i,j);
+    int ss3 = canSS(j-1), ss5 = canSS(i+1);
+    const int *v1 = TRI(VK, i+1, j-1);
+
+    if (canHairpin(i,j)) eH_sets(i, j, eh);
+    else for (k = 0; k < nsets; k++) eh[k] = INFINITY_;
+    if (stack) eS_sets(i, j, es);
+
+    calcVBI_sets(i, j, vbi);
+
+    for (k = 0; k < K; k++) {
+      const struct param_set *S = sets[set_of[k]];
+      int e_s = stack?es[set_of[k]]+ESHAPE(k,i,j,i+1,j-1)+v1[k]:INFINITY_;
+      int d3 = ss3?ED3(S,i,j,j-1):INFINITY_;
+      int d5 = ss5?ED5(S,i,j,i+1):INFINITY_;
+      int au = AU_PEN(S,i,j), ea = EA(S), eb = EB(S), ec = EC(S);
+      int m = vm[k];
+
+      if (mode[k] == SWEEP_MISMATCH) {
+        m = MIN(m, FULL(WMPrimeK,i+1,j-1)[k] + au + ea + eb);
+        m = MIN(m, FULL(WMPrimeK,i+2,j-1)[k] + d5 + au + ea + eb + ec);
+        m = MIN(m, FULL(WMPrimeK,i+1,j-2)[k] + d3 + au + ea + eb + ec);
+        m = MIN(m, FULL(WMPrimeK,i+2,j-2)[k] + ESTACKM(S,i,j) + au + ea + eb + 2*ec);
+      } else if (mode[k] == SWEEP_DANGLE_2) {
+        m = MIN(m, FULL(WMPrimeK,i+1,j-1)[k] + d3 + d5 + au + ea + eb);
+      } else if (mode[k] == SWEEP_DANGLE_0) {
+        m = MIN(m, FULL(WMPrimeK,i+1,j-1)[k] + au + ea + eb);
+      } else {
+        m = MIN(m, FULL(WMPrimeK,i+1,j-1)[k] + au + ea + eb);
+        m = MIN(m, FULL(WMPrimeK,i+2,j-1)[k] + d5 + au + ea + eb + ec);
+        m = MIN(m, FULL(WMPrimeK,i+1,j-2)[k] + d3 + au + ea + eb + ec);
+        m = MIN(m, FULL(WMPrimeK,i+2,j-2)[k] + d3 + d5 + au + ea + eb + 2*ec);
+      }
+      vm[k] = stack?m:INFINITY_;
+      v[k] = MIN4(eh[set_of[k]], e_s, vbi[k], vm[k]);
+    }
+  } else {
+    for (k = 0; k < K; k++) v[k] = INFINITY_;
+  }
+
+  /* four table sets at a time, so that the minima stay in registers */
+  for (k = 0; k+4 <= K; k += 4) {
+    const int *u = FULL(WMK, i, i+TURN) + k, *l = FULL(WMK, j, i+TURN+1) + k;
+    int m0 = wmp[k], m1 = wmp[k+1], m2 = wmp[k+2], m3 = wmp[k+3];
+    for (h = i+TURN+1 ; h <= j-TURN-2; h++, u += K, l += K) {
+      m0 = MIN(m0, u[0] + l[0]);
+      m1 = MIN(m1, u[1] + l[1]);
+      m2 = MIN(m2, u[2] + l[2]);
+      m3 = MIN(m3, u[3] + l[3]);
+    }
+    wmp[k] = m0; wmp[k+1] = m1; wmp[k+2] = m2; wmp[k+3] = m3;
+  }
+  for (; k < K; k++) {
+    const int *u = FULL(WMK, i, i+TURN) + k, *l = FULL(WMK, j, i+TURN+1) + k;
+    int m = wmp[k];
+    for (h = i+TURN+1 ; h <= j-TURN-2; h++, u += K, l += K)
+      m = MIN(m, *u + *l);
+    wmp[k] = m;
+  }
+
+  {
+    int force = forcePair(i,j), ssi = canSS(i), ssj = canSS(j);
+    int *wmu = FULL(WMK, i, j), *wml = FULL(WMK, j, i);
+    const int *wi1 = FULL(WMK, i+1, j), *wj1 = FULL(WMK, j-1, i);
+    const int *vi1 = TRI(VK, i+1, j), *vj1 = TRI(VK, i, j-1), *vij1 = TRI(VK, i+1, j-1);
+
+    for (k = 0; k < K; k++) {
+      const struct param_set *S = sets[set_of[k]];
+      int eb = EB(S), ec = EC(S);
+      int newWM = INFINITY_;
+
+      newWM = (!force)?MIN(newWM, wmp[k]):newWM;
+
+      if (mode[k] == SWEEP_MISMATCH) {
+        newWM = MIN(v[k] + AU_PEN(S,i,j) + eb, newWM);
+        newWM = ssi?MIN(vi1[k] + ED3(S,j,i+1,i) + AU_PEN(S,i+1,j) + eb + ec, newWM):newWM;
+        newWM = ssj?MIN(vj1[k] + ED5(S,j-1,i,j) + AU_PEN(S,i,j-1) + eb + ec, newWM):newWM;
+        if (i<j-TURN-2)
+          newWM = (ssi&&ssj)?MIN(vij1[k] + ESTACKM(S,j-1,i+1) + AU_PEN(S,i+1,j-1) + eb + 2*ec, newWM):newWM;
+      } else if (mode[k] == SWEEP_DANGLE_2) {
+        int energy = v[k] + AU_PEN(S,i,j) + eb;
+        energy += (i==1)?ED3(S,j,i,len):ED3(S,j,i,i-1);
+        energy += ED5(S,j,i,j+1);
+        newWM = (ssi&&ssj)?MIN(energy, newWM):newWM;
+      } else if (mode[k] == SWEEP_DANGLE_0) {
+        newWM = MIN(v[k] + AU_PEN(S,i,j) + eb, newWM);
+      } else {
+        newWM = MIN(v[k] + AU_PEN(S,i,j) + eb, newWM);
+        newWM = ssi?MIN(vi1[k] + ED3(S,j,i+1,i) + AU_PEN(S,i+1,j) + eb + ec, newWM):newWM;
+        newWM = ssj?MIN(vj1[k] + ED5(S,j-1,i,j) + AU_PEN(S,i,j-1) + eb + ec, newWM):newWM;
+        newWM = (ssi&&ssj)?MIN(vij1[k] + ED3(S,j-1,i+1,i) + ED5(S,j-1,i+1,j) + AU_PEN(S,i+1,j-1) + eb + 2*ec, newWM):newWM;
+      }
+      newWM = ssi?MIN(wi1[k] + ec, newWM):newWM;
+      newWM = ssj?MIN(wj1[k] + ec, newWM):newWM;
+
+      wmu[k] = wml[k] = newWM;
+    }
+  }
+}
+
+void calculate_sets(int len, int ntables, const struct param_set* const* param_sets, const int* modes,
+                    const int* const* shapes, int* energies) {
+  int b, i, j, k, m;
+
+  /* the tables without SHAPE data read zeros */
+  if (len+1 > cap_shape) {
+    free(no_shape);
+    no_shape = (int *) calloc(len+1, sizeof(int));
+    if (no_shape == NULL) {
+      perror("Cannot allocate variable 'no_shape'");
+      exit(-1);
+    }
+    cap_shape = len+1;
+  }
+
+  /* the energies of the loops are evaluated once for each distinct set */
+  K = ntables;
+  nsets = 0;
+  for (k = 0; k < K; k++) {
+    for (m = 0; m < nsets && sets[m] != param_sets[k]; m++) ;
+    if (m == nsets) sets[nsets++] = param_sets[k];
+    set_of[k] = m;
+    if (modes) mode[k] = modes[k];
+    else if (g_unamode || g_mismatch) mode[k] = SWEEP_MISMATCH;
+    else if (g_dangles == 2) mode[k] = SWEEP_DANGLE_2;
+    else if (g_dangles == 0) mode[k] = SWEEP_DANGLE_0;
+    else mode[k] = SWEEP_DANGLE_DEFAULT;
+    if (shapes) shape[k] = shapes[k] ? shapes[k] : no_shape;
+    else shape[k] = SHAPE_ENABLED ? SHAPEenergies : no_shape;
+  }
+  create_set_tables(len);
+
+#ifdef _OPENMP
+  if (g_nthreads > 0) omp_set_num_threads(g_nthreads);
+#pragma omp parallel
+#pragma omp master
+  fprintf(stdout,"Thread count: %3d \n",omp_get_num_threads());
+#endif
+
+  initializeMatrix(len);
+  if (g_unamode || g_prefilter_mode) {
+    prefilter(len,g_prefilter1,g_prefilter2);
+  }
+
+  for (b = TURN+1; b <= len-1; b++) {
+#ifdef _OPENMP
+#pragma omp parallel for private (i,j) schedule(guided)
+#endif
+    for (i = 1; i <= len - b; i++) {
+      j = i + b;
+      calc_cell_sets(i, j, len);
+    }
+  }
+
+  for (k = 0; k < K; k++) WK[k] = 0;
+  for (j = 1; j <= len; j++) {
+    int Wj[SWEEP_TABLES_MAX];
+    int ssj = canSS(j);
+    for (k = 0; k < K; k++) Wj[k] = 0;
+
+    for (i = 1; i < j-TURN; i++) {
+      int ssi = canSS(i);
+      const int *vij = TRI(VK, i, j), *vi1 = TRI(VK, i+1, j), *vj1 = TRI(VK, i, j-1), *vij1 = TRI(VK, i+1, j-1);
+
+      for (k = 0; k < K; k++) {
+        const struct param_set *S = sets[set_of[k]];
+        int Wij, Widjd, Wijd, Widj, Wim1;
+        Wij = Widjd = Wijd = Widj = INFINITY_;
+        Wim1 = MIN(0, WK[(size_t)(i-1)*K + k]);
+
+        if (mode[k] == SWEEP_MISMATCH) {
+          Wij = vij[k] + AU_PEN(S,i,j) + Wim1;
+          Widj = ssi?vi1[k] + AU_PEN(S,i+1,j) + ED3(S,j,i+1,i) + Wim1:Widj;
+          Wijd = ssj?vj1[k] + AU_PEN(S,i,j-1) + ED5(S,j-1,i,j) + Wim1:Wijd;
+          Widjd = (ssi&&ssj)?vij1[k] + AU_PEN(S,i+1,j-1) + ESTACKE(S,j-1,i+1) + Wim1:Widjd;
+          Wij = MIN4(Wij, Widjd, Wijd, Widj);
+        } else if (mode[k] == SWEEP_DANGLE_2) {
+          int energy = vij[k] + AU_PEN(S,i,j) + Wim1;
+          if (i>1) energy += ED3(S,j,i,i-1);
+          if (j<len) energy += ED5(S,j,i,j+1);
+          Widjd = (ssi&&ssj)?energy:Widjd;
+          Wij = MIN(Wij, Widjd);
+        } else if (mode[k] == SWEEP_DANGLE_0) {
+          Wij = vij[k] + AU_PEN(S,i,j) + Wim1;
+        } else {
+          Wij = vij[k] + AU_PEN(S,i,j) + Wim1;
+          Widj = ssi?vi1[k] + AU_PEN(S,i+1,j) + ED3(S,j,i+1,i) + Wim1:INFINITY_;
+          Wijd = ssj?vj1[k] + AU_PEN(S,i,j-1) + ED5(S,j-1,i,j) + Wim1:INFINITY_;
+          Widjd = (ssi&&ssj)?vij1[k] + AU_PEN(S,i+1,j-1) + ED3(S,j-1,i+1,i) + ED5(S,j-1,i+1,j) + Wim1:INFINITY_;
+          Wij = MIN4(Wij, Widjd, Wijd, Widj);
+        }
+
+        Wj[k] = MIN(Wj[k],Wij);
+      }
+    }
+    for (k = 0; k < K; k++)
+      WK[(size_t)j*K + k] = ssj?MIN(Wj[k], WK[(size_t)(j-1)*K + k]):Wj[k];
+  }
+
+  for (k = 0; k < K; k++)
+    energies[k] = WK[(size_t)len*K + k];
+}
+
+void load_set_tables(int len, int k) {
+  size_t tri = (size_t)len*(len+1)/2 + 1;
+  size_t c;
+  int i, j;
+
+  for (c = 0; c < tri; c++) {
+    V[c] = VK[c*K + k];
+    VM[c] = VMK[c*K + k];
+    VBI[c] = VBIK[c*K + k];
+  }
+  for (j = 0; j <= len; j++)
+    W[j] = WK[(size_t)j*K + k];
+  for (i = 0; i <= len; i++) {
+    for (j = 0; j <= len; j++) {
+      WM[i][j] = FULL(WMK, i, j)[k];
+      WMPrime[i][j] = FULL(WMPrimeK, i, j)[k];
+    }
+  }
+}
@@ -41,30 +41,48 @@ void initializeMatrix(int len) {
         PP[i][j]  = 1;
 }
 
+/* A pair (i,j) is kept if some window (i',j'),(i'+1,j'-1),... of prefilter2 stacked
+   positions (cut at the middle of the loop) starting at a valid (i',j') covers it and holds
+   at least prefilter1 possible pairs. Each window lies on the anti-diagonal i+j = s, so the
+   windows are counted from prefix sums along the anti-diagonals, which are independent and
+   filtered in parallel, and the result goes straight back into PP. */
 void prefilter(int len, int prefilter1, int prefilter2) {
-  char** in;
-  int i, j, k, count;
-
-  in = (char**)malloc(len*sizeof(char*));
-  for (i = 1; i <= len; ++i) in[i - 1] = (char*)malloc(len*sizeof(char));
-
-  for (i = 1; i <= len - prefilter2 + 1; ++i)
-    for (j = len; j >= prefilter2 && j >= i; --j) {
-      count = 0;
-      for (k = 0; k < prefilter2 && k <= (j - i) / 2; ++k)
-        if (PP[i + k][j - k] == 1) ++count;
-      if (count >= prefilter1)
-        for (k = 0; k < prefilter2 && k <= (j - i) / 2; ++k)
-          ++in[i + k - 1][j - k - 1];
+  int s;
+
+#ifdef _OPENMP
+#pragma omp parallel private (s)
+#endif
+  {
+    int* sum = (int*)malloc((len+2)*sizeof(int));
+    if (sum == NULL) {
+      perror("Cannot allocate prefilter buffer");
+      exit(-1);
     }
 
-  for (i = 1; i <= len; ++i) {
-    for (j = len; j >= i; --j)
-      if (!in[i - 1][j - 1]) PP[i][j] = 0;
-    free(in[i - 1]);
-  }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,16)
+#endif
+    for (s = 2; s <= 2*len; ++s) {
+      int lo = MAX(1, s-len), mid = s/2; /* cells (i,s-i) with lo <= i <= mid */
+      int i, covered = 0;
+
+      /* sum[i-lo+1] = number of possible pairs (lo,s-lo) .. (i,s-i) */
+      sum[0] = 0;
+      for (i = lo; i <= mid; ++i)
+        sum[i-lo+1] = sum[i-lo] + (PP[i][s-i] == 1);
+
+      for (i = lo; i <= mid; ++i) {
+        int j = s-i;
+        if (i <= len - prefilter2 + 1 && j >= prefilter2) {
+          int end = MIN(i + prefilter2 - 1, mid);
+          if (sum[end-lo+1] - sum[i-lo] >= prefilter1) covered = end;
+        }
+        if (i > covered) PP[i][j] = 0;
+      }
+    }
 
-  free(in);
+    free(sum);
+  }
 }
 
 int calcVBI(int i, int j) {
@@ -120,10 +138,50 @@ int calcVBI2(int i, int j, int  len) {
   return energy;
 }
 
+#ifdef _OPENMP
+/* calcVBI/calcVBI1 with the p loop split over the team, for the cells of the last diagonals */
+static int calcVBIParallel(int i, int j) {
+  int p=0, q=0;
+  int VBIij = INFINITY_;
+  int maxp = MIN(j-2-TURN,i+MAXLOOP+1);
+
+#pragma omp parallel for private (q) reduction (min:VBIij) schedule(dynamic)
+  for (p = i+1; p <= maxp; p++) {
+    int minq = j-i+p-MAXLOOP-2;
+    if (minq < p+1+TURN) minq = p+1+TURN;
+    int maxq = (p==(i+1))?(j-2):(j-1);
+
+    for (q = minq; q <= maxq; q++) {
+      if (PP[p][q]==0) continue;
+      if (!canILoop(i,j,p,q)) continue;
+      VBIij = MIN((g_unamode ? eL1(i, j, p, q) : eL(i, j, p, q)) + V(p,q), VBIij);
+    }
+  }
+
+  return VBIij;
+}
+
+static int calcWMPrimeParallel(int i, int j) {
+  int h;
+  int WMPrimeij = WMPrime[i][j];
+
+#pragma omp parallel for reduction (min:WMPrimeij) schedule(static)
+  for (h = i+TURN+1 ; h <= j-TURN-2; h++) {
+    WMPrimeij = MIN(WMPrimeij, WMU(i,h-1) + WML(h,j));
+  }
+
+  return WMPrimeij;
+}
+#endif
+
 int calculate(int len) { 
   int b, i, j;
+  /* diagonals from b_threshold on have fewer cells than threads, their cells are
+     computed one at a time with the O(n) loops inside each cell split over the team */
+  int b_threshold = len;
 #ifdef _OPENMP
   if (g_nthreads > 0) omp_set_num_threads(g_nthreads);
+  if (omp_get_max_threads() > 1) b_threshold = MAX(TURN+1, len - omp_get_max_threads());
 #endif
 
 #ifdef _OPENMP
@@ -139,8 +197,9 @@ int calculate(int len) {
   }
 
   for (b = TURN+1; b <= len-1; b++) {
+    int tail = b >= b_threshold;
 #ifdef _OPENMP
-#pragma omp parallel for private (i,j) schedule(guided)
+#pragma omp parallel for private (i,j) schedule(guided) if (!tail)
 #endif
     for (i = 1; i <= len - b; i++) {
       j = i + b;
@@ -150,6 +209,11 @@ int calculate(int len) {
         int es = canStack(i,j)?eS(i,j)+V(i+1,j-1):INFINITY_; // stack
 
         // Internal Loop BEGIN
+#ifdef _OPENMP
+        if (tail)
+          VBI(i,j) = calcVBIParallel(i,j);
+        else
+#endif
         if (g_unamode) 
           VBI(i,j) = calcVBI1(i,j);
         else
@@ -189,6 +253,11 @@ int calculate(int len) {
 
       // Added auxillary storage WMPrime to speedup multiloop calculations
       int h;
+#ifdef _OPENMP
+      if (tail)
+        WMPrime[i][j] = calcWMPrimeParallel(i,j);
+      else
+#endif
       for (h = i+TURN+1 ; h <= j-TURN-2; h++) {
         WMPrime[i][j] = MIN(WMPrime[i][j], WMU(i,h-1) + WML(h,j)); 
       }
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <vector>
+
+#include "constants.h"
+#include "utils.h"
+#include "batch.h"
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+using namespace std;
+
+static double batch_memory = 0; /* bytes, 0 for half of the physical memory */
+static int batch_failures = 0; /* records that failed, counted in the driver */
+
+/* a worker process as seen by the driver */
+struct batch_worker
+{
+	pid_t pid;
+	int cmd;        /* records to fold, closed when there are no more */
+	int done;       /* finished records */
+	FILE* out;      /* stdout and stderr of the worker, in the order written */
+	long shown;     /* output up to here has been printed */
+	bool busy;
+	string id;      /* record being folded */
+	int threads;
+	double held;    /* tables kept by its pools, sized for the longest record it has folded */
+};
+
+/* followed by the record ID and the sequence */
+struct batch_command
+{
+	int threads;
+	size_t idSize, seqSize;
+};
+
+struct batch_done
+{
+	long start, end;  /* output of the record in the worker's output file */
+};
+
+/* set in a worker */
+static bool batch_worker_process = false;
+static int worker_cmd = -1, worker_done = -1;
+static bool worker_busy = false;
+static long worker_start = 0;
+
+void set_batch_memory(const char* mb) {
+	char* end;
+	double v = strtod(mb, &end);
+	if (*end != '\0' || v <= 0) {
+		printf("INVALID ARGUMENTS: --batchmem accepts a positive size in MB\n");
+		exit(-1);
+	}
+	batch_memory = v*1024*1024;
+}
+
+string batch_output_prefix(const string& prefix, const fasta_record& record) {
+	return prefix + "_" + record.id;
+}
+
+static void print_output(batch_worker& w, long end) {
+	char buf[65536];
+	while (w.shown < end) {
+		ssize_t n = pread(fileno(w.out), buf, MIN((long)sizeof(buf), end - w.shown), w.shown);
+		if (n <= 0) break;
+		fwrite(buf, 1, n, stdout);
+		w.shown += n;
+	}
+	fflush(stdout);
+}
+
+/* prints what is left of the output of a worker that has exited, and reaps it */
+static bool finish_worker(batch_worker& w) {
+	int status;
+	close(w.cmd);
+	waitpid(w.pid, &status, 0);
+	struct stat st;
+	if (fstat(fileno(w.out), &st) == 0) print_output(w, st.st_size);
+	fclose(w.out);
+	close(w.done);
+	if (w.busy) {
+		printf("**** %s failed\n", w.id.c_str());
+		fflush(stdout);
+		return false;
+	}
+	return true;
+}
+
+static void write_all(int fd, const void* buf, size_t size) {
+	const char* p = (const char*)buf;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("Cannot talk to the batch workers");
+			exit(-1);
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+static bool read_all(int fd, void* buf, size_t size) {
+	char* p = (char*)buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void send_record(batch_worker& w, const fasta_record& r, int threads) {
+	batch_command c;
+	c.threads = threads;
+	c.idSize = r.id.length();
+	c.seqSize = r.seq.length();
+	write_all(w.cmd, &c, sizeof(c));
+	write_all(w.cmd, r.id.data(), c.idSize);
+	write_all(w.cmd, r.seq.data(), c.seqSize);
+}
+
+/* worker side of batch_next */
+static bool next_record(fasta_record& record, int& threads) {
+	fflush(stdout);
+	fflush(stderr);
+	long here = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+	if (worker_busy) {
+		batch_done d;
+		d.start = worker_start;
+		d.end = here;
+		write_all(worker_done, &d, sizeof(d));
+	}
+
+	batch_command c;
+	if (!read_all(worker_cmd, &c, sizeof(c)))
+		return false;
+	record.id.resize(c.idSize);
+	record.seq.resize(c.seqSize);
+	if (!read_all(worker_cmd, &record.id[0], c.idSize) || !read_all(worker_cmd, &record.seq[0], c.seqSize))
+		return false;
+	worker_busy = true;
+	worker_start = here;
+	threads = c.threads;
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	printf("\n==== %s (%d nt, %d thread%s) ====\n", record.id.c_str(), (int)record.seq.length(), threads, threads > 1 ? "s" : "");
+	return true;
+}
+
+static batch_worker start_worker(vector<batch_worker>& workers, fasta_reader& input) {
+	int cmd[2], done[2];
+	batch_worker w;
+	w.out = tmpfile();
+	if (w.out == NULL || pipe(cmd) != 0 || pipe(done) != 0) {
+		perror("Cannot set up a batch worker");
+		exit(-1);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	w.pid = fork();
+	if (w.pid < 0) {
+		perror("Cannot fork a batch worker");
+		exit(-1);
+	}
+	if (w.pid == 0) {
+		for (size_t k = 0; k < workers.size(); k++) {
+			fclose(workers[k].out);
+			close(workers[k].cmd);
+			close(workers[k].done);
+		}
+		close(cmd[1]);
+		close(done[0]);
+		dup2(fileno(w.out), STDOUT_FILENO);
+		dup2(fileno(w.out), STDERR_FILENO);
+		fclose(w.out);
+		// stderr is unbuffered, a block buffered stdout would put a record's errors
+		// in the file ahead of its header and the messages before them
+		setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+		input.release();
+		batch_worker_process = true;
+		worker_cmd = cmd[0];
+		worker_done = done[1];
+		return w;
+	}
+	close(cmd[0]);
+	close(done[1]);
+	w.cmd = cmd[1];
+	w.done = done[0];
+	w.shown = 0;
+	w.busy = false;
+	w.threads = 0;
+	w.held = 0;
+	return w;
+}
+
+/* the idle worker whose pools already fit need most tightly, else the one with the largest, -1 if none is idle */
+static int pick_worker(const vector<batch_worker>& workers, double need) {
+	int best = -1;
+	for (int k = 0; k < (int)workers.size(); k++) {
+		if (workers[k].busy) continue;
+		if (best < 0) {
+			best = k;
+			continue;
+		}
+		double h = workers[k].held, b = workers[best].held;
+		if (b < need ? h > b : h >= need && h < b) best = k;
+	}
+	return best;
+}
+
+bool batch_next(fasta_reader& input, int nthreads, double cellBytes, fasta_record& record,
+		int& threads) {
+	if (batch_worker_process)
+		return next_record(record, threads);
+
+	int total = nthreads;
+	if (total <= 0) total = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (total <= 0) total = 1;
+	signal(SIGPIPE, SIG_IGN);
+
+	double budget = batch_memory;
+	if (budget <= 0) {
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pagesize = sysconf(_SC_PAGESIZE);
+		budget = (pages > 0 && pagesize > 0) ? 0.5*(double)pages*pagesize : 1024.0*1024*1024;
+	}
+
+	printf("Folding the records with %d thread%s and %.0f MB for the tables\n",
+			total, total > 1 ? "s" : "", budget/(1024*1024));
+	fflush(stdout);
+
+	// records read ahead, in input order
+	vector<fasta_record> pending(1);
+	pending[0].id.swap(record.id);
+	pending[0].seq.swap(record.seq);
+	bool more = true;
+
+	vector<batch_worker> workers;
+	int free_threads = total;
+	double used = 0;
+	int folded = 0, running = 0, failed = 0;
+	double t1 = get_seconds();
+
+	while (!pending.empty() || more || running > 0) {
+		while (more && pending.size() < BATCH_WINDOW) {
+			pending.push_back(fasta_record());
+			if (!input.next(pending.back())) {
+				pending.pop_back();
+				more = false;
+			}
+		}
+
+		while (!pending.empty()) {
+			// longest first, ties in input order
+			size_t best = 0;
+			for (size_t k = 1; k < pending.size(); k++)
+				if (pending[k].seq.length() > pending[best].seq.length()) best = k;
+			const fasta_record& r = pending[best];
+			double n1 = r.seq.length() + 1;
+			int want;
+			if ((int)r.seq.length() >= BATCH_LONG_RECORD) {
+				want = total;
+			} else {
+				int left = (int)pending.size();
+				want = MAX(1, free_threads/left);
+			}
+			if (want > free_threads) break;
+
+			// the pools of idle workers count as well, they are freed by retiring the worker
+			double need = cellBytes*n1*n1;
+			int k = pick_worker(workers, need);
+			double grow = k < 0 ? need : MAX(0.0, need - workers[k].held);
+			double idle = 0;
+			for (int q = 0; q < (int)workers.size(); q++)
+				if (!workers[q].busy && q != k) idle += workers[q].held;
+			if (running > 0 && used - idle + grow > budget) break;
+			while (used + grow > budget) {
+				int q = -1;
+				for (int p = 0; p < (int)workers.size(); p++)
+					if (!workers[p].busy && p != k && workers[p].held > 0 && (q < 0 || workers[p].held > workers[q].held))
+						q = p;
+				if (q < 0) break;
+				used -= workers[q].held;
+				if (!finish_worker(workers[q])) failed++;
+				workers.erase(workers.begin() + q);
+				if (q < k) k--;
+			}
+
+			if (k < 0) {
+				batch_worker w = start_worker(workers, input);
+				if (w.pid == 0)
+					return next_record(record, threads);
+				workers.push_back(w);
+				k = workers.size() - 1;
+			}
+			batch_worker& w = workers[k];
+			send_record(w, r, want);
+			w.busy = true;
+			w.id = r.id;
+			w.threads = want;
+			w.held += grow;
+			free_threads -= w.threads;
+			used += grow;
+			running++;
+			folded++;
+			pending.erase(pending.begin() + best);
+		}
+		if (running == 0) continue;
+
+		vector<struct pollfd> fds;
+		vector<size_t> busy;
+		for (size_t k = 0; k < workers.size(); k++) {
+			if (!workers[k].busy) continue;
+			struct pollfd p;
+			p.fd = workers[k].done;
+			p.events = POLLIN;
+			p.revents = 0;
+			fds.push_back(p);
+			busy.push_back(k);
+		}
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("Cannot wait for the batch workers");
+			exit(-1);
+		}
+		for (int k = (int)busy.size()-1; k >= 0; k--) {
+			if (fds[k].revents == 0) continue;
+			batch_worker& w = workers[busy[k]];
+			batch_done d;
+			bool done = read_all(w.done, &d, sizeof(d));
+			free_threads += w.threads;
+			running--;
+			if (done) {
+				print_output(w, d.end);
+				w.busy = false;
+			} else {
+				// the worker has exited in the middle of a record
+				used -= w.held;
+				if (!finish_worker(w)) failed++;
+				workers.erase(workers.begin() + busy[k]);
+			}
+		}
+	}
+
+	// no more records, the idle workers exit
+	for (size_t k = 0; k < workers.size(); k++)
+		if (!finish_worker(workers[k])) failed++;
+
+	t1 = get_seconds() - t1;
+	printf("\nFolded %d records", folded);
+	if (failed) printf(", %d failed", failed);
+	printf(" in %9.6f seconds\n", t1);
+	batch_failures = failed;
+	return false;
+}
+
+int batch_failed() {
+	return batch_failures;
+}
@@ -26,6 +26,10 @@
 //#include "AdvancedDouble.cc"
 #include "AdvancedDouble.h"
 #include "shapereader.h"
+#include "sample-archive.h"
+#include "batch.h"
+#include "result-cache.h"
+#include "daemon.h"
 
 using namespace std;
 
@@ -49,6 +53,10 @@ static double ST_D2_UNIFORM_SAMPLE_ENERGY = 0.0;
 static int PF_ST_D2_ADVANCED_DOUBLE_SPECIFIER = 0;//0 (default value) means decide automatically, 1 means native double, 2 means BigNum, 3 means hybrid, 4 means bigNumOptimized
 static bool ST_D2_ENABLE_CHECK_FRACTION = false;
 static bool ST_D2_ENABLE_BPP_PROBABILITY = false;
+static bool SAMPLE_ARCHIVE = false;
+static bool ST_D2_NONREDUNDANT_SAMPLE = false;
+static bool EXPORT_ARCHIVE = false;
+static bool EXPORT_CT = false;
 
 static string seqfile = "";
 static string outputPrefix = "";
@@ -64,6 +72,11 @@ static string pfArraysOutFile = "";
 static string ctFileDumpDir = "";
 static string stochastic_summery_file_name = "stochaSampleSummary.txt";
 static string shapeFile = "";
+static string sampleArchiveFile = "";
+static string exportArchiveFile = "";
+static string exportOutFile = "";
+static unsigned long long exportFirst = 1;
+static unsigned long long exportLast = 0;//0 means till the last record
 
 static int num_rnd = 0;
 //static int ss_verbose_global = 0;
@@ -78,6 +91,9 @@ static std::string seq;
 static double t1;
 	
 static void printRunConfiguration(string seq);
+static void set_output_files();
+static void boltzmann_file(int argc, char** argv);
+static void boltzmann_sequence(int threads);
 static void handleBpp();
 static void handleD2Sample();
 static void handleDsSample();
@@ -90,17 +106,24 @@ template <class T> static void computeD2Sample(T st_d2);
 static void print_usage() {
 	printf("Usage: gtboltzmann [OPTION]... FILE\n\n");
 
-	printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n\n");
+	printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n");
+	printf("   Every record of a multi-record FASTA file is processed, with output files named OUTPUT_ID.*.\n\n");
 
 	printf("OPTIONS\n");
 
+	printf("   --batchmem MB	Memory for the tables of the records processed at once from a\n");
+	printf("			multi-record FASTA file, half of the physical memory by default.\n");
+	printf("   --cache-dir DIR	Keep the base pair probabilities of --bpp in DIR and reuse them for the same\n");
+	printf("			sequence, parameters and options, and reuse the MFE structures kept there by gtmfe.\n");
+	printf("   --cache-size MB	Size of the cache in DIR, least recently used results are removed\n");
+	printf("			beyond it, 1024 by default.\n");
 	printf("   -d, --dangle INT	Restricts treatment of dangling energies (INT=0,2). See below for details.\n");
 	//printf("   --detailedhelp      Output help (this message) with detailed options and examples, and exit.\n");
 	printf("   --detailedhelp       Display detailed help message. Includes examples and additional options useful to developers.\n");
 	//printf("   -e, --energydetail         prints energy decomposition for sampled structures to file with extention '.energy' (should be used with '-t 1' option, as otherwise all threads in parallel, will write to file and output will be intermixed from all threads).\n");
 	printf("   -e, --energydetail   Writes loop-by-loop energy decomposition of structures to\n");
 	printf("			output-prefix.energy. When using this function in combination\n");
-	printf("			with --sample, number of threads must be limited to one (-t 1). .\n");
+	printf("			with --sample, the decomposition of every sample is written in sample order.\n");
 	printf("   --estimatebpp	Writed a csv file containing, for each sampled base pair, that base pair and it's frequency\n");
 	printf("			to output-prefix.sbpp. This option is ignored if not using --sample.\n");
 	printf("   --groupbyfreq        Write a csv file (output-prefix.frequency) containing, for each sampled structure, a line with\n");
@@ -112,10 +135,21 @@ static void print_usage() {
 	printf(" 		      	limit is given, base pairs can be over any distance.\n");
 	printf("   -o, --output NAME    Write output files with prefix given in NAME\n");
 	printf("   -p  --paramdir DIR   Path to directory from which parameters are to be read\n");
+	printf("                        or a parameter snapshot file written by gtfold-compile-params\n");
 	//printf("   --pfcount		Calculate the structure count using partition function and zero energy value.\n");
 	printf("   --pfcount		Output the number of possible structures (using partition function).\n");
 	//printf("   -s|--sample   INT	Sample number of structures equal to INT.\n");
 	printf("   -s|--sample   INT	Sample INT structures from Boltzmann distribution. Writes structures to file output-prefix.samples.\n");
+	printf("   --samplearchive      Writes sampled structures with their energies and probabilities to the binary archive\n");
+	printf("			output-prefix.gtsa instead of output-prefix.samples. Only valid in combination with --sample.\n");
+	printf("   --nonredundant       Sample without replacement, every sampled structure is distinct from the previous ones.\n");
+	printf("			The cumulative Boltzmann probability of the sampled structures is reported. Sampling stops\n");
+	printf("			early if the ensemble is exhausted. Only valid in combination with --sample, samples are\n");
+	printf("			traced back one after another.\n");
+	printf("   --exportsamples FILE [--records FIRST[:LAST]] [--ct]\n");
+	printf("			Exports structures stored in the sample archive FILE in dot-bracket notation to\n");
+	printf("			output-prefix_samples.txt, or with --ct, as one .ct file per structure in the directory given by -w.\n");
+	printf("			No sequence file is needed, by default all records are exported.\n");
 	printf("   -t|--threads INT	Limit number of threads used to INT.\n");
 	printf("   --useSHAPE FILE  Use SHAPE constraints from FILE.\n");
 	printf("   -v, --verbose	Run in verbose mode (includes partition function table printing.)\n");
@@ -144,7 +178,8 @@ static void print_usage_developer_options() {
 	//printf("   --counts-parallel  While sampling structures, parallelize INT sample counts among available threads (this is also a default behaviour of sampling).\n");
 	//printf("   --parallelsample        While sampling structures, parallelize the processing of one sample (useful when sampling large sequence with number of samples being less than available threads).\n");
 	printf("   --scale DOUBLE	Use scaling facotr as DOUBLE to approximate partition function, default value will be 1.07 in case seq len is more than 100 else it will be zero by default.\n");
-	printf("   --parallelsample     Paralellizes the sampling of each individual structure.\n");
+	printf("   --parallelsample     Paralellizes the sampling of each individual structure. With more than one thread\n");
+	printf("			this is always done, samples and the branches of each sample are run as tasks on all threads.\n");
 	printf("			Only valid in combination with --sample.\n");
 	//printf("   -s|--sample   INT  --separatectfiles [--ctfilesdir dump_dir_path] [--summaryfile dump_summery_file_name] Sample number of structures equal to INT and dump each structure to a ct file in dump_dir_path directory (if no value provided then use current directory value for this purpose) and also create a summary file with name stochastic_summery_file_name in dump_dir_path directory (if no value provided, use stochaSampleSummary.txt value for this purpose).\n");
 	printf("   --separatectfiles [--ctfilesdir DIR] [--summaryfile NAME] Writes each sampled structure to a separate .ct file \n");
@@ -168,6 +203,7 @@ static void print_usage_developer_options() {
 	printf("\t\t(1)      The directory pointed to by environment variable GTFOLDDATADIR \n");
 	printf("\t\t(2)      The install directory (eg. /usr/local/share/gtfold), if (1) fails. \n");
 	printf("\t\t(3)      The subdirectory 'data' of the current directory, if (1) and (2) fail. \n");
+	printf("\tUnless GTFOLDDATADIR is set, the default Turner99 and RNAParams sets are read from a copy compiled into GTfold. \n");
 	printf("\n");
 }
 
@@ -177,6 +213,9 @@ static void print_examples(){
 	printf("gtboltzmann [-s INT] [[-d 0|2]|[-dS]] [-t n] [-o outputPrefix] [-v] [--estimatebpp] [-p DIR] [-w DIR] [-l] [--useSHAPE FILE] <seq_file>\n\n");
 	printf("2. Calculate base pair probabilities:\n\n");
 	printf("gtboltzmann --bpp [-d 2] [-o outputPrefix] [-v] [-p DIR] [-w DIR] [-l] [--useSHAPE FILE] <seq_file>\n\n");
+	printf("3. Sample structures into a binary archive and export some of them:\n\n");
+	printf("gtboltzmann -s INT --samplearchive [-d 0|2] [-t n] [-o outputPrefix] [-w DIR] <seq_file>\n");
+	printf("gtboltzmann --exportsamples outputPrefix.gtsa [--records FIRST[:LAST]] [--ct] [-o outputPrefix] [-w DIR]\n\n");
 	printf("\n\n");
 }
 
@@ -185,8 +224,8 @@ static void print_examples_developer_options(){
 	printf("1. Calculate Partition function:\n\n");
 	printf("gtboltzmann [--partition] [[-d 0|2]|[-dS]] [-t n] [-o outputPrefix] [--exactintloop] [-v] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
 	printf("2. Sample structures stochastically:\n\n");
-	printf("gtboltzmann -s INT [[-d 0|2]|[-dS]] [-t n] [-o outputPrefix] [--exactintloop] [-v] [--groupbyfreq] [--estimatebpp] [--parallelsample] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
-	printf("gtboltzmann -s INT [[-d 0|2]|[-dS]] -t 1 [-o outputPrefix] [--exactintloop] [-v] [--groupbyfreq] [--sampleenergy DOUBLE] [-e] [--checkfraction] [--estimatebpp] [--parallelsample] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
+	printf("gtboltzmann -s INT [[-d 0|2]|[-dS]] [-t n] [-o outputPrefix] [--exactintloop] [-v] [--groupbyfreq] [-e] [--estimatebpp] [--parallelsample] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
+	printf("gtboltzmann -s INT [[-d 0|2]|[-dS]] -t 1 [-o outputPrefix] [--exactintloop] [-v] [--groupbyfreq] [--sampleenergy DOUBLE] [--checkfraction] [--estimatebpp] [--parallelsample] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
 	printf("gtboltzmann -s INT --separatectfiles [--ctfilesdir dump_dir_path] [--summaryfile dump_summery_file_name] [-d 2] [--exactintloop] [-v] [-p DIR] [-w DIR] [-l] [--scale DOUBLE] [--advancedouble INT] [--bignumprecision INT] [--useSHAPE FILE] <seq_file>\n\n");
 	printf("\n\n");
 }
@@ -241,7 +280,9 @@ static void printRunConfiguration(string seq) {
 	if(!SILENT) printf("- input sequence file: %s\n", seqfile.c_str());
 	if(!SILENT) printf("- sequence length: %d\n", (int)seq.length());
 	//if(!SILENT) printf("- output file: %s\n", outputFile.c_str());
-	if(RND_SAMPLE) if(!SILENT) printf("- samples output file: %s\n", sampleOutFile.c_str());
+	if(RND_SAMPLE && !SAMPLE_ARCHIVE) if(!SILENT) printf("- samples output file: %s\n", sampleOutFile.c_str());
+	if(RND_SAMPLE && SAMPLE_ARCHIVE) if(!SILENT) printf("- samples archive file: %s\n", sampleArchiveFile.c_str());
+	if(RND_SAMPLE && ST_D2_NONREDUNDANT_SAMPLE) if(!SILENT) printf("+ non-redundant sampling\n");
 	if(BPP_ENABLED) if(!SILENT) printf("- bpp output file: %s\n", bppOutFile.c_str());
 	if(PF_PRINT_ARRAYS_ENABLED) if(!SILENT) printf("+ partition function array print output file: %s\n", pfArraysOutFile.c_str());
 	if(print_energy_decompose==1) if(!SILENT) printf("+ energy decompose output file: %s\n", energyDecomposeOutFile.c_str());
@@ -264,6 +305,38 @@ static void validate_options(string seq){
 			RND_SAMPLE = false;
 		}
 	}
+	if(SAMPLE_ARCHIVE){
+		if(!RND_SAMPLE){
+			if(!SILENT) printf("Ignoring the option --samplearchive, as it will be valid with --sample option.\n\n");
+			SAMPLE_ARCHIVE = false;
+		}
+		else if(CALC_PF_DS){
+			if(!SILENT) printf("Ignoring the option --samplearchive, as it is not supported with -dS option.\n\n");
+			SAMPLE_ARCHIVE = false;
+		}
+		else if(DUMP_CT_FILE){
+			if(!SILENT) printf("Ignoring the option --separatectfiles, as all samples are written to the archive %s.\n\n", sampleArchiveFile.c_str());
+			DUMP_CT_FILE = false;
+		}
+	}
+	if(ST_D2_NONREDUNDANT_SAMPLE){
+		if(!RND_SAMPLE){
+			if(!SILENT) printf("Ignoring the option --nonredundant, as it will be valid with --sample option.\n\n");
+			ST_D2_NONREDUNDANT_SAMPLE = false;
+		}
+		else if(CALC_PF_DS){
+			if(!SILENT) printf("Ignoring the option --nonredundant, as it is not supported with -dS option.\n\n");
+			ST_D2_NONREDUNDANT_SAMPLE = false;
+		}
+		else if(DUMP_CT_FILE){
+			if(!SILENT) printf("Ignoring the option --nonredundant, as it is not supported with --separatectfiles option.\n\n");
+			ST_D2_NONREDUNDANT_SAMPLE = false;
+		}
+		else if(ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION){
+			if(!SILENT) printf("Ignoring the option --parallelsample, as every non-redundant sample depends on the previous ones.\n\n");
+			ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION = false;
+		}
+	}
 	if(BPP_ENABLED){
 		//do nothing
 	}
@@ -341,6 +414,21 @@ static void parse_options(int argc, char** argv) {
 					g_nthreads = atoi(argv[++i]);
 				}
 				else help();
+			} else if(strcmp(argv[i], "--batchmem") == 0) {
+				if(i+1 < argc){
+					set_batch_memory(argv[++i]);
+				}
+				else help();
+			} else if(strcmp(argv[i], "--cache-dir") == 0) {
+				if(i+1 < argc){
+					set_cache_dir(argv[++i]);
+				}
+				else help();
+			} else if(strcmp(argv[i], "--cache-size") == 0) {
+				if(i+1 < argc){
+					set_cache_size(argv[++i]);
+				}
+				else help();
 			} else if(strcmp(argv[i], "--bignumprecision") == 0 ) {
                                 if(i+1 < argc){
                                         g_bignumprecision = atoi(argv[++i]);
@@ -416,6 +504,31 @@ static void parse_options(int argc, char** argv) {
 				ST_D2_ENABLE_COUNTS_PARALLELIZATION = true;
 			} else if(strcmp(argv[i],"--parallelsample") == 0){ 
 				ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION = true;
+			} else if(strcmp(argv[i],"--samplearchive") == 0){ 
+				SAMPLE_ARCHIVE = true;
+			} else if(strcmp(argv[i],"--nonredundant") == 0){ 
+				ST_D2_NONREDUNDANT_SAMPLE = true;
+			} else if(strcmp(argv[i],"--exportsamples") == 0){ 
+				if(i+1 < argc){
+					EXPORT_ARCHIVE = true;
+					exportArchiveFile = argv[++i];
+				}
+				else help();
+			} else if(strcmp(argv[i],"--records") == 0){ 
+				if(i+1 < argc){
+					std::string range = argv[++i];
+					size_t pos = range.find(':');
+					exportFirst = strtoull(range.substr(0, pos).c_str(), NULL, 10);
+					if(pos == string::npos) exportLast = exportFirst;
+					else exportLast = strtoull(range.substr(pos+1).c_str(), NULL, 10);
+					if(exportFirst < 1 || (exportLast != 0 && exportLast < exportFirst)){
+						printf("Error: %s is not a valid record range.\n\n", range.c_str());
+						help();
+					}
+				}
+				else help();
+			} else if(strcmp(argv[i],"--ct") == 0){ 
+				EXPORT_CT = true;
 			} else if (strcmp(argv[i],"--pfcount") == 0) {
 				CALC_PART_FUNC = true;
 				PF_COUNT_MODE = true;
@@ -487,7 +600,7 @@ static void parse_options(int argc, char** argv) {
 		}
 	}
 
-	if(seqfile.compare("")==0 || seqfile.empty()) {
+	if(!EXPORT_ARCHIVE && (seqfile.compare("")==0 || seqfile.empty())) {
 		printf("Error: Missing input file.\n");
 		help();
 	}
@@ -495,7 +608,8 @@ static void parse_options(int argc, char** argv) {
 	// If no output file specified, create one
 	if(outputPrefix.empty()) {
 		// base it off the input file
-		outputPrefix += seqfile;
+		if(EXPORT_ARCHIVE) outputPrefix += exportArchiveFile;
+		else outputPrefix += seqfile;
 
 		size_t pos;
 		// extract file name from the path
@@ -508,6 +622,20 @@ static void parse_options(int argc, char** argv) {
 			outputPrefix.erase(outputPrefix.rfind("."));
 	}
 
+	set_output_files();
+}
+
+static void set_output_files() {
+	outputFile = "";
+	bppOutFile = "";
+	sampleOutFile = "";
+	energyDecomposeOutFile = "";
+	estimateBppOutputFile = "";
+	scatterPlotOutputFile = "";
+	pfArraysOutFile = "";
+	sampleArchiveFile = "";
+	exportOutFile = "";
+
 	// If output dir specified
 	if (!outputDir.empty()) {
 		outputFile += outputDir;
@@ -524,6 +652,10 @@ static void parse_options(int argc, char** argv) {
 		scatterPlotOutputFile += "/";
 		pfArraysOutFile += outputDir;
 		pfArraysOutFile += "/";
+		sampleArchiveFile += outputDir;
+		sampleArchiveFile += "/";
+		exportOutFile += outputDir;
+		exportOutFile += "/";
 
 	}
 	// ... and append the .ct
@@ -548,6 +680,12 @@ static void parse_options(int argc, char** argv) {
 	pfArraysOutFile += outputPrefix;
 	pfArraysOutFile += ".pfarrays";
 
+	sampleArchiveFile += outputPrefix;
+	sampleArchiveFile += ".gtsa";
+
+	exportOutFile += outputPrefix;
+	exportOutFile += "_samples.txt";
+
 }
 /*
    double get_seconds() {
@@ -558,18 +696,79 @@ static void parse_options(int argc, char** argv) {
 
 int boltzmann_main(int argc, char** argv) {
 	parse_options(argc, argv);
+	if(EXPORT_ARCHIVE){
+		string ctDir = outputDir.empty() ? "." : outputDir;
+		sample_archive_export(exportArchiveFile, exportFirst, exportLast, exportOutFile, EXPORT_CT, ctDir);
+		return EXIT_SUCCESS;
+	}
+
+	// set for each sequence from these
+	double scale = scaleFactor;
+	int specifier = PF_ST_D2_ADVANCED_DOUBLE_SPECIFIER;
+	boltzmann_file(argc, argv);
+
+	// a worker of gtfoldd goes on with the next files processed with these options
+	while (daemon_next(argc, argv)) {
+		outputPrefix = "";
+		scaleFactor = scale;
+		PF_ST_D2_ADVANCED_DOUBLE_SPECIFIER = specifier;
+		parse_options(argc, argv);
+		boltzmann_file(argc, argv);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* processes every record of seqfile */
+static void boltzmann_file(int argc, char** argv) {
 	validate_options(seqfile);
-	if (read_sequence_file(seqfile.c_str(), seq) == FAILURE) {
+	fasta_reader input;
+	fasta_record record;
+	if (input.open(seqfile.c_str()) == FAILURE) {
 		printf("Failed to open sequence file: %s.\n\n", seqfile.c_str());
 		exit(-1);
 	}
+	input.next(record);
 	parse_mfe_options(argc, argv);
+
+	// read again only for a different set
+	static string loaded;
+	string params = paramDir + (PARAM_DIR ? "+" : "-");
+	if (params != loaded) {
+		readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, 0, 0, 0);
+		cache_params_changed();
+		loaded = params;
+	}
+
+	if (!input.at_end()) {
+		// the workers process record after record
+		string prefix = outputPrefix;
+		double scale = scaleFactor;
+		int specifier = PF_ST_D2_ADVANCED_DOUBLE_SPECIFIER;
+		int nthreads = g_nthreads, threads = g_nthreads;
+		// the MFE tables and the partition function arrays of doubles
+		while (batch_next(input, nthreads, 64, record, threads)) {
+			outputPrefix = batch_output_prefix(prefix, record);
+			set_output_files();
+			scaleFactor = scale;
+			PF_ST_D2_ADVANCED_DOUBLE_SPECIFIER = specifier;
+			seq = record.seq;
+			boltzmann_sequence(threads);
+		}
+		if (batch_failed() > 0) exit(-1);
+		return;
+	}
+	seq.swap(record.seq);
+	input.close();
+	boltzmann_sequence(0);
+}
+
+/* folds seq, threads overrides -t for a record of a batch */
+static void boltzmann_sequence(int threads) {
 	init_fold(seq.c_str());
+	if (threads) g_nthreads = threads;
 	g_LIMIT_DISTANCE = LIMIT_DISTANCE;
 	g_contactDistance = contactDistance;
 
-	readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, 0, 0, 0);
-
 	if(scaleFactor==-1){//that is if scaleFactor is not input by the user, and we only need to decide for its default value
 		if(strlen(seq.c_str())<=100){
 			scaleFactor=0.0;
@@ -627,7 +826,6 @@ int boltzmann_main(int argc, char** argv) {
 
 	free_fold(seq.length());
 	printf("\n");
-	return EXIT_SUCCESS;
 }
 
 static void decideAutomaticallyForAdvancedDoubleSpecifier(){
@@ -707,14 +905,17 @@ static void computeD2Sample(T st_d2){
 	if(PF_COUNT_MODE) pf_count_mode=1;
 	int no_dangle_mode = 0;
 	if(CALC_PF_DO) no_dangle_mode=1;
+	if(PF_PRINT_ARRAYS_ENABLED) st_d2.enablePfArraysOutput();
 	t1 = get_seconds();
 	st_d2.initialize(seq.length(), pf_count_mode, no_dangle_mode, print_energy_decompose, PF_D2_UP_APPROX_ENABLED,ST_D2_ENABLE_CHECK_FRACTION, energyDecomposeOutFile,scaleFactor);
 	t1 = get_seconds() - t1;
 	//printf("D2 Traceback initialization (partition function computation) running time: %9.6f seconds\n", t1);
 	printf("D2 Traceback initialization (partition function computation) running time: %f seconds\n", t1);
 	t1 = get_seconds();
+	if(SAMPLE_ARCHIVE) st_d2.enableSampleArchive(sampleArchiveFile, seq, dangles);
+	if(ST_D2_NONREDUNDANT_SAMPLE) st_d2.enableNonRedundantSampling();
 	if(DUMP_CT_FILE==false){
-		if(ST_D2_ENABLE_COUNTS_PARALLELIZATION && g_nthreads!=1)
+		if(ST_D2_ENABLE_COUNTS_PARALLELIZATION && g_nthreads!=1 && !ST_D2_NONREDUNDANT_SAMPLE)
 			st_d2.batch_sample_parallel(num_rnd,ST_D2_ENABLE_SCATTER_PLOT,ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION,ST_D2_ENABLE_BPP_PROBABILITY, sampleOutFile, estimateBppOutputFile, scatterPlotOutputFile);
 		else st_d2.batch_sample(num_rnd,ST_D2_ENABLE_SCATTER_PLOT,ST_D2_ENABLE_ONE_SAMPLE_PARALLELIZATION,ST_D2_ENABLE_UNIFORM_SAMPLE,ST_D2_UNIFORM_SAMPLE_ENERGY,ST_D2_ENABLE_BPP_PROBABILITY, sampleOutFile, estimateBppOutputFile, scatterPlotOutputFile);
 	}
@@ -760,22 +961,54 @@ static void handleDsSample(){
 
 static void handleBpp(){
 	printf("\n");
-	printf("Calculating partition function\n");
+	int len = seq.length();
 	double ** Q,  **QM, **QB, **P;
-	Q = mallocTwoD(seq.length() + 1, seq.length() + 1);
-	QM = mallocTwoD(seq.length() + 1, seq.length() + 1);
-	QB = mallocTwoD(seq.length() + 1, seq.length() + 1);
-	P = mallocTwoD(seq.length() + 1, seq.length() + 1);
-
+	P = mallocTwoD(len + 1, len + 1);
+	// fillBasePairProbabilities leaves the pairs closing fewer than 3 bases unset
+	for (int i = 0; i <= len; ++i)
+		memset(P[i], 0, (len + 1)*sizeof(double));
+
+	// P[i][j] for j > i+3
+	size_t cells = len > 4 ? (size_t)(len-3)*(len-4)/2 : 0;
+	std::string key, data;
+	if (cache_enabled()) {
+		key = cache_key("bpp", seq);
+		cache_key_add(key, "limitCD", LIMIT_DISTANCE ? contactDistance : -1);
+		if (!shapeFile.empty()) cache_key_add_file(key, "shape", shapeFile);
+	}
+
+	if (!key.empty() && cache_get(key, data) && data.size() == cells*sizeof(double)) {
+		printf("Base pair probabilities found in the cache\n");
+		const double* p = (const double*)data.data();
+		for (int i = 1; i <= len; ++i)
+			for (int j = i+4; j <= len; ++j)
+				P[i][j] = *p++;
+	} else {
+		printf("Calculating partition function\n");
+		Q = mallocTwoD(len + 1, len + 1);
+		QM = mallocTwoD(len + 1, len + 1);
+		QB = mallocTwoD(len + 1, len + 1);
+
+		fill_partition_fn_arrays(len, Q, QB, QM);
+		fillBasePairProbabilities(len, Q, QB, QM, P);
+
+		freeTwoD(Q, len + 1, len + 1);
+		freeTwoD(QM, len + 1, len + 1);
+		freeTwoD(QB, len + 1, len + 1);
+
+		if (!key.empty()) {
+			data.resize(cells*sizeof(double));
+			double* p = (double*)&data[0];
+			for (int i = 1; i <= len; ++i)
+				for (int j = i+4; j <= len; ++j)
+					*p++ = P[i][j];
+			cache_put(key, data);
+		}
+	}
 
-	fill_partition_fn_arrays(seq.length(), Q, QB, QM);
-	fillBasePairProbabilities(seq.length(), Q, QB, QM, P);
-	//printBasePairProbabilities(seq.length(), structure, P, bppOutFile.c_str());
-	printBasePairProbabilitiesDetail(seq.length(), structure, P, bppOutFile.c_str());
+	//printBasePairProbabilities(len, structure, P, bppOutFile.c_str());
+	printBasePairProbabilitiesDetail(len, structure, P, bppOutFile.c_str());
 	printf("Saved BPP output in %s\n",bppOutFile.c_str());
 
-	freeTwoD(Q, seq.length() + 1, seq.length() + 1);
-	freeTwoD(QM, seq.length() + 1, seq.length() + 1);
-	freeTwoD(QB, seq.length() + 1, seq.length() + 1);
-	freeTwoD(P, seq.length() + 1, seq.length() + 1);
+	freeTwoD(P, len + 1, len + 1);
 }
@@ -0,0 +1,26 @@
+/*
+ GTfold: compute minimum free energy of RNA secondary structure
+ Copyright (C) 2008  David A. Bader
+ http://www.cc.gatech.edu/~bader
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Empty built-in parameter snapshots for gtfold-compile-params, which writes the real ones */
+#include <stddef.h>
+
+const unsigned char param_snapshot_turner99[1] = {0};
+const size_t param_snapshot_turner99_size = 0;
+const unsigned char param_snapshot_rnaparams[1] = {0};
+const size_t param_snapshot_rnaparams_size = 0;
@@ -8,6 +8,7 @@
 #include <stack>
 #include <map>
 #include<sstream>
+#include "sample-archive.h" //build with: g++ -I../include calc_pnum.cc sample-archive.cc global.cc utils.cc
 static int verbose=0;
 using namespace std;
 
@@ -59,12 +60,41 @@ void updatePnum(int * strucArr, int** pnumArr, int* pnumLen, int length){
 	}
 }	
 
+//Reads the structures straight from a binary sample archive written by gtboltzmann --samplearchive
+static int calcPnumFromArchive(char* filename){
+	SampleArchiveReader reader;
+	reader.open(filename);
+	int length = reader.header().length;
+	if(verbose==1)cout<<"seq="<<reader.header().seq<<endl;
+	int** pnumArr = new int*[length+1];
+	for(int i=1; i<=length; ++i) pnumArr[i] = new int[length];
+	int* pnumLen = new int[length+1];
+	for(int i=1; i<=length; ++i) pnumLen[i]=0;
+	int* strucArr = new int[length+1];
+	int numStrucs = reader.count();
+	for(int k=0; k<numStrucs; ++k){
+		double energy, probability;
+		reader.read(k, strucArr, energy, probability);
+		for(int i=1; i<=length; ++i) if(strucArr[i]==0) strucArr[i]=-1;
+		updatePnum(strucArr, pnumArr, pnumLen, length);
+	}
+	if(numStrucs==0){
+		cout<<"zero structures\n";
+		return 0;
+	}
+	for(int i=1; i<=length; ++i){
+		cout<<i<<" "<<(double)pnumLen[i]/numStrucs<<endl;
+	}
+	return 0;
+}
+
 int main(int argc, char** argv){
 	if(argc<2){
-		cout<<"Usage: ./calc_pnum file_ss.txt\n";
+		cout<<"Usage: ./calc_pnum file_ss.txt|samples.gtsa\n";
 		exit(-1);
 	}
 	char* filename = argv[1];
+	if(is_sample_archive(filename)) return calcPnumFromArchive(filename);
 	ifstream fin(filename);
 	string seq;
 	string struc;
@@ -0,0 +1,98 @@
+/*
+ GTfold: compute minimum free energy of RNA secondary structure
+ Copyright (C) 2008  David A. Bader
+ http://www.cc.gatech.edu/~bader
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* gtfold-compile-params: parses a parameter directory once and writes it as a binary snapshot */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "loader.h"
+#include "param-snapshot.h"
+
+static void help()
+{
+	printf("Usage: gtfold-compile-params [OPTION]... DIR OUTFILE\n\n");
+	printf("   Reads the thermodynamic parameters in DIR and writes them to OUTFILE as a binary\n");
+	printf("   snapshot, which gtmfe, gtsubopt and gtboltzmann load with -p OUTFILE.\n\n");
+	printf("OPTIONS\n");
+	printf("   -m, --mismatch       Include the terminal mismatch tables (tstackm.DAT, tstacke.DAT).\n");
+	printf("   --unafold            Read the UNAfold file set (sint2.DAT, sint4.DAT, asint1x2.DAT, tstacki23.DAT, ...).\n");
+	printf("   --name NAME          Name of the parameter set, the name of DIR by default.\n");
+	printf("   --c-source           Write OUTFILE as a C array to be compiled into gtfold.\n");
+	printf("   -h, --help           Output help (this message) and exit.\n");
+}
+
+int main(int argc, char** argv)
+{
+	int unamode = 0, mismatch = 0;
+	bool c_source = false;
+	std::string name, dir, outFile;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--mismatch") == 0 || strcmp(argv[i], "-m") == 0) {
+			mismatch = 1;
+		} else if (strcmp(argv[i], "--unafold") == 0) {
+			unamode = 1;
+		} else if (strcmp(argv[i], "--c-source") == 0) {
+			c_source = true;
+		} else if (strcmp(argv[i], "--name") == 0) {
+			if (i < argc-1) {
+				name = argv[++i];
+			} else {
+				help();
+				exit(-1);
+			}
+		} else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			help();
+			exit(0);
+		} else if (dir.empty()) {
+			dir = argv[i];
+		} else if (outFile.empty()) {
+			outFile = argv[i];
+		} else {
+			help();
+			exit(-1);
+		}
+	}
+	if (dir.empty() || outFile.empty()) {
+		help();
+		exit(-1);
+	}
+
+	if (name.empty()) {
+		name = dir;
+		while (name.length() > 1 && name[name.length()-1] == '/') name.erase(name.length()-1);
+		name = name.substr(name.find_last_of('/') + 1);
+	}
+
+	readThermodynamicParameters(dir.c_str(), true, unamode, 0, mismatch);
+
+	int flags = 0;
+	if (unamode) flags |= PARAM_SNAPSHOT_UNAMODE | PARAM_SNAPSHOT_MISMATCH;
+	if (mismatch) flags |= PARAM_SNAPSHOT_MISMATCH;
+	if (c_source)
+		save_param_snapshot_source(outFile, name, flags);
+	else
+		save_param_snapshot(outFile, name, flags);
+
+	printf("Wrote %s parameter snapshot to %s\n", name.c_str(), outFile.c_str());
+	return EXIT_SUCCESS;
+}
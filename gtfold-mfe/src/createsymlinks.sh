@@ -5,4 +5,6 @@ echo 'creating symlinks under' $BINDIR
 ln -sf gtfold $BINDIR/gtmfe
 ln -sf gtfold $BINDIR/gtsubopt
 ln -sf gtfold $BINDIR/gtboltzmann
+ln -sf gtfold $BINDIR/gtfoldd
+ln -sf gtfold $BINDIR/gtfold-client
 
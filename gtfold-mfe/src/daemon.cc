@@ -0,0 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "utils.h"
+#include "mfe_main.h"
+#include "boltzmann_main.h"
+#include "daemon.h"
+
+using namespace std;
+
+static const char DAEMON_MAGIC[4] = {'G','T','F','D'};
+
+/* a command line to run */
+struct daemon_request
+{
+	int client;         /* connection to reply on */
+	int out, err;       /* stdout and stderr of the client */
+	string cwd;
+	vector<string> args;
+	string key;         /* what a worker must have run to take the request */
+};
+
+/* a worker process as seen by gtfoldd */
+struct daemon_worker
+{
+	pid_t pid;
+	int chan;           /* requests to the worker, exit statuses back */
+	string key;
+	int client;         /* connection of the request being run, -1 when idle */
+	double last;        /* when its last request was done */
+};
+
+/* set in a worker */
+static pid_t worker_pid = 0;
+static int worker_chan = -1;
+static vector<string> worker_args;
+static vector<char*> worker_argv;
+
+static volatile sig_atomic_t stopping = 0;
+
+static bool write_all(int fd, const void* buf, size_t size) {
+	const char* p = (const char*)buf;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void* buf, size_t size) {
+	char* p = (char*)buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static string socket_path() {
+	const char* env = getenv("GTFOLDD_SOCKET");
+	if (env != NULL && *env != '\0') return env;
+	char path[64];
+	sprintf(path, GTFOLDD_SOCKET, (int)getuid());
+	return path;
+}
+
+/* the tool a command line runs, empty if gtfoldd does not run it */
+static string tool_name(const string& arg0) {
+	if (arg0.find("gtmfe") != string::npos) return "gtmfe";
+	if (arg0.find("gtboltzmann") != string::npos) return "gtboltzmann";
+	return "";
+}
+
+static string request_key(const daemon_request& r) {
+	string key = tool_name(r.args[0]);
+	key += '\0';
+	key += r.cwd;
+	size_t n = r.args.size();
+	// the sequence file
+	if (n > 1 && r.args[n-1][0] != '-') n--;
+	for (size_t k = 1; k < n; k++) {
+		key += '\0';
+		key += r.args[k];
+	}
+	return key;
+}
+
+static bool send_request(int fd, const daemon_request& r) {
+	string payload = r.cwd;
+	payload += '\0';
+	for (size_t k = 0; k < r.args.size(); k++) {
+		payload += r.args[k];
+		payload += '\0';
+	}
+
+	daemon_header h;
+	memcpy(h.magic, DAEMON_MAGIC, 4);
+	h.version = GTFOLDD_VERSION;
+	h.argc = r.args.size();
+	h.size = payload.size();
+
+	// the descriptors go with the first byte of the header
+	int fds[2] = {r.out, r.err};
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov;
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+	ssize_t n;
+	do {
+		n = sendmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) return false;
+	return write_all(fd, (char*)&h + n, sizeof(h) - n) && write_all(fd, payload.data(), payload.size());
+}
+
+/* false on a closed connection or a malformed request, with no descriptor left open */
+static bool recv_request(int fd, daemon_request& r) {
+	daemon_header h;
+	char control[CMSG_SPACE(2*sizeof(int))];
+	struct iovec iov;
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t n;
+	do {
+		n = recvmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+
+	r.out = r.err = -1;
+	for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); n > 0 && c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+		int count = (c->cmsg_len - CMSG_LEN(0))/sizeof(int);
+		int* fds = (int*)CMSG_DATA(c);
+		for (int k = 0; k < count; k++) {
+			if (k == 0 && r.out < 0) r.out = fds[k];
+			else if (k == 1 && r.err < 0) r.err = fds[k];
+			else close(fds[k]);
+		}
+	}
+
+	bool ok = n > 0 && read_all(fd, (char*)&h + n, sizeof(h) - n)
+		&& memcmp(h.magic, DAEMON_MAGIC, 4) == 0 && h.version == GTFOLDD_VERSION
+		&& h.argc > 0 && h.size <= GTFOLDD_MAX_REQUEST && r.out >= 0 && r.err >= 0;
+	string payload;
+	if (ok) {
+		payload.resize(h.size);
+		ok = h.size > 0 && read_all(fd, &payload[0], h.size) && payload[h.size-1] == '\0';
+	}
+	if (ok) {
+		// the working directory, then the arguments
+		r.args.clear();
+		size_t start = payload.find('\0') + 1;
+		r.cwd = payload.substr(0, start - 1);
+		while (start < payload.size()) {
+			size_t end = payload.find('\0', start);
+			r.args.push_back(payload.substr(start, end - start));
+			start = end + 1;
+		}
+		ok = r.args.size() == h.argc;
+	}
+	if (!ok) {
+		if (r.out >= 0) close(r.out);
+		if (r.err >= 0) close(r.err);
+		r.out = r.err = -1;
+	}
+	return ok;
+}
+
+/* takes the descriptors and the working directory of r in a worker */
+static void begin_request(daemon_request& r, int& argc, char**& argv) {
+	fflush(stdout);
+	fflush(stderr);
+	dup2(r.out, STDOUT_FILENO);
+	dup2(r.err, STDERR_FILENO);
+	close(r.out);
+	close(r.err);
+	if (chdir(r.cwd.c_str()) != 0) {
+		printf("Cannot change to the working directory %s: %s\n", r.cwd.c_str(), strerror(errno));
+		exit(-1);
+	}
+
+	worker_args.swap(r.args);
+	worker_argv.clear();
+	for (size_t k = 0; k < worker_args.size(); k++)
+		worker_argv.push_back(&worker_args[k][0]);
+	worker_argv.push_back(NULL);
+	argc = worker_args.size();
+	argv = &worker_argv[0];
+}
+
+bool daemon_next(int& argc, char**& argv) {
+	// batch workers forked by a worker are not workers of gtfoldd
+	if (worker_pid == 0 || getpid() != worker_pid)
+		return false;
+
+	// the client may be waiting for the end of its output, nothing of it is kept open
+	fflush(stdout);
+	fflush(stderr);
+	int null = open("/dev/null", O_WRONLY);
+	if (null >= 0) {
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+	}
+
+	int status = EXIT_SUCCESS;
+	daemon_request r;
+	if (!write_all(worker_chan, &status, sizeof(status)) || !recv_request(worker_chan, r))
+		return false;
+	begin_request(r, argc, argv);
+	return true;
+}
+
+static void reply(int client, int status) {
+	write_all(client, &status, sizeof(status));
+	close(client);
+}
+
+/* closes the channel of a worker and reaps it, returns its exit status */
+static int stop_worker(daemon_worker& w) {
+	int status;
+	close(w.chan);
+	while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR);
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return -1;
+}
+
+/* forks a worker that runs r, false if it cannot be started */
+static bool start_worker(int listener, vector<daemon_worker>& workers, deque<daemon_request>& waiting,
+		daemon_request& r) {
+	int chan[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, chan) != 0) {
+		perror("gtfoldd cannot set up a worker");
+		return false;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("gtfoldd cannot fork a worker");
+		close(chan[0]);
+		close(chan[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(listener);
+		close(chan[0]);
+		for (size_t k = 0; k < workers.size(); k++) {
+			close(workers[k].chan);
+			if (workers[k].client >= 0) close(workers[k].client);
+		}
+		for (size_t k = 0; k < waiting.size(); k++) {
+			close(waiting[k].client);
+			if (&waiting[k] == &r) continue;
+			close(waiting[k].out);
+			close(waiting[k].err);
+		}
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		worker_pid = getpid();
+		worker_chan = chan[1];
+
+		int argc;
+		char** argv;
+		string tool = tool_name(r.args[0]);
+		begin_request(r, argc, argv);
+		if (tool == "gtmfe") mfe_main(argc, argv);
+		else boltzmann_main(argc, argv);
+		fflush(stdout);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(chan[1]);
+	daemon_worker w;
+	w.pid = pid;
+	w.chan = chan[0];
+	w.key = r.key;
+	w.client = r.client;
+	w.last = get_seconds();
+	workers.push_back(w);
+	return true;
+}
+
+/* hands the waiting requests to the workers, in turn as far as the workers allow */
+static void dispatch(int listener, vector<daemon_worker>& workers, deque<daemon_request>& waiting,
+		int maxWorkers) {
+	size_t q = 0;
+	while (q < waiting.size()) {
+		daemon_request& r = waiting[q];
+		size_t k = 0;
+		while (k < workers.size() && (workers[k].client >= 0 || workers[k].key != r.key)) k++;
+
+		if (k < workers.size()) {
+			if (!send_request(workers[k].chan, r)) {
+				// the worker has gone away while idle
+				stop_worker(workers[k]);
+				workers.erase(workers.begin() + k);
+				continue;
+			}
+			workers[k].client = r.client;
+		} else {
+			if ((int)workers.size() >= maxWorkers) {
+				// the least recently used idle worker makes room
+				size_t lru = workers.size();
+				for (k = 0; k < workers.size(); k++)
+					if (workers[k].client < 0 && (lru == workers.size() || workers[k].last < workers[lru].last))
+						lru = k;
+				if (lru == workers.size()) {
+					q++;
+					continue;
+				}
+				stop_worker(workers[lru]);
+				workers.erase(workers.begin() + lru);
+			}
+			if (!start_worker(listener, workers, waiting, r))
+				reply(r.client, -1);
+		}
+
+		close(r.out);
+		close(r.err);
+		waiting.erase(waiting.begin() + q);
+	}
+}
+
+static void accept_request(int listener, deque<daemon_request>& waiting) {
+	int client = accept(listener, NULL, NULL);
+	if (client < 0) return;
+
+	// a client sends its request right after connecting
+	struct timeval tv;
+	tv.tv_sec = 5;
+	tv.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	daemon_request r;
+	if (!recv_request(client, r)) {
+		close(client);
+		return;
+	}
+	r.client = client;
+	if (tool_name(r.args[0]).empty()) {
+		const char* msg = "gtfoldd runs gtmfe and gtboltzmann command lines only\n";
+		write_all(r.err, msg, strlen(msg));
+		close(r.out);
+		close(r.err);
+		reply(client, -1);
+		return;
+	}
+	r.key = request_key(r);
+	waiting.push_back(r);
+}
+
+static int listen_on(const string& path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr.sun_path)) {
+		printf("INVALID ARGUMENTS: the socket path %s is too long\n", path.c_str());
+		exit(-1);
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	// a socket left behind by a gtfoldd that has gone is replaced
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+		printf("gtfoldd is already listening on %s\n", path.c_str());
+		exit(-1);
+	}
+	if (fd >= 0) close(fd);
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path.c_str());
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	mode_t mask = umask(077);
+	bool ok = fd >= 0 && bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 64) == 0;
+	umask(mask);
+	if (!ok) {
+		printf("Cannot listen on %s: %s\n", path.c_str(), strerror(errno));
+		exit(-1);
+	}
+	return fd;
+}
+
+static void stop(int) {
+	stopping = 1;
+}
+
+static void daemon_help() {
+	printf("Usage: gtfoldd [OPTION]...\n\n");
+	printf("   Runs gtmfe and gtboltzmann command lines sent by gtfold-client, in worker processes that\n");
+	printf("   keep their parameters, tables and threads for the next command lines with the same options.\n");
+	printf("   gtfoldd runs in the foreground until it is interrupted or terminated.\n\n");
+	printf("OPTIONS\n");
+	printf("   --socket PATH        Listen on the Unix domain socket PATH, GTFOLDD_SOCKET or\n");
+	printf("                        /tmp/gtfoldd-UID.sock by default.\n");
+	printf("   --workers INT        Run at most INT command lines at once, the number of processors\n");
+	printf("                        by default.\n");
+	printf("   -h, --help           Output help (this message) and exit.\n");
+	printf("\nThe workers read the default parameters through the environment of gtfoldd (GTFOLDDATADIR).\n");
+	exit(-1);
+}
+
+int gtfoldd_main(int argc, char** argv) {
+	string path = socket_path();
+	int maxWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) {
+			path = argv[++i];
+		} else if (strcmp(argv[i], "--workers") == 0 && i+1 < argc) {
+			maxWorkers = atoi(argv[++i]);
+			if (maxWorkers <= 0) {
+				printf("INVALID ARGUMENTS: --workers accepts positive integers\n\n");
+				daemon_help();
+			}
+		} else {
+			daemon_help();
+		}
+	}
+	if (maxWorkers <= 0) maxWorkers = 1;
+
+	int listener = listen_on(path);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("gtfoldd listening on %s with up to %d worker%s\n", path.c_str(), maxWorkers, maxWorkers > 1 ? "s" : "");
+	fflush(stdout);
+
+	vector<daemon_worker> workers;
+	deque<daemon_request> waiting;
+	while (!stopping) {
+		dispatch(listener, workers, waiting, maxWorkers);
+
+		// the listener, then the channel and the connection of each busy worker
+		vector<struct pollfd> fds;
+		vector<size_t> busy;
+		struct pollfd p;
+		p.fd = listener;
+		p.events = POLLIN;
+		p.revents = 0;
+		fds.push_back(p);
+		for (size_t k = 0; k < workers.size(); k++) {
+			if (workers[k].client < 0) continue;
+			p.fd = workers[k].chan;
+			fds.push_back(p);
+			p.fd = workers[k].client;
+			fds.push_back(p);
+			busy.push_back(k);
+		}
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("gtfoldd cannot wait for requests");
+			break;
+		}
+
+		for (int b = (int)busy.size()-1; b >= 0; b--) {
+			daemon_worker& w = workers[busy[b]];
+			if (fds[1 + 2*b].revents != 0) {
+				int status;
+				if (read_all(w.chan, &status, sizeof(status))) {
+					reply(w.client, status);
+					w.client = -1;
+					w.last = get_seconds();
+				} else {
+					// the worker has exited, at the end of a run that does not take more requests
+					// or on an error
+					reply(w.client, stop_worker(w));
+					workers.erase(workers.begin() + busy[b]);
+				}
+			} else if (fds[2 + 2*b].revents != 0) {
+				// the client has gone away, nobody waits for the run
+				kill(w.pid, SIGKILL);
+				stop_worker(w);
+				close(w.client);
+				workers.erase(workers.begin() + busy[b]);
+			}
+		}
+		if (fds[0].revents & POLLIN)
+			accept_request(listener, waiting);
+	}
+
+	close(listener);
+	unlink(path.c_str());
+	for (size_t q = 0; q < waiting.size(); q++) {
+		close(waiting[q].out);
+		close(waiting[q].err);
+		close(waiting[q].client);
+	}
+	// idle workers exit when their channel is closed
+	for (size_t k = 0; k < workers.size(); k++) {
+		if (workers[k].client >= 0) {
+			kill(workers[k].pid, SIGTERM);
+			close(workers[k].client);
+		}
+		stop_worker(workers[k]);
+	}
+	printf("gtfoldd stopped\n");
+	return EXIT_SUCCESS;
+}
+
+static void client_help() {
+	printf("Usage: gtfold-client [--socket PATH] gtmfe|gtboltzmann [OPTION]... FILE\n\n");
+	printf("   Runs a gtmfe or gtboltzmann command line in gtfoldd, with the output printed here and the\n");
+	printf("   output files written relative to the current directory, and exits with its exit status.\n\n");
+	printf("OPTIONS\n");
+	printf("   --socket PATH        Socket gtfoldd listens on, GTFOLDD_SOCKET or /tmp/gtfoldd-UID.sock\n");
+	printf("                        by default.\n");
+	exit(-1);
+}
+
+int gtfold_client_main(int argc, char** argv) {
+	string path = socket_path();
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) {
+			path = argv[i+1];
+			i += 2;
+		} else {
+			client_help();
+		}
+	}
+	if (i >= argc) client_help();
+
+	daemon_request r;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("Cannot read the current directory");
+		exit(-1);
+	}
+	r.cwd = cwd;
+	r.out = STDOUT_FILENO;
+	r.err = STDERR_FILENO;
+	for (; i < argc; i++)
+		r.args.push_back(argv[i]);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		printf("Cannot connect to gtfoldd on %s: %s\n", path.c_str(), strerror(errno));
+		exit(-1);
+	}
+
+	// the run prints after what is printed here
+	fflush(stdout);
+	fflush(stderr);
+	signal(SIGPIPE, SIG_IGN);
+	int status;
+	if (!send_request(fd, r) || !read_all(fd, &status, sizeof(status))) {
+		printf("gtfoldd stopped before the run was done\n");
+		exit(-1);
+	}
+	exit(status);
+}
@@ -21,75 +21,100 @@ int alloc_flag = 0;
 const float RT = ((0.00198721 * 310.15)*100); //* 100.00);
 const float RT_ = (0.00198721 * 310.15);
 
-void create_tables(int len) {	
-	V = (int *) malloc(((len+1)*len/2 + 1) * sizeof(int));
-	if (V == NULL) {
-		perror("Cannot allocate variable 'V'");
-		exit(-1);
-	}
-
-	int i;
-	WM = (int **) malloc((len+1)* sizeof(int *));
-	if (WM == NULL) {
-		perror("Cannot allocate variable 'WM'");
+/*
+ * The tables of a finished fold go back to a pool instead of being freed, and create_tables
+ * hands them to the next fold. A set grows to the longest sequence it has held, and the rows of
+ * WM, WMPrime and PP are packed with a stride of len+1 into one block each, so a shorter
+ * sequence uses (and init_tables resets) only the leading part of the blocks and the pages stay
+ * mapped between folds. Sets bound to a fold are kept on tables_in_use, so several folds can
+ * hold tables at once (see FoldContext).
+ */
+struct table_set {
+	int cap;
+	int *V, *VM, *VBI, *W, *indx;
+	int *WMblock, *WMPrimeblock, *PPblock;
+	int **WM, **WMPrime, **PP;
+	struct table_set *next;
+};
+
+static struct table_set *table_pool = NULL;
+static struct table_set *tables_in_use = NULL;
+
+static void *alloc_table(size_t size, const char *name) {
+	void *p = malloc(size);
+	if (p == NULL) {
+		fprintf(stderr, "Cannot allocate variable '%s': ", name);
+		perror("");
 		exit(-1);
-	}   
-	for (i = 0; i <= len; i++) {
-		WM[i] = (int *)malloc((len+1)* sizeof(int));
-		if (WM[i] == NULL) {
-			perror("Cannot allocate variable 'WM[i]'");
-			exit(-1);
-		}   
 	}
+	return p;
+}
 
-	PP = (int **) malloc((len+1)* sizeof(int *));
-	if (PP == NULL) {
-		perror("Cannot allocate variable 'WM'");
-		exit(-1);
-	}   
-	for (i = 0; i <= len; i++) {
-		PP[i] = (int *)malloc((len+1)* sizeof(int));
-		if (PP[i] == NULL) {
-			perror("Cannot allocate variable 'WM[i]'");
-			exit(-1);
-		}   
-	}
+static void free_table_set(struct table_set *t) {
+	free(t->V); free(t->VM); free(t->VBI); free(t->W); free(t->indx);
+	free(t->WMblock); free(t->WMPrimeblock); free(t->PPblock);
+	free(t->WM); free(t->WMPrime); free(t->PP);
+}
 
-  	WMPrime = (int **) malloc((len+1)* sizeof(int *));
-	if (WMPrime == NULL) {
-		perror("Cannot allocate variable 'WM'");
-		exit(-1);
-	}   
-	for (i = 0; i <= len; i++) {
-		WMPrime[i] = (int *)malloc((len+1)* sizeof(int));
-		if (WMPrime[i] == NULL) {
-			perror("Cannot allocate variable 'WM[i]'");
-			exit(-1);
-		}   
-	}
+static void alloc_table_set(struct table_set *t, int len) {
+	size_t tri = ((size_t)(len+1)*len/2 + 1) * sizeof(int);
+	size_t full = (size_t)(len+1)*(len+1) * sizeof(int);
+	t->cap = len;
+	t->V = (int *) alloc_table(tri, "V");
+	t->VM = (int *) alloc_table(tri, "VM");
+	t->VBI = (int *) alloc_table(tri, "VBI");
+	t->W = (int *) alloc_table((len+1) * sizeof(int), "W");
+	t->indx = (int *) alloc_table((len+1) * sizeof(int), "indx");
+	t->WMblock = (int *) alloc_table(full, "WM");
+	t->WMPrimeblock = (int *) alloc_table(full, "WMPrime");
+	t->PPblock = (int *) alloc_table(full, "PP");
+	t->WM = (int **) alloc_table((len+1) * sizeof(int *), "WM");
+	t->WMPrime = (int **) alloc_table((len+1) * sizeof(int *), "WMPrime");
+	t->PP = (int **) alloc_table((len+1) * sizeof(int *), "PP");
+}
 
-	VM = (int *) malloc(((len+1)*len/2 + 1) * sizeof(int));
-	if (VM == NULL) {
-		perror("Cannot allocate variable 'V'");
-		exit(-1);
+/* the smallest pooled set that fits len, else the largest one grown to len */
+static struct table_set *take_table_set(int len) {
+	struct table_set **p, **best = NULL;
+	for (p = &table_pool; *p; p = &(*p)->next) {
+		int cap = (*p)->cap;
+		if (best == NULL || ((*best)->cap < len ? cap > (*best)->cap : cap >= len && cap < (*best)->cap))
+			best = p;
 	}
 
-	VBI = (int *) malloc(((len+1)*len/2 + 1) * sizeof(int));
-	if (VBI == NULL) {
-		perror("Cannot allocate variable 'V'");
-		exit(-1);
+	struct table_set *t;
+	if (best) {
+		t = *best;
+		*best = t->next;
+		if (t->cap < len) {
+			free_table_set(t);
+			alloc_table_set(t, len);
+		}
+	} else {
+		t = (struct table_set *) alloc_table(sizeof(struct table_set), "tables");
+		alloc_table_set(t, len);
 	}
+	t->next = tables_in_use;
+	tables_in_use = t;
+	return t;
+}
 
-	W = (int *) malloc((len+1) * sizeof(int));
-	if (W == NULL) {
-		perror("Cannot allocate variable 'W'");
-		exit(-1);
-	}
+void create_tables(int len) {	
+	struct table_set *t = take_table_set(len);
+	int i;
 
-	indx = (int*) malloc((len+1) * sizeof(int));
-	if (indx == NULL) {
-		perror("Cannot allocate variable 'indx'");
-		exit(-1);
+	V = t->V;
+	VM = t->VM;
+	VBI = t->VBI;
+	W = t->W;
+	indx = t->indx;
+	WM = t->WM;
+	WMPrime = t->WMPrime;
+	PP = t->PP;
+	for (i = 0; i <= len; i++) {
+		WM[i] = t->WMblock + (size_t)i*(len+1);
+		WMPrime[i] = t->WMPrimeblock + (size_t)i*(len+1);
+		PP[i] = t->PPblock + (size_t)i*(len+1);
 	}
 
 	alloc_flag = 1;
@@ -125,19 +150,25 @@ void init_tables(int len) {
 
 void free_tables(int len) {
 	if (alloc_flag == 1) {
-		free(indx);
-
-		int i;
-		for (i = 0; i <= len; i++) free(WM[i]);
-		free(WM);
-
-		for (i = 0; i <= len; i++) free(WMPrime[i]);
-		free(WMPrime);
+		struct table_set **p;
+		for (p = &tables_in_use; *p; p = &(*p)->next) {
+			if ((*p)->V == V) {
+				struct table_set *t = *p;
+				*p = t->next;
+				t->next = table_pool;
+				table_pool = t;
+				break;
+			}
+		}
+	}
+}
 
-		free(VM);
-		free(VBI);
-		free(V);
-		free(W);
+void release_tables() {
+	while (table_pool) {
+		struct table_set *t = table_pool;
+		table_pool = t->next;
+		free_table_set(t);
+		free(t);
 	}
 }
 
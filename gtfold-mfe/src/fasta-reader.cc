@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sstream>
+
+#include "constants.h"
+#include "fasta-reader.h"
+
+using namespace std;
+
+static string record_id(const char* header, size_t n, size_t count)
+{
+	string id;
+	size_t i = 1;
+	while (i < n && (header[i] == ' ' || header[i] == '\t')) i++;
+	for (; i < n && header[i] != ' ' && header[i] != '\t'; i++) {
+		char c = header[i];
+		id += (isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_') ? c : '_';
+	}
+	if (id.empty()) {
+		stringstream ss;
+		ss << "record" << count;
+		id = ss.str();
+	}
+	return id;
+}
+
+static bool has_suffix(const string& s, const char* suffix)
+{
+	size_t n = strlen(suffix);
+	return s.length() > n && s.compare(s.length() - n, n, suffix) == 0;
+}
+
+fasta_reader::fasta_reader()
+	: fd(-1), decompressor(0), map(NULL), mapSize(0), buf(NULL), bufSize(0), pos(NULL), end(NULL),
+	eof(true), held(NULL), heldSize(0), holding(false), count(0)
+{
+}
+
+fasta_reader::~fasta_reader()
+{
+	close();
+}
+
+int fasta_reader::open(const char* filename)
+{
+	close();
+	name = filename;
+	count = 0;
+	seen.clear();
+
+	int file = ::open(filename, O_RDONLY);
+	if (file < 0) return FAILURE;
+
+	const char* tool = NULL;
+	if (has_suffix(name, ".gz")) tool = "gzip";
+	else if (has_suffix(name, ".zst")) tool = "zstd";
+
+	if (tool != NULL) {
+		int p[2];
+		if (pipe(p) != 0) {
+			::close(file);
+			return FAILURE;
+		}
+		fflush(stdout);
+		fflush(stderr);
+		decompressor = fork();
+		if (decompressor < 0) {
+			perror("Cannot start the decompressor");
+			exit(-1);
+		}
+		if (decompressor == 0) {
+			dup2(file, STDIN_FILENO);
+			dup2(p[1], STDOUT_FILENO);
+			::close(file);
+			::close(p[0]);
+			::close(p[1]);
+			execlp(tool, tool, "-dc", (char*)NULL);
+			fprintf(stderr, "Cannot run %s to read %s\n", tool, filename);
+			_exit(127);
+		}
+		::close(file);
+		::close(p[1]);
+		fd = p[0];
+	} else {
+		fd = file;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			pos = end = NULL;
+			eof = true;
+			if (st.st_size == 0) return SUCCESS;
+			void* m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (m != MAP_FAILED) {
+				map = (char*)m;
+				mapSize = st.st_size;
+				madvise(map, mapSize, MADV_SEQUENTIAL);
+				pos = map;
+				end = map + mapSize;
+				return SUCCESS;
+			}
+		}
+	}
+
+	// pipes, and files that cannot be mapped
+	bufSize = FASTA_READ_BUFFER;
+	buf = (char*)malloc(bufSize);
+	if (buf == NULL) {
+		perror("Cannot allocate the FASTA read buffer");
+		exit(-1);
+	}
+	pos = end = buf;
+	eof = false;
+	return SUCCESS;
+}
+
+void fasta_reader::release()
+{
+	if (map != NULL) munmap(map, mapSize);
+	free(buf);
+	if (fd >= 0) ::close(fd);
+	map = NULL;
+	mapSize = 0;
+	buf = NULL;
+	bufSize = 0;
+	fd = -1;
+	decompressor = 0;
+	pos = end = NULL;
+	eof = true;
+	holding = false;
+}
+
+void fasta_reader::close()
+{
+	pid_t child = decompressor;
+	release();
+	// a decompressor stopped before the end of its input exits on the closed pipe
+	if (child > 0) waitpid(child, NULL, 0);
+}
+
+/* moves what is left to the front of the buffer and reads more, false at the end of the input */
+bool fasta_reader::refill()
+{
+	size_t left = end - pos;
+	memmove(buf, pos, left);
+	if (left == bufSize) {
+		// a line longer than the buffer
+		bufSize *= 2;
+		buf = (char*)realloc(buf, bufSize);
+		if (buf == NULL) {
+			perror("Cannot allocate the FASTA read buffer");
+			exit(-1);
+		}
+	}
+	pos = buf;
+	end = buf + left;
+
+	ssize_t n;
+	do {
+		n = read(fd, buf + left, bufSize - left);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		perror("Cannot read the sequence file");
+		exit(-1);
+	}
+	if (n > 0) {
+		end += n;
+		return true;
+	}
+
+	eof = true;
+	if (decompressor > 0) {
+		int status;
+		waitpid(decompressor, &status, 0);
+		decompressor = 0;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			printf("Failed to decompress sequence file: %s.\n\n", name.c_str());
+			exit(-1);
+		}
+	}
+	return false;
+}
+
+/* the next line without its line break, in place in the map or the buffer */
+bool fasta_reader::line(const char*& s, size_t& n)
+{
+	for (;;) {
+		const char* nl = pos < end ? (const char*)memchr(pos, '\n', end - pos) : NULL;
+		if (nl != NULL) {
+			s = pos;
+			n = nl - pos;
+			pos = nl + 1;
+			break;
+		}
+		if (eof) {
+			if (pos == end) return false;
+			s = pos;
+			n = end - pos;
+			pos = end;
+			break;
+		}
+		refill();
+	}
+	if (n > 0 && s[n-1] == '\r') n--;
+	return true;
+}
+
+bool fasta_reader::at_end()
+{
+	const char* s;
+	size_t n;
+	while (!holding) {
+		if (!line(s, n)) return true;
+		if (n == 0 || s[0] == ';') continue;
+		held = s;
+		heldSize = n;
+		holding = true;
+	}
+	return false;
+}
+
+bool fasta_reader::next(fasta_record& record)
+{
+	record.id.clear();
+	record.seq.clear();
+
+	const char* s;
+	size_t n;
+	bool started = false;
+	for (;;) {
+		if (holding) {
+			s = held;
+			n = heldSize;
+			holding = false;
+		} else if (!line(s, n)) {
+			break;
+		}
+		if (n == 0 || s[0] == ';') continue;
+		if (s[0] == '>') {
+			if (started) {
+				// the header of the next record
+				held = s;
+				heldSize = n;
+				holding = true;
+				break;
+			}
+			count++;
+			record.id = record_id(s, n, count);
+			started = true;
+			continue;
+		}
+		if (!started) {
+			count++;
+			started = true;
+		}
+		size_t i = 0;
+		while (i < n) {
+			size_t j = i;
+			while (j < n && s[j] != ' ' && s[j] != '\t') j++;
+			record.seq.append(s + i, j - i);
+			i = j + 1;
+		}
+	}
+	if (!started) return false;
+
+	// record IDs name the output files
+	if (record.id.empty()) {
+		if (count == 1 && at_end()) return true;
+		record.id = record_id(">", 1, count);
+	}
+	hash<string> id_hash;
+	if (!seen.insert(id_hash(record.id)).second) {
+		stringstream ss;
+		ss << record.id << "_" << count;
+		record.id = ss.str();
+		seen.insert(id_hash(record.id));
+	}
+	return true;
+}
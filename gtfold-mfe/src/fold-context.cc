@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+#include "global.h"
+#include "energy.h"
+#include "algorithms.h"
+#include "traceback.h"
+#include "constraints.h"
+#include "shapereader.h"
+#include "loader.h"
+#include "fold-context.h"
+
+/* the engine's per fold globals, saved into and restored from a context */
+#define FOLD_GLOBALS(X) \
+	X(RNA) X(structure) X(chPairKey) \
+	X(V) X(W) X(VBI) X(VM) X(WM) X(WMPrime) X(indx) X(PP) \
+	X(BP) X(ind) X(PBP) X(FBP) X(nPBP) X(nFBP) \
+	X(SHAPEarray) X(SHAPEenergies) X(SHAPE_ENABLED) \
+	X(g_nthreads) X(g_unamode) X(g_dangles) X(g_mismatch) \
+	X(g_prefilter_mode) X(g_prefilter1) X(g_prefilter2) \
+	X(g_LIMIT_DISTANCE) X(g_contactDistance)
+
+struct fold_state
+{
+#define FOLD_DECLARE(x) decltype(::x) x;
+	FOLD_GLOBALS(FOLD_DECLARE)
+#undef FOLD_DECLARE
+};
+
+/* held for every call that touches the engine's globals, the engine is not re-entrant */
+static std::mutex& engine_lock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+/* parameter set currently in the tables of data.h, see ensure_params */
+static std::string loaded_params;
+
+static void save_state(fold_state& s)
+{
+#define FOLD_SAVE(x) s.x = ::x;
+	FOLD_GLOBALS(FOLD_SAVE)
+#undef FOLD_SAVE
+}
+
+static void load_state(const fold_state& s)
+{
+#define FOLD_LOAD(x) ::x = s.x;
+	FOLD_GLOBALS(FOLD_LOAD)
+#undef FOLD_LOAD
+}
+
+static void ensure_params(const FoldOptions& opt)
+{
+	char key[64];
+	sprintf(key, "|%d|%d|%d", opt.unamode, opt.rnamode, opt.mismatch);
+	std::string wanted = opt.paramDir + key;
+	if (wanted == loaded_params) return;
+	readThermodynamicParameters(opt.paramDir.c_str(), !opt.paramDir.empty(), opt.unamode, opt.rnamode, opt.mismatch);
+	loaded_params = wanted;
+}
+
+FoldContext::FoldContext(const std::string& seq1, const FoldOptions& opt1)
+	: seq(seq1), opt(opt1), len(seq1.length()), mfeEnergy(INFINITY_), filled(false), state(new fold_state)
+{
+	// same precedence between the modes as gtmfe
+	if (opt.unamode || opt.rnamode) {
+		opt.mismatch = false;
+		opt.dangles = -1;
+		opt.prefilter = 0;
+		opt.paramDir.clear();
+	}
+	if (opt.dangles == 0 || opt.dangles == 2)
+		opt.mismatch = false;
+	else
+		opt.dangles = -1;
+
+	std::lock_guard<std::mutex> lk(engine_lock());
+	load();
+}
+
+/* called with the engine lock held, sets up the globals of seq and saves them */
+void FoldContext::load()
+{
+	len = seq.length();
+	init_global_params(len);
+	if (!encodeSequence(seq)) {
+		free_global_params();
+		exit(-1);
+	}
+	create_tables(len);
+	memset(structure, 0, (len+1)*sizeof(int));
+
+	enable_constraints(false);
+	BP = NULL; ind = NULL; PBP = NULL; FBP = NULL; nPBP = 0; nFBP = 0;
+	if (!opt.constraintsFile.empty())
+		init_constraints(opt.constraintsFile.c_str(), len);
+
+	SHAPEarray = NULL; SHAPEenergies = NULL;
+	SHAPE_ENABLED = !opt.shapeFile.empty();
+	if (SHAPE_ENABLED)
+		readSHAPEarray(opt.shapeFile.c_str(), len);
+
+	g_nthreads = opt.nthreads;
+	g_unamode = opt.unamode;
+	g_dangles = opt.dangles;
+	g_mismatch = opt.mismatch;
+	g_prefilter_mode = opt.prefilter > 0;
+	g_prefilter1 = g_prefilter2 = opt.prefilter;
+	g_LIMIT_DISTANCE = opt.contactDistance >= 0;
+	g_contactDistance = opt.contactDistance;
+
+	save_state(*state);
+}
+
+FoldContext::~FoldContext()
+{
+	std::lock_guard<std::mutex> lk(engine_lock());
+	bind();
+	unload();
+	delete state;
+}
+
+/* called with the engine lock held and the context bound */
+void FoldContext::unload()
+{
+	if (!opt.constraintsFile.empty())
+		free_constraints(len);
+	if (SHAPE_ENABLED)
+		free_shapeArray(len);
+	free_tables(len);
+	free_global_params();
+}
+
+void FoldContext::setSequence(const std::string& seq1)
+{
+	std::lock_guard<std::mutex> lk(engine_lock());
+	bind();
+	unload();
+	seq = seq1;
+	mfeEnergy = INFINITY_;
+	filled = false;
+	load();
+}
+
+void FoldContext::releaseTables()
+{
+	std::lock_guard<std::mutex> lk(engine_lock());
+	release_tables();
+}
+
+/* called with the engine lock held, the parameters are loaded by the calls that fold */
+void FoldContext::bind()
+{
+	load_state(*state);
+	enable_constraints(!opt.constraintsFile.empty());
+	enable_limit_distance(opt.contactDistance >= 0);
+	set_contact_distance(opt.contactDistance);
+}
+
+void FoldContext::unbind()
+{
+	save_state(*state);
+}
+
+int FoldContext::mfe()
+{
+	std::lock_guard<std::mutex> lk(engine_lock());
+	bind();
+	ensure_params(opt);
+	if (filled) init_tables(len);
+	mfeEnergy = calculate(len);
+	filled = true;
+	unbind();
+	return mfeEnergy;
+}
+
+void FoldContext::trace(bool energyDecompose, const std::string& decomposeFile)
+{
+	if (!filled) mfe();
+	std::lock_guard<std::mutex> lk(engine_lock());
+	bind();
+	ensure_params(opt);
+	::trace(len, energyDecompose, decomposeFile.c_str());
+	unbind();
+}
+
+int FoldContext::pair(int i) const
+{
+	return (i >= 1 && i <= len) ? state->structure[i] : 0;
+}
+
+std::string FoldContext::dotBracket() const
+{
+	std::string s(len, '.');
+	for (int i = 1; i <= len; ++i)
+		if (state->structure[i] > 0) s[i-1] = state->structure[i] > i ? '(' : ')';
+	return s;
+}
+
+void FoldContext::saveCT(const std::string& fileName) const
+{
+	save_ct_file(fileName, seq, mfeEnergy, state->structure);
+}
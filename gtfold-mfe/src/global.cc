@@ -5,6 +5,7 @@
 #include "utils.h"
 #include "global.h"
 #include "constraints.h"
+#include "fasta-reader.h"
 
 unsigned char *RNA; 
 int *structure; 
@@ -78,32 +79,22 @@ void print_structure(int len) {
 int read_sequence_file(const char* filename, std::string& seq) {
 	seq = "";
 
-	ifstream fs;
-	fs.open(filename, ios::in);
-	if (!fs.good()) return FAILURE;
+	fasta_reader input;
+	if (input.open(filename) == FAILURE) return FAILURE;
 
-	string line;
-	while(fs.good()) {
-		getline(fs, line);
-		// exclude lines starting with FASTA comment characters
-		if(line[0] != ';' && line[0] != '>' && line.length() > 0)
-			seq += line;
-	}
-
-	fs.close();
-
-    size_t loc;
-    while((loc = seq.find(" ")) != string::npos)
-        seq.erase(loc, 1);
+	// the bases of all records as one sequence
+	fasta_record record;
+	while (input.next(record))
+		seq += record.seq;
+	input.close();
 
 	return SUCCESS;
 }
 
-bool encodeSequence(string seq) {
+bool encodeSequence(const char* seq, int len) {
 	unsigned int unspecifiedBaseCount=0;
-	unsigned int unspecifiedBases[seq.length()];
 
-	for(unsigned int i=1; i<=seq.length(); i++) {
+	for(int i=1; i<=len; i++) {
 		RNA[i] = encode(seq[i-1]);
 
 		// die on non-IUPAC codes
@@ -113,19 +104,21 @@ bool encodeSequence(string seq) {
 			return false;
 		}
 
-		// add non-canonical IUPAC codes to the warning list
+		// count non-canonical IUPAC codes for the warning
 		if(!isWatsonCrickBase(seq[i-1]))
-			unspecifiedBases[unspecifiedBaseCount++]=i;
+			unspecifiedBaseCount++;
 	}
 
 	// just print a warning for non-canonical IUPAC codes
 	if(unspecifiedBaseCount > 0) {
 		printf("\nIncompletely-specified IUPAC codes have been detected at position%s: ", unspecifiedBaseCount == 1 ? "" : "s");
 
-		// put [0] first for nice comma separation
-		printf("%d (%c)", unspecifiedBases[0], seq.at(unspecifiedBases[0]-1));
-		for(unsigned int i=1; i<unspecifiedBaseCount; i++)
-			printf(", %d (%c)", unspecifiedBases[i], seq[unspecifiedBases[i]-1]);
+		const char* separator = "";
+		for(int i=1; i<=len; i++) {
+			if(isWatsonCrickBase(seq[i-1])) continue;
+			printf("%s%d (%c)", separator, i, seq[i-1]);
+			separator = ", ";
+		}
 
 		printf("\nPlease replace with fully-specified IUPAC codes (A,C,G,U,T) and retry.\n");
 		return false;
@@ -134,6 +127,10 @@ bool encodeSequence(string seq) {
 	return true;
 }
 
+bool encodeSequence(const string& seq) {
+	return encodeSequence(seq.c_str(), seq.length());
+}
+
 
 void print_header() {
 	printf("GTfold: A Scalable Multicore Code for RNA Secondary Structure Prediction\n");
@@ -217,6 +214,7 @@ void help() {
 //    printf("   -n, --noisolate      Prevent isolated base pairs from forming.\n");
     printf("   -o, --output NAME    Write output files with prefix given in NAME\n");
     printf("   -p  --paramdir DIR   Path to directory from which parameters are to be read\n");
+    printf("                        or a parameter snapshot file written by gtfold-compile-params\n");
     printf("   -t, --threads INT    Limit number of threads used to INT.\n");
     printf("   -v, --verbose        Run in verbose mode (includes loop-by-loop energy decomposition\n");
     printf("                        and confirmation of constraints satisfied).\n");
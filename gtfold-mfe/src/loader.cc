@@ -36,6 +36,7 @@
 #include "constants.h"
 #include "global.h"
 #include "loader.h"
+#include "param-snapshot.h"
 
 #define xstr(s) str(s)
 #define str(s) #s
@@ -88,6 +89,24 @@ float prelog;
 void readThermodynamicParameters(const char *userdatadir,bool userdatalogic, int unamode = 0, int rnamode = 0, int mismatch = 0) {
 	struct stat buf;
 
+	// a snapshot written by gtfold-compile-params is mapped instead of parsing a directory
+	if (userdatalogic && is_param_snapshot(userdatadir)) {
+		load_param_snapshot(userdatadir, unamode, mismatch);
+		EN_DATADIR.assign(userdatadir);
+		return;
+	}
+
+	// the default sets are compiled in, GTFOLDDATADIR still selects files on disk
+	if (!userdatalogic && !unamode && getenv("GTFOLDDATADIR") == 0) {
+		const char* name = rnamode ? "RNAParams" : "Turner99";
+		if (load_builtin_params(name, unamode, mismatch)) {
+			EN_DATADIR.assign("built-in ");
+			EN_DATADIR += name;
+			fprintf(stdout,"Using built-in %s parameters.\n", name);
+			return;
+		}
+	}
+
 	if (!userdatalogic) {
 		std::string opt1, opt2, opt3;
 		char cwd[1024];
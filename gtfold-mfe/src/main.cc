@@ -33,6 +33,7 @@
 #include "mfe_main.h"
 #include "boltzmann_main.h"
 #include "subopt_main.h"
+#include "daemon.h"
 #include "utils.h"
 #include "global.h"
 
@@ -48,6 +49,10 @@ int main(int argc, char** argv) {
     subopt_main(argc,argv);
   } else if (cmd.find("gtboltzmann") != std::string::npos) {
     boltzmann_main(argc,argv);
+  } else if (cmd.find("gtfoldd") != std::string::npos) {
+    gtfoldd_main(argc,argv);
+  } else if (cmd.find("gtfold-client") != std::string::npos) {
+    gtfold_client_main(argc,argv);
   } else{
 	print_gtfold_usage_help();
   }
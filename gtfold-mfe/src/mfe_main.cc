@@ -24,10 +24,12 @@
 #include <string>
 #include <math.h>
 #include <sstream>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <cassert>
+#include <vector>
 
 #include "main.h"
 #include "mfe_main.h"
@@ -37,9 +39,14 @@
 #include "global.h"
 #include "energy.h"
 #include "algorithms.h"
+#include "algorithms-sets.h"
+#include "param-set.h"
 #include "constraints.h"
 #include "traceback.h"
 #include "shapereader.h"
+#include "batch.h"
+#include "result-cache.h"
+#include "daemon.h"
 
 using namespace std;
 
@@ -65,6 +72,22 @@ static string energyDecomposeOutFile = "";
 static string outputDir = "";
 static string shapeFile = "";
 static string paramDir; // default value
+static string compareList; // --compare, comma separated
+static string modeList;    // --dangle-modes, comma separated
+static string profileList; // --shape-profiles, comma separated
+
+/* a table set of the sweep, for --compare, --dangle-modes and --shape-profiles */
+struct fold_variant
+{
+	int set;        /* in paramSets */
+	int mode;       /* SWEEP_DANGLE_0 .. SWEEP_MISMATCH */
+	int profile;    /* in profileFiles, -1 for none */
+	string label;   /* in the output file names */
+};
+
+static vector<param_set*> paramSets;
+static vector<string> profileFiles;
+static vector<fold_variant> variants;
 
 static int dangles=-1;
 static int prefilter1=2;
@@ -77,6 +100,12 @@ static int contactDistance = -1;
 static void help();
 static void detailed_help();
 static void printRunConfiguration(string seq);
+static void set_output_files();
+static void resolve_modes();
+static void fold_file();
+static void fold_sequence(const std::string& seq);
+static void compare_sequence(const std::string& seq);
+static void print_results(const std::string& seq, int energy);
 void parse_mfe_options(int argc, char** argv);
 
 void init_fold(const char* seq) {
@@ -85,7 +114,7 @@ void init_fold(const char* seq) {
 
   init_global_params(len);
 
-  if (!encodeSequence(seq)) {
+  if (!encodeSequence(seq, len)) {
     free_fold(len);
     exit(0);
   }
@@ -100,6 +129,30 @@ void init_fold(const char* seq) {
     readSHAPEarray(shapeFile.c_str(),len);
   }
 
+  resolve_modes();
+
+  g_nthreads = nThreads;
+  g_unamode  = UNAMODE;
+  g_mismatch = T_MISMATCH;
+  g_verbose  = VERBOSE;
+  g_prefilter_mode  = b_prefilter;
+  g_prefilter1  = prefilter1;
+  g_prefilter2  = prefilter2;
+  g_dangles = dangles;
+
+#ifdef DEBUG
+  if(!SILENT) printf("g_nthreads = %d\n", g_nthreads);
+  if(!SILENT) printf("g_unamode = %d\n", g_unamode);
+  if(!SILENT) printf("g_mismatch = %d\n", g_mismatch);
+  if(!SILENT) printf("g_prefilter_mode = %d\n", g_prefilter_mode);
+  if(!SILENT) printf("g_dangles = %d\n", g_dangles);
+
+#endif
+
+}
+
+/* the precedence between the modes, safe to call again */
+static void resolve_modes() {
   if (UNAMODE) {
     if (T_MISMATCH) if(!SILENT) printf("Ignoring -m option, using --unafold\n");
     if (PARAM_DIR) if(!SILENT) printf("Ignoring -p option, using --unafold\n");
@@ -126,6 +179,29 @@ void init_fold(const char* seq) {
     b_prefilter = false;
   }
 
+  if (!modeList.empty() && (UNAMODE || RNAMODE)) {
+    if(!SILENT) printf("Ignoring --dangle-modes option, using --%s\n", UNAMODE ? "unafold" : "rnafold");
+    modeList = "";
+  }
+  if (!modeList.empty()) {
+    if (dangles == 0 || dangles == 1 || dangles == 2)
+      if(!SILENT) printf("Ignoring -d option, using --dangle-modes\n");
+    if (T_MISMATCH) if(!SILENT) printf("Ignoring -m option, using --dangle-modes\n");
+    dangles = -1;
+    T_MISMATCH = false;
+  }
+
+  if (!compareList.empty() && PARAM_DIR) {
+    if(!SILENT) printf("Ignoring -p option, using --compare\n");
+    PARAM_DIR = false;
+  }
+
+  if (!profileList.empty() && SHAPE_ENABLED) {
+    if(!SILENT) printf("Ignoring --useSHAPE option, using --shape-profiles\n");
+    shapeFile = "";
+    SHAPE_ENABLED = 0;
+  }
+
   if ((dangles == 0 || dangles == 1 ||dangles == 2) && !UNAMODE && !RNAMODE) {
     if (T_MISMATCH) if(!SILENT) printf("Ignoring -m option, using -d option\n");
     T_MISMATCH = false;
@@ -134,25 +210,6 @@ void init_fold(const char* seq) {
     dangles = -1;
   }
   if(dangles==1) dangles=-1;
-
-  g_nthreads = nThreads;
-  g_unamode  = UNAMODE;
-  g_mismatch = T_MISMATCH;
-  g_verbose  = VERBOSE;
-  g_prefilter_mode  = b_prefilter;
-  g_prefilter1  = prefilter1;
-  g_prefilter2  = prefilter2;
-  g_dangles = dangles;
-
-#ifdef DEBUG
-  if(!SILENT) printf("g_nthreads = %d\n", g_nthreads);
-  if(!SILENT) printf("g_unamode = %d\n", g_unamode);
-  if(!SILENT) printf("g_mismatch = %d\n", g_mismatch);
-  if(!SILENT) printf("g_prefilter_mode = %d\n", g_prefilter_mode);
-  if(!SILENT) printf("g_dangles = %d\n", g_dangles);
-
-#endif
-
 }
 
 void free_fold(int len) {
@@ -168,22 +225,263 @@ void free_fold(int len) {
 
 
 int mfe_main(int argc, char** argv) {
-	std::string seq;
-	int energy;
-	
 	parse_mfe_options(argc, argv);
 	
 	//if(!SILENT) print_header();
 
-	if (read_sequence_file(seqfile.c_str(), seq) == FAILURE) {
+	fold_file();
+
+	// a worker of gtfoldd goes on with the next files folded with these options
+	while (daemon_next(argc, argv)) {
+		outputPrefix = "";
+		parse_mfe_options(argc, argv);
+		fold_file();
+	}
+	
+  return EXIT_SUCCESS;
+}
+
+static const char* mode_label(int mode) {
+	switch (mode) {
+		case SWEEP_DANGLE_0: return "d0";
+		case SWEEP_DANGLE_2: return "d2";
+		case SWEEP_MISMATCH: return "m";
+		default: return "d1";
+	}
+}
+
+/* the last component of path without its extension, made unique among labels */
+static string unique_label(const string& path, const vector<string>& labels) {
+	string label = path;
+	while (label.length() > 1 && label[label.length()-1] == '/')
+		label.erase(label.length()-1);
+	size_t pos = label.find_last_of("/ ");
+	if (pos != string::npos) label = label.substr(pos+1);
+	if ((pos = label.rfind('.')) != string::npos && pos > 0) label.erase(pos);
+	for (size_t k = 0; k < labels.size(); k++) {
+		if (labels[k] == label) {
+			stringstream ss;
+			ss << label << "-" << labels.size()+1;
+			return ss.str();
+		}
+	}
+	return label;
+}
+
+/* reads the sets of --compare (or the one of -p) and makes a table set for every set, every
+   treatment of --dangle-modes and every SHAPE file of --shape-profiles, labelled by the last
+   components of the paths of the set and the file and the treatment */
+static void load_param_sets() {
+	vector<int> modes;
+	vector<string> setLabels, profileLabels;
+	string item;
+	bool mismatch = T_MISMATCH;
+
+	stringstream mlist(modeList);
+	while (getline(mlist, item, ',')) {
+		if (item == "0") modes.push_back(SWEEP_DANGLE_0);
+		else if (item == "1") modes.push_back(SWEEP_DANGLE_DEFAULT);
+		else if (item == "2") modes.push_back(SWEEP_DANGLE_2);
+		else if (item == "m") modes.push_back(SWEEP_MISMATCH);
+		else {
+			printf("INVALID ARGUMENTS: --dangle-modes accepts a list of 0, 1, 2 and m\n");
+			exit(-1);
+		}
+		// the output files are named after the treatment
+		if (find(modes.begin(), modes.end() - 1, modes.back()) != modes.end() - 1) {
+			printf("INVALID ARGUMENTS: --dangle-modes lists %s more than once\n", item.c_str());
+			exit(-1);
+		}
+		if (item == "m") mismatch = true;
+	}
+
+	for (size_t k = 0; k < paramSets.size(); k++)
+		free_param_set(paramSets[k]);
+	paramSets.clear();
+	variants.clear();
+
+	stringstream list(!compareList.empty() ? compareList : PARAM_DIR ? paramDir : "default");
+	while (getline(list, item, ',')) {
+		if (item.empty()) continue;
+		if (paramSets.size() == PARAM_SETS_MAX) {
+			printf("INVALID ARGUMENTS: --compare accepts at most %d parameter sets\n", PARAM_SETS_MAX);
+			exit(-1);
+		}
+		param_set* set = load_param_set(item, UNAMODE, RNAMODE, mismatch);
+		setLabels.push_back(unique_label(set->name, setLabels));
+		paramSets.push_back(set);
+	}
+	if (paramSets.empty()) {
+		printf("INVALID ARGUMENTS: --compare needs a list of parameter sets\n");
+		exit(-1);
+	}
+
+	// the files are read for every sequence, as readSHAPEarray needs its length
+	profileFiles.clear();
+	stringstream plist(profileList);
+	while (getline(plist, item, ',')) {
+		if (item.empty()) continue;
+		ifstream file(item.c_str());
+		if (!file) {
+			printf("Failed to open SHAPE data file: %s\n", item.c_str());
+			exit(-1);
+		}
+		profileLabels.push_back(unique_label(item, profileLabels));
+		profileFiles.push_back(item);
+	}
+	if (!profileList.empty() && profileFiles.empty()) {
+		printf("INVALID ARGUMENTS: --shape-profiles needs a list of SHAPE data files\n");
+		exit(-1);
+	}
+
+	// the treatment of the options without --dangle-modes
+	if (modes.empty()) {
+		if (UNAMODE || T_MISMATCH) modes.push_back(SWEEP_MISMATCH);
+		else if (dangles == 2) modes.push_back(SWEEP_DANGLE_2);
+		else if (dangles == 0) modes.push_back(SWEEP_DANGLE_0);
+		else modes.push_back(SWEEP_DANGLE_DEFAULT);
+	}
+
+	// the label names what differs between the table sets
+	bool setLabel = !compareList.empty() || (modeList.empty() && profileList.empty());
+	int nprofiles = profileFiles.empty() ? 1 : profileFiles.size();
+	for (size_t k = 0; k < paramSets.size(); k++) {
+		for (size_t m = 0; m < modes.size(); m++) {
+			for (int s = 0; s < nprofiles; s++) {
+				fold_variant v;
+				v.set = k;
+				v.mode = modes[m];
+				v.profile = profileFiles.empty() ? -1 : s;
+				if (setLabel)
+					v.label = setLabels[k];
+				if (!modeList.empty())
+					v.label += (v.label.empty() ? "" : "_") + string(mode_label(modes[m]));
+				if (v.profile >= 0)
+					v.label += (v.label.empty() ? "" : "_") + profileLabels[s];
+				variants.push_back(v);
+			}
+		}
+	}
+}
+
+/* reads the parameters for the options, unless they have been read already */
+static void load_parameters() {
+	static string loaded;
+	stringstream ss;
+	ss << paramDir << '\0' << compareList << '\0' << modeList << '\0' << profileList << '\0' << PARAM_DIR << UNAMODE << RNAMODE << T_MISMATCH;
+	if (ss.str() == loaded) return;
+	if (!compareList.empty() || !modeList.empty() || !profileList.empty())
+		load_param_sets();
+	else
+		readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, UNAMODE, RNAMODE, T_MISMATCH);
+	cache_params_changed();
+	loaded = ss.str();
+}
+
+/* folds every record of seqfile */
+static void fold_file() {
+	std::string seq;
+	fasta_reader input;
+	fasta_record record;
+	if (input.open(seqfile.c_str()) == FAILURE) {
 		printf("Failed to open sequence file: %s.\n\n", seqfile.c_str());
 		exit(-1);
 	}
+	input.next(record);
 
-	init_fold(seq.c_str());
-	
 	// Read in thermodynamic parameters. Always use Turner99 data (for now)
-  readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, UNAMODE, RNAMODE, T_MISMATCH);
+	// The workers of a batch inherit them and fold record after record.
+	resolve_modes();
+	load_parameters();
+
+	if (!input.at_end()) {
+		string prefix = outputPrefix;
+		int threads = nThreads;
+		// V, VM, VBI (half) and WM, WMPrime, PP (full) ints per cell, and the first five again
+		// for every table set of a pass of the sweep
+		double cellBytes = 18 + 14*MIN(variants.size(), (size_t)SWEEP_TABLES_MAX);
+		while (batch_next(input, nThreads, cellBytes, record, threads)) {
+			outputPrefix = batch_output_prefix(prefix, record);
+			set_output_files();
+			nThreads = threads;
+			fold_sequence(record.seq);
+		}
+		if (batch_failed() > 0) exit(-1);
+		return;
+	}
+	seq.swap(record.seq);
+	input.close();
+	fold_sequence(seq);
+}
+
+/* the key of the MFE structure of seq in the result cache */
+static std::string mfe_cache_key(const std::string& seq) {
+	std::string key = cache_key("mfe", seq);
+	cache_key_add(key, "dangles", dangles);
+	cache_key_add(key, "unafold", UNAMODE);
+	cache_key_add(key, "rnafold", RNAMODE);
+	cache_key_add(key, "mismatch", T_MISMATCH);
+	cache_key_add(key, "prefilter", b_prefilter ? prefilter1 : 0);
+	cache_key_add(key, "limitCD", contactDistance);
+	if (CONS_ENABLED) cache_key_add_file(key, "constraints", constraintsFile);
+	if (SHAPE_ENABLED) cache_key_add_file(key, "shape", shapeFile);
+	return key;
+}
+
+/* reports the MFE structure of seq from the result cache, false if it is not there */
+static bool cached_fold(const std::string& seq, const std::string& key) {
+	std::string data;
+	int len = seq.length();
+	// the energy decomposition is written by the traceback
+	if (print_energy_decompose || !cache_get(key, data) || data.size() != (len+1)*sizeof(int))
+		return false;
+
+	int energy;
+	init_global_params(len);
+	encodeSequence(seq.c_str(), len);
+	memcpy(&energy, data.data(), sizeof(int));
+	memcpy(structure + 1, data.data() + sizeof(int), len*sizeof(int));
+	if (CONS_ENABLED)
+		init_constraints(constraintsFile.c_str(), len);
+	if (SHAPE_ENABLED)
+		readSHAPEarray(shapeFile.c_str(), len);
+
+	printRunConfiguration(seq);
+
+	if(!SILENT) printf("\nMinimum free energy structure found in the cache.\n\n");
+	if(!SILENT) printf("Results:\n");
+	if (energy >= MAXENG)	
+		printf("- Minimum Free Energy: %12.4f kcal/mol\n", 0.00);
+	else
+		printf("- Minimum Free Energy: %12.4f kcal/mol\n", energy/100.00);
+
+	print_results(seq, energy);
+
+	// no tables were taken
+	if (CONS_ENABLED)
+		free_constraints(len);
+	if (SHAPE_ENABLED)
+		free_shapeArray(len);
+	free_global_params();
+	return true;
+}
+
+/* folds seq with the parameters read */
+static void fold_sequence(const std::string& seq) {
+	int energy;
+	std::string key;
+
+	if (!variants.empty()) {
+		compare_sequence(seq);
+		return;
+	}
+
+	if (cache_enabled()) {
+		key = mfe_cache_key(seq);
+		if (cached_fold(seq, key)) return;
+	}
+
+	init_fold(seq.c_str());
 	printRunConfiguration(seq);
 
 	if(!SILENT) printf("\nComputing minimum free energy structure...\n");
@@ -204,7 +502,125 @@ int mfe_main(int argc, char** argv) {
 	t1 = get_seconds();
 	trace(seq.length(), print_energy_decompose, energyDecomposeOutFile.c_str());
 	t1 = get_seconds() - t1;
-	
+
+	if (!key.empty()) {
+		std::string data((char*)&energy, sizeof(int));
+		data.append((char*)(structure + 1), seq.length()*sizeof(int));
+		cache_put(key, data);
+	}
+
+	print_results(seq, energy);
+	free_fold(seq.length());
+}
+
+/* folds seq with every parameter set of --compare, dangle treatment of --dangle-modes and SHAPE
+   profile of --shape-profiles in one sweep, or in passes of SWEEP_TABLES_MAX table sets, and
+   traces and saves the MFE structure of each to OUTPUT_LABEL.ct */
+static void compare_sequence(const std::string& seq) {
+	static const char* modeNames[] = {"-d 0", "default dangles", "-d 2", "terminal mismatch"};
+	int len = seq.length();
+	int ntables = variants.size();
+	std::vector<const param_set*> sets(ntables);
+	std::vector<int> modes(ntables), energies(ntables);
+	std::vector<const int*> shapes(ntables);
+	std::vector<double*> profileValues;
+	std::vector<int*> profileEnergies;
+	std::vector<int> first;
+
+	init_fold(seq.c_str());
+	printRunConfiguration(seq);
+
+	// the SHAPE energies of every profile, bound to SHAPEarray and SHAPEenergies for the traceback
+	for (size_t s = 0; s < profileFiles.size(); s++) {
+		readSHAPEarray(profileFiles[s].c_str(), len);
+		profileValues.push_back(SHAPEarray);
+		profileEnergies.push_back(SHAPEenergies);
+	}
+	for (int k = 0; k < ntables; k++) {
+		sets[k] = paramSets[variants[k].set];
+		modes[k] = variants[k].mode;
+		if (variants[k].profile >= 0)
+			shapes[k] = profileEnergies[variants[k].profile];
+		else
+			shapes[k] = SHAPE_ENABLED ? SHAPEenergies : NULL;
+	}
+
+	if(!SILENT) printf("\nComputing minimum free energy structures for %d combinations of parameters, dangles and SHAPE data...\n", ntables);
+	fflush(stdout);
+
+	std::string prefix = outputPrefix;
+	bool shapeEnabled = SHAPE_ENABLED;
+	for (int pass = 0; pass < ntables; pass += SWEEP_TABLES_MAX) {
+		int n = MIN(ntables - pass, SWEEP_TABLES_MAX);
+
+		double t1 = get_seconds();
+		calculate_sets(len, n, &sets[pass], &modes[pass], &shapes[pass], &energies[pass]);
+		t1 = get_seconds() - t1;
+
+		if (pass == 0) {
+			if(!SILENT) printf("Done.\n\n");
+			if(!SILENT) printf("Results:\n");
+		} else {
+			printf("\n");
+		}
+		for (int k = pass; k < pass + n; k++) {
+			if (energies[k] >= MAXENG)
+				printf("- Minimum Free Energy (%s): %12.4f kcal/mol\n", variants[k].label.c_str(), 0.00);
+			else
+				printf("- Minimum Free Energy (%s): %12.4f kcal/mol\n", variants[k].label.c_str(), energies[k]/100.00);
+		}
+		printf("- MFE runtime: %9.6f seconds\n", t1);
+
+		// the traceback and the energy decomposition read the tables, parameters, dangle
+		// treatment and SHAPE energies from the globals
+		for (int k = pass; k < pass + n; k++) {
+			outputPrefix = prefix + "_" + variants[k].label;
+			set_output_files();
+			load_set_tables(len, k - pass);
+			bind_param_set(sets[k]);
+			g_mismatch = modes[k] == SWEEP_MISMATCH && !UNAMODE;
+			g_dangles = modes[k] == SWEEP_DANGLE_0 ? 0 : modes[k] == SWEEP_DANGLE_2 ? 2 : -1;
+			if (variants[k].profile >= 0) {
+				SHAPEarray = profileValues[variants[k].profile];
+				SHAPEenergies = profileEnergies[variants[k].profile];
+				SHAPE_ENABLED = 1;
+			}
+			trace(len, print_energy_decompose, energyDecomposeOutFile.c_str());
+
+			printf("\n%s: %s, %s", variants[k].label.c_str(), sets[k]->name, UNAMODE ? "unafold" : modeNames[modes[k]]);
+			if (variants[k].profile >= 0)
+				printf(", SHAPE data %s", profileFiles[variants[k].profile].c_str());
+			printf("\n");
+			if (k == 0) {
+				first.assign(structure, structure + len + 1);
+			} else {
+				int distance = 0;
+				for (int i = 1; i <= len; i++) {
+					if (first[i] > i && structure[i] != first[i]) distance++;
+					if (structure[i] > i && first[i] != structure[i]) distance++;
+				}
+				printf("- base pair distance to %s: %d\n", variants[0].label.c_str(), distance);
+			}
+			print_results(seq, energies[k]);
+		}
+	}
+	outputPrefix = prefix;
+	set_output_files();
+	g_mismatch = T_MISMATCH;
+	g_dangles = dangles;
+
+	for (size_t s = 0; s < profileFiles.size(); s++) {
+		SHAPEarray = profileValues[s];
+		SHAPEenergies = profileEnergies[s];
+		free_shapeArray(len);
+	}
+	SHAPE_ENABLED = shapeEnabled;
+
+	free_fold(len);
+}
+
+/* prints and saves the MFE structure in structure */
+static void print_results(const std::string& seq, int energy) {
 	printf("\n");
 	print_sequence(seq.length());
 	print_structure(seq.length());
@@ -230,15 +646,17 @@ int mfe_main(int argc, char** argv) {
 			fprintf(stderr, "Constraint file: %s\n", constraintsFile.c_str());
 		}
 	}
-
-	free_fold(seq.length());
-	
-  return EXIT_SUCCESS;
 }
 
 //double calculate_mfe(int argc, char** argv) {
 double calculate_mfe(std::string seq) {
 	int energy;
+	std::string data;
+	// the energy of a structure folded by gtmfe with the same options
+	if (cache_enabled() && cache_get(mfe_cache_key(seq), data) && data.size() == (seq.length()+1)*sizeof(int)) {
+		memcpy(&energy, data.data(), sizeof(int));
+		return energy/100.0;
+	}
 	fflush(stdout);
 	double t1 = get_seconds();
 	energy = calculate(seq.length()) ; 
@@ -341,6 +759,46 @@ void parse_mfe_options(int argc, char** argv) {
       } else if (strcmp(argv[i], "--energydetail") == 0 || strcmp(argv[i], "-e") == 0) {
 	print_energy_decompose = 1;
       }
+      else if (strcmp(argv[i], "--batchmem") == 0) {
+        if(i+1 < argc)
+          set_batch_memory(argv[++i]);
+        else
+          help();
+      }
+      else if (strcmp(argv[i], "--dangle-modes") == 0) {
+        if(i+1 < argc)
+          modeList = argv[++i];
+        else
+          help();
+        if (modeList.empty()) {
+          printf("INVALID ARGUMENTS: --dangle-modes needs a list of 0, 1, 2 and m\n");
+          exit(-1);
+        }
+      }
+      else if (strcmp(argv[i], "--compare") == 0) {
+        if(i+1 < argc)
+          compareList = argv[++i];
+        else
+          help();
+      }
+      else if (strcmp(argv[i], "--shape-profiles") == 0) {
+        if(i+1 < argc)
+          profileList = argv[++i];
+        else
+          help();
+      }
+      else if (strcmp(argv[i], "--cache-dir") == 0) {
+        if(i+1 < argc)
+          set_cache_dir(argv[++i]);
+        else
+          help();
+      }
+      else if (strcmp(argv[i], "--cache-size") == 0) {
+        if(i+1 < argc)
+          set_cache_size(argv[++i]);
+        else
+          help();
+      }
       else if (strcmp(argv[i], "--useSHAPE") == 0){
         if( i < argc){
           shapeFile = argv[++i];
@@ -377,6 +835,13 @@ void parse_mfe_options(int argc, char** argv) {
       outputPrefix.erase(outputPrefix.rfind("."));
   }
 
+  set_output_files();
+}
+
+static void set_output_files() {
+  outputFile = "";
+  energyDecomposeOutFile = "";
+
   // If output dir specified
   if (!outputDir.empty()) {
     outputFile += outputDir;
@@ -411,6 +876,10 @@ static void printRunConfiguration(string seq) {
 		if(!SILENT) printf("+ running in dangle %d mode\n", dangles);
 		standardRun = false;
 	} 
+	if (!modeList.empty()) {
+		if(!SILENT) printf("+ running in dangle modes %s\n", modeList.c_str());
+		standardRun = false;
+	}
 	if (T_MISMATCH == true) {
 		if(!SILENT) printf("+ enabled terminal mismatch calculations\n");
 		standardRun = false;
@@ -428,6 +897,9 @@ static void printRunConfiguration(string seq) {
 	if(!shapeFile.empty()){
 		if(!SILENT) printf("- using SHAPE data file: %s\n", shapeFile.c_str());
 	}
+	for (size_t k = 0; k < profileFiles.size(); k++) {
+		if(!SILENT) printf("- using SHAPE data file: %s\n", profileFiles[k].c_str());
+	}
 	if (contactDistance != -1) {
 		if(!SILENT) printf("- maximum contact distance: %d\n", contactDistance);
 		standardRun = false;
@@ -436,7 +908,12 @@ static void printRunConfiguration(string seq) {
 	if(standardRun)
 		if(!SILENT) printf("- standard\n");
 
-	if(!SILENT) printf("- thermodynamic parameters: %s\n", EN_DATADIR.c_str());
+	if (!compareList.empty()) {
+		for (size_t k = 0; k < paramSets.size(); k++)
+			if(!SILENT) printf("- thermodynamic parameters: %s\n", paramSets[k]->name);
+	} else {
+		if(!SILENT) printf("- thermodynamic parameters: %s\n", EN_DATADIR.c_str());
+	}
 	if(!SILENT) printf("- input file: %s\n", seqfile.c_str());
 	if(!SILENT) printf("- sequence length: %d\n", (int)seq.length());
 	if(!SILENT) printf("- output file: %s\n", outputFile.c_str());
@@ -455,19 +932,32 @@ static void print_usage_developer_options() {
     printf("\t\t(1)      The directory pointed to by environment variable GTFOLDDATADIR \n");
     printf("\t\t(2)      The install directory (eg. /usr/local/share/gtfold), if (1) fails. \n");
     printf("\t\t(3)      The subdirectory 'data' of the current directory, if (1) and (2) fail. \n");
+    printf("\tUnless GTFOLDDATADIR is set, the default Turner99 and RNAParams sets are read from a copy compiled into GTfold. \n");
     printf("\n");
 }
 
 static void print_usage() {
     printf("Usage: gtmfe [OPTION]... FILE\n\n");
 
-    printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n\n");
+    printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n");
+    printf("   Every record of a multi-record FASTA file is folded, with output files named OUTPUT_ID.\n\n");
 
     printf("OPTIONS\n");
+    printf("   --batchmem MB        Memory for the tables of the records folded at once from a\n");
+    printf("                        multi-record FASTA file, half of the physical memory by default.\n");
+    printf("   --cache-dir DIR      Keep the MFE structures in DIR and reuse them for the same sequence,\n");
+    printf("                        parameters and options instead of folding again.\n");
+    printf("   --cache-size MB      Size of the cache in DIR, least recently used results are removed\n");
+    printf("                        beyond it, 1024 by default.\n");
+    printf("   --compare SET,...    Fold with each of the parameter sets SET (a directory or snapshot as for\n");
+    printf("                        -p, or default) in one pass, saving the structures to OUTPUT_SET.ct.\n");
     printf("   -c, --constraints FILE\n");
     printf("                        Load constraints from FILE.  See Constraint syntax below.\n");
     printf("   -d, --dangle INT     Restricts treatment of dangling energies (INT=0,1,2), (with -d option, call to -m option will be ignored)\n"); 
     printf("                        see below for details.\n");
+    printf("   --dangle-modes LIST  Fold with each treatment of dangling energies in LIST (0, 1, 2 as for -d,\n");
+    printf("                        m as for -m, each at most once) in one pass, saving the structures to\n");
+    printf("                        OUTPUT_MODE.ct.\n");
     printf("   -h, --help           Output help (this message) and exit.\n");
     printf("   --detailedhelp      Output help (this message) with detailed options and examples, and exit.\n");
     printf("   -l, --limitCD INT    Set a maximum base pair contact distance to INT. If no\n");
@@ -476,7 +966,9 @@ static void print_usage() {
 //    printf("   -n, --noisolate      Prevent isolated base pairs from forming.\n");
     printf("   -o, --output NAME    Write output files with prefix given in NAME\n");
     printf("   -p  --paramdir DIR   Path to directory from which parameters are to be read\n");
-    printf("   -t, --threads INT    Limit number of threads used to INT.\n");
+    printf("                        or a parameter snapshot file written by gtfold-compile-params\n");
+    printf("   -t, --threads INT    Limit number of threads used to INT. For a multi-record FASTA file\n");
+    printf("                        INT threads are shared between the records folded at once.\n");
     printf("   -v, --verbose        Run in verbose mode (includes confirmation of constraints satisfied).\n");
     //printf("   --silent		    Run in silent mode.\n");
     printf("   -w, --workdir DIR    Path of directory where output files will be written.\n");
@@ -488,6 +980,9 @@ static void print_usage() {
     printf("                        implementation.\n");
 
     printf("   --useSHAPE FILE  Use SHAPE constraints from FILE.\n");      
+    printf("   --shape-profiles FILE,...\n");
+    printf("                        Fold with the SHAPE data of each FILE in one pass, saving the\n");
+    printf("                        structures to OUTPUT_FILE.ct.\n");
     printf("   -e, --energydetail         prints energy decomposition for MFE structure to file output-prefix.energy.\n");
     printf("\nConstraint syntax:\n");
     printf("\tP i j k  # prohibit (i,j)(i+1,j-1),.......,(i+k-1,j-k+1) pairs.\n");
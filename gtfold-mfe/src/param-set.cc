@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "data.h"
+#include "loader.h"
+#include "param-set.h"
+
+using namespace std;
+
+struct param_field
+{
+	size_t offset;
+	void* global;
+	size_t size;
+};
+
+#define FIELD(x) {offsetof(param_set, x), (void*)&(x), sizeof(x)}
+
+/* every table set by the loader */
+static const param_field fields[] = {
+	FIELD(poppen),
+	FIELD(maxpen),
+	FIELD(eparam),
+	FIELD(multConst),
+	FIELD(dangle),
+	FIELD(inter),
+	FIELD(bulge),
+	FIELD(hairpin),
+	FIELD(stack),
+	FIELD(tstkh),
+	FIELD(tstki),
+	FIELD(tloop),
+	FIELD(numoftloops),
+	FIELD(iloop22),
+	FIELD(iloop21),
+	FIELD(iloop11),
+	FIELD(auend),
+	FIELD(gubonus),
+	FIELD(cint),
+	FIELD(cslope),
+	FIELD(c3),
+	FIELD(efn2a),
+	FIELD(efn2b),
+	FIELD(efn2c),
+	FIELD(triloop),
+	FIELD(numoftriloops),
+	FIELD(init),
+	FIELD(gail),
+	FIELD(prelog),
+	FIELD(tstackm),
+	FIELD(tstacke),
+	FIELD(tstacki23),
+};
+
+static const unsigned int NUM_FIELDS = sizeof(fields)/sizeof(fields[0]);
+
+param_set* load_param_set(const string& source, int unamode, int rnamode, int mismatch) {
+	if (source == "default")
+		readThermodynamicParameters("", false, unamode, rnamode, mismatch);
+	else
+		readThermodynamicParameters(source.c_str(), true, unamode, rnamode, mismatch);
+	return capture_param_set(EN_DATADIR);
+}
+
+param_set* capture_param_set(const string& name) {
+	param_set* set = (param_set*)malloc(sizeof(param_set));
+	if (set == NULL) {
+		perror("Cannot allocate a parameter set");
+		exit(-1);
+	}
+	memset(set, 0, sizeof(param_set));
+	strncpy(set->name, name.c_str(), sizeof(set->name) - 1);
+	for (unsigned int k = 0; k < NUM_FIELDS; k++)
+		memcpy((char*)set + fields[k].offset, fields[k].global, fields[k].size);
+	return set;
+}
+
+void bind_param_set(const param_set* set) {
+	for (unsigned int k = 0; k < NUM_FIELDS; k++)
+		memcpy(fields[k].global, (const char*)set + fields[k].offset, fields[k].size);
+	EN_DATADIR.assign(set->name);
+}
+
+void free_param_set(param_set* set) {
+	free(set);
+}
@@ -0,0 +1,347 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "data.h"
+#include "param-snapshot.h"
+
+using namespace std;
+
+static const char SNAPSHOT_MAGIC[4] = {'G','T','P','S'};
+static const size_t HEADER_SIZE = 4 + 4 + 4 + 4 + 4 + 8;
+
+struct param_table
+{
+	const char* name;
+	void* ptr;
+	unsigned int count;
+	int flag; /* only loaded if the mode needs it */
+};
+
+#define TABLE(x, flag) {#x, (void*)&(x), sizeof(x)/sizeof(int), flag}
+
+/* every table set by the loader, append only: changing it needs a new PARAM_SNAPSHOT_VERSION */
+static const param_table tables[] = {
+	TABLE(poppen, 0),
+	TABLE(maxpen, 0),
+	TABLE(eparam, 0),
+	TABLE(multConst, 0),
+	TABLE(dangle, 0),
+	TABLE(inter, 0),
+	TABLE(bulge, 0),
+	TABLE(hairpin, 0),
+	TABLE(stack, 0),
+	TABLE(tstkh, 0),
+	TABLE(tstki, 0),
+	TABLE(tloop, 0),
+	TABLE(numoftloops, 0),
+	TABLE(iloop21, 0),
+	TABLE(iloop22, 0),
+	TABLE(iloop11, 0),
+	TABLE(tstackm, PARAM_SNAPSHOT_MISMATCH),
+	TABLE(tstacke, PARAM_SNAPSHOT_MISMATCH),
+	TABLE(tstacki23, PARAM_SNAPSHOT_UNAMODE),
+	TABLE(auend, 0),
+	TABLE(gubonus, 0),
+	TABLE(cint, 0),
+	TABLE(cslope, 0),
+	TABLE(c3, 0),
+	TABLE(efn2a, 0),
+	TABLE(efn2b, 0),
+	TABLE(efn2c, 0),
+	TABLE(triloop, 0),
+	TABLE(numoftriloops, 0),
+	TABLE(init, 0),
+	TABLE(gail, 0),
+	TABLE(prelog, 0), /* float, kept as its bit pattern */
+};
+
+static const unsigned int NUM_TABLES = sizeof(tables)/sizeof(tables[0]);
+
+/*
+ * compiled in at build time by gtfold-compile-params. The references are strong, so a
+ * program linked against libgtfold.a pulls the snapshots out of the archive as well;
+ * gtfold-compile-params itself links empty ones from builtin-none.c.
+ */
+extern "C" {
+	extern const unsigned char param_snapshot_turner99[];
+	extern const size_t param_snapshot_turner99_size;
+	extern const unsigned char param_snapshot_rnaparams[];
+	extern const size_t param_snapshot_rnaparams_size;
+}
+
+static void put_u32(std::string& buf, unsigned int v)
+{
+	for (int k = 0; k < 4; ++k) buf.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+static void put_u64(std::string& buf, unsigned long long v)
+{
+	for (int k = 0; k < 8; ++k) buf.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+static void put_varint(std::string& buf, unsigned int v)
+{
+	while (v >= 0x80) {
+		buf.push_back((char)((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((char)v);
+}
+
+static unsigned int get_u32(const unsigned char* p)
+{
+	unsigned int v = 0;
+	for (int k = 3; k >= 0; --k) v = (v << 8) | p[k];
+	return v;
+}
+
+static unsigned long long get_u64(const unsigned char* p)
+{
+	unsigned long long v = 0;
+	for (int k = 7; k >= 0; --k) v = (v << 8) | p[k];
+	return v;
+}
+
+// false if the varint runs past end
+static bool get_varint(const unsigned char*& p, const unsigned char* end, unsigned int& v)
+{
+	v = 0;
+	for (int shift = 0; p < end && shift < 35; shift += 7) {
+		unsigned char c = *p++;
+		v |= (unsigned int)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+static unsigned long long fnv1a(const unsigned char* p, size_t n)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for (size_t k = 0; k < n; ++k) {
+		h ^= p[k];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static inline int load_entry(const param_table& t, unsigned int k)
+{
+	int v;
+	memcpy(&v, (const char*)t.ptr + k*sizeof(int), sizeof(int));
+	return v;
+}
+
+static inline void store_entry(const param_table& t, unsigned int k, int v)
+{
+	memcpy((char*)t.ptr + k*sizeof(int), &v, sizeof(int));
+}
+
+void param_snapshot_encode(std::string name, int flags, std::string& blob)
+{
+	std::string payload;
+	put_varint(payload, NUM_TABLES);
+	for (unsigned int t = 0; t < NUM_TABLES; ++t) {
+		put_varint(payload, tables[t].count);
+		unsigned int k = 0;
+		while (k < tables[t].count) {
+			int v = load_entry(tables[t], k);
+			unsigned int run = 1;
+			while (k + run < tables[t].count && load_entry(tables[t], k + run) == v) run++;
+			put_varint(payload, run);
+			put_varint(payload, ((unsigned int)v << 1) ^ (unsigned int)(v >> 31));
+			k += run;
+		}
+	}
+
+	blob.assign(SNAPSHOT_MAGIC, 4);
+	put_u32(blob, PARAM_SNAPSHOT_VERSION);
+	put_u32(blob, (unsigned int)flags);
+	put_u32(blob, name.length());
+	put_u32(blob, payload.size());
+	put_u64(blob, fnv1a((const unsigned char*)payload.data(), payload.size()));
+	blob += name;
+	blob += payload;
+}
+
+unsigned long long param_tables_checksum()
+{
+	std::string blob;
+	param_snapshot_encode("", 0, blob);
+	return get_u64((const unsigned char*)blob.data() + 20);
+}
+
+bool param_snapshot_decode(const unsigned char* blob, size_t size, int unamode, int mismatch, std::string& name, std::string& err)
+{
+	if (size < HEADER_SIZE || memcmp(blob, SNAPSHOT_MAGIC, 4) != 0) {
+		err = "not a parameter snapshot";
+		return false;
+	}
+	unsigned int version = get_u32(blob+4);
+	if (version != PARAM_SNAPSHOT_VERSION) {
+		err = "unsupported snapshot version, recompile it with this version of gtfold-compile-params";
+		return false;
+	}
+	int flags = (int)get_u32(blob+8);
+	size_t name_len = get_u32(blob+12);
+	size_t payload_size = get_u32(blob+16);
+	if (HEADER_SIZE + name_len + payload_size != size) {
+		err = "truncated snapshot";
+		return false;
+	}
+	const unsigned char* p = blob + HEADER_SIZE + name_len;
+	const unsigned char* end = p + payload_size;
+	if (fnv1a(p, payload_size) != get_u64(blob+20)) {
+		err = "checksum mismatch, the snapshot is corrupt";
+		return false;
+	}
+	name.assign((const char*)blob + HEADER_SIZE, name_len);
+
+	if (((flags & PARAM_SNAPSHOT_UNAMODE) != 0) != (unamode != 0)) {
+		err = unamode ? "snapshot was not compiled with --unafold" : "snapshot was compiled with --unafold";
+		return false;
+	}
+	if (mismatch && !(flags & PARAM_SNAPSHOT_MISMATCH)) {
+		err = "snapshot has no terminal mismatch tables, compile it with --mismatch";
+		return false;
+	}
+	int needed = (unamode ? PARAM_SNAPSHOT_UNAMODE|PARAM_SNAPSHOT_MISMATCH : 0) | (mismatch ? PARAM_SNAPSHOT_MISMATCH : 0);
+
+	unsigned int ntables;
+	if (!get_varint(p, end, ntables) || ntables != NUM_TABLES) {
+		err = "snapshot tables do not match this build";
+		return false;
+	}
+	for (unsigned int t = 0; t < NUM_TABLES; ++t) {
+		unsigned int count;
+		if (!get_varint(p, end, count) || count != tables[t].count) {
+			err = std::string("size of table ") + tables[t].name + " does not match this build";
+			return false;
+		}
+		// tables the mode does not use are left as the text loader would leave them
+		bool use = tables[t].flag == 0 || (tables[t].flag & needed);
+		unsigned int k = 0;
+		while (k < count) {
+			unsigned int run, zz;
+			if (!get_varint(p, end, run) || !get_varint(p, end, zz) || run == 0 || run > count - k) {
+				err = std::string("corrupt run in table ") + tables[t].name;
+				return false;
+			}
+			int v = (int)(zz >> 1) ^ -(int)(zz & 1);
+			if (use)
+				for (unsigned int r = 0; r < run; ++r) store_entry(tables[t], k + r, v);
+			k += run;
+		}
+	}
+	if (p != end) {
+		err = "trailing bytes after the last table";
+		return false;
+	}
+	return true;
+}
+
+void save_param_snapshot(std::string fileName, std::string name, int flags)
+{
+	std::string blob;
+	param_snapshot_encode(name, flags, blob);
+	FILE* outfile = fopen(fileName.c_str(), "wb");
+	if (outfile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+	if (fwrite(blob.data(), 1, blob.size(), outfile) != blob.size()) {
+		cerr<<"Error in writing file: "<<fileName<<endl;
+		exit(-1);
+	}
+	fclose(outfile);
+}
+
+void save_param_snapshot_source(std::string fileName, std::string name, int flags)
+{
+	std::string blob;
+	param_snapshot_encode(name, flags, blob);
+
+	std::string symbol = "param_snapshot_";
+	for (size_t k = 0; k < name.length(); ++k)
+		symbol.push_back(isalnum((unsigned char)name[k]) ? (char)tolower((unsigned char)name[k]) : '_');
+
+	FILE* outfile = fopen(fileName.c_str(), "w");
+	if (outfile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+	fprintf(outfile, "/* %s parameter snapshot, generated by gtfold-compile-params. Do not edit. */\n", name.c_str());
+	fprintf(outfile, "#include <stddef.h>\n\n");
+	fprintf(outfile, "const unsigned char %s[] = {", symbol.c_str());
+	for (size_t k = 0; k < blob.size(); ++k)
+		fprintf(outfile, "%s%u,", k % 20 == 0 ? "\n" : "", (unsigned char)blob[k]);
+	fprintf(outfile, "\n};\n\nconst size_t %s_size = sizeof(%s);\n", symbol.c_str(), symbol.c_str());
+	if (ferror(outfile)) {
+		cerr<<"Error in writing file: "<<fileName<<endl;
+		exit(-1);
+	}
+	fclose(outfile);
+}
+
+bool is_param_snapshot(std::string fileName)
+{
+	struct stat buf;
+	if (stat(fileName.c_str(), &buf) != 0 || !S_ISREG(buf.st_mode)) return false;
+	FILE* infile = fopen(fileName.c_str(), "rb");
+	if (infile == NULL) return false;
+	char magic[4];
+	bool ret = fread(magic, 1, 4, infile) == 4 && memcmp(magic, SNAPSHOT_MAGIC, 4) == 0;
+	fclose(infile);
+	return ret;
+}
+
+void load_param_snapshot(std::string fileName, int unamode, int mismatch)
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	struct stat buf;
+	if (fd < 0 || fstat(fd, &buf) != 0) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+	void* blob = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (blob == MAP_FAILED) {
+		cerr<<"Error in mapping file: "<<fileName<<endl;
+		exit(-1);
+	}
+
+	std::string name, err;
+	bool ok = param_snapshot_decode((const unsigned char*)blob, buf.st_size, unamode, mismatch, name, err);
+	munmap(blob, buf.st_size);
+	if (!ok) {
+		cerr<<"Error in parameter snapshot "<<fileName<<": "<<err<<endl;
+		exit(-1);
+	}
+}
+
+bool load_builtin_params(std::string name, int unamode, int mismatch)
+{
+	const unsigned char* blob = NULL;
+	size_t size = 0;
+	if (name == "Turner99" && param_snapshot_turner99_size > 0) {
+		blob = param_snapshot_turner99;
+		size = param_snapshot_turner99_size;
+	} else if (name == "RNAParams" && param_snapshot_rnaparams_size > 0) {
+		blob = param_snapshot_rnaparams;
+		size = param_snapshot_rnaparams_size;
+	}
+	if (blob == NULL) return false;
+
+	std::string name1, err;
+	if (!param_snapshot_decode(blob, size, unamode, mismatch, name1, err)) {
+		cerr<<"Error in built-in "<<name<<" parameters: "<<err<<endl;
+		exit(-1);
+	}
+	return true;
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#include "utils.h"
+#include "param-snapshot.h"
+#include "result-cache.h"
+
+using namespace std;
+
+static const char CACHE_MAGIC[4] = {'G','T','R','C'};
+
+static string cache_dir;
+static double cache_size = RESULT_CACHE_SIZE*1024.0*1024;
+static double cache_used = -1; /* bytes in the entries when last counted, -1 before */
+static bool write_failed = false;
+
+static bool params_hashed = false;
+static unsigned long long params_checksum;
+
+struct cache_entry
+{
+	time_t mtime;
+	double size;
+	string path;
+};
+
+static unsigned long long fnv1a(const void* p, size_t n, unsigned long long h = 0xcbf29ce484222325ULL)
+{
+	const unsigned char* c = (const unsigned char*)p;
+	for (size_t k = 0; k < n; ++k) {
+		h ^= c[k];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+void set_cache_dir(const char* dir) {
+	cache_dir = dir;
+	while (cache_dir.length() > 1 && cache_dir[cache_dir.length()-1] == '/')
+		cache_dir.erase(cache_dir.length()-1);
+
+	struct stat st;
+	if (mkdir(cache_dir.c_str(), 0777) != 0 && errno != EEXIST) {
+		printf("Cannot create the cache directory %s: %s\n", cache_dir.c_str(), strerror(errno));
+		exit(-1);
+	}
+	if (stat(cache_dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+		printf("INVALID ARGUMENTS: --cache-dir %s is not a directory\n", cache_dir.c_str());
+		exit(-1);
+	}
+}
+
+void set_cache_size(const char* mb) {
+	char* end;
+	double v = strtod(mb, &end);
+	if (*end != '\0' || v <= 0) {
+		printf("INVALID ARGUMENTS: --cache-size accepts a positive size in MB\n");
+		exit(-1);
+	}
+	cache_size = v*1024*1024;
+}
+
+bool cache_enabled() {
+	return !cache_dir.empty();
+}
+
+string cache_key(const char* kind, const string& seq) {
+	string key = kind;
+	key += '\0';
+	key.reserve(key.length() + seq.length() + 64);
+	for (size_t i = 0; i < seq.length(); i++)
+		key += (char)encode(seq[i]);
+
+	// taken once until the parameters are read again
+	if (!params_hashed) {
+		params_checksum = param_tables_checksum();
+		params_hashed = true;
+	}
+	cache_key_add(key, "params", (long long)params_checksum);
+	return key;
+}
+
+void cache_params_changed() {
+	params_hashed = false;
+}
+
+void cache_key_add(string& key, const char* name, long long value) {
+	stringstream ss;
+	ss << '\0' << name << '=' << value;
+	key += ss.str();
+}
+
+void cache_key_add_file(string& key, const char* name, const string& fileName) {
+	unsigned long long h = fnv1a(NULL, 0);
+	ifstream fs(fileName.c_str(), ios::in | ios::binary);
+	char buf[65536];
+	while (fs.good()) {
+		fs.read(buf, sizeof(buf));
+		h = fnv1a(buf, fs.gcount(), h);
+	}
+	cache_key_add(key, name, (long long)h);
+}
+
+static string entry_path(const string& key) {
+	char name[17];
+	sprintf(name, "%016llx", fnv1a(key.data(), key.size()));
+	return cache_dir + "/" + name;
+}
+
+bool cache_get(const string& key, string& data) {
+	string path = entry_path(key);
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL) return false;
+
+	char magic[4];
+	unsigned int version;
+	unsigned long long keySize, dataSize;
+	bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, CACHE_MAGIC, 4) == 0
+		&& fread(&version, sizeof(version), 1, f) == 1 && version == RESULT_CACHE_VERSION
+		&& fread(&keySize, sizeof(keySize), 1, f) == 1 && keySize == key.size();
+	if (ok) {
+		string k(keySize, '\0');
+		ok = (keySize == 0 || fread(&k[0], keySize, 1, f) == 1) && k == key;
+	}
+	if (ok) ok = fread(&dataSize, sizeof(dataSize), 1, f) == 1;
+	if (ok) {
+		data.resize(dataSize);
+		ok = (dataSize == 0 || fread(&data[0], dataSize, 1, f) == 1) && fgetc(f) == EOF;
+	}
+	fclose(f);
+
+	// the modification time orders the entries for eviction
+	if (ok) utimes(path.c_str(), NULL);
+	return ok;
+}
+
+static bool older_entry(const cache_entry& a, const cache_entry& b) {
+	return a.mtime < b.mtime;
+}
+
+/* counts the entries, and removes the least recently used ones if they take more than the cap */
+static void trim_cache() {
+	vector<cache_entry> entries;
+	cache_used = 0;
+	DIR* d = opendir(cache_dir.c_str());
+	if (d == NULL) return;
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL) {
+		// skips . and .. and the files being written
+		if (e->d_name[0] == '.') continue;
+		cache_entry c;
+		c.path = cache_dir + "/" + e->d_name;
+		struct stat st;
+		if (stat(c.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+		c.mtime = st.st_mtime;
+		c.size = st.st_size;
+		cache_used += c.size;
+		entries.push_back(c);
+	}
+	closedir(d);
+	if (cache_used <= cache_size) return;
+
+	// down to 90% of the cap, so that the next entries do not trim again right away
+	sort(entries.begin(), entries.end(), older_entry);
+	for (size_t k = 0; k < entries.size() && cache_used > 0.9*cache_size; k++) {
+		unlink(entries[k].path.c_str());
+		cache_used -= entries[k].size;
+	}
+}
+
+void cache_put(const string& key, const string& data) {
+	static int count = 0;
+	stringstream tmp;
+	tmp << cache_dir << "/." << getpid() << "." << count++ << ".tmp";
+
+	unsigned int version = RESULT_CACHE_VERSION;
+	unsigned long long keySize = key.size(), dataSize = data.size();
+	FILE* f = fopen(tmp.str().c_str(), "wb");
+	bool ok = f != NULL;
+	if (ok) {
+		fwrite(CACHE_MAGIC, 4, 1, f);
+		fwrite(&version, sizeof(version), 1, f);
+		fwrite(&keySize, sizeof(keySize), 1, f);
+		fwrite(key.data(), 1, keySize, f);
+		fwrite(&dataSize, sizeof(dataSize), 1, f);
+		fwrite(data.data(), 1, dataSize, f);
+		ok = !ferror(f);
+		ok = fclose(f) == 0 && ok;
+	}
+	if (!ok || rename(tmp.str().c_str(), entry_path(key).c_str()) != 0) {
+		if (!write_failed) printf("Cannot write to the cache directory %s, continuing without storing results\n", cache_dir.c_str());
+		write_failed = true;
+		unlink(tmp.str().c_str());
+		return;
+	}
+
+	// other processes sharing the cache are only seen when the entries are counted again
+	if (cache_used < 0) {
+		trim_cache();
+		return;
+	}
+	cache_used += 4 + sizeof(version) + 2*sizeof(keySize) + keySize + dataSize;
+	if (cache_used > cache_size)
+		trim_cache();
+}
@@ -0,0 +1,306 @@
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "global.h"
+#include "sample-archive.h"
+
+using namespace std;
+
+static const char ARCHIVE_MAGIC[4] = {'G','T','S','A'};
+static const char INDEX_MAGIC[4] = {'G','T','S','I'};
+static const int TRAILER_SIZE = 8 + 8 + 4;
+
+static void put_u32(std::string& buf, unsigned int v)
+{
+	for (int k = 0; k < 4; ++k) buf.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+static void put_u64(std::string& buf, unsigned long long v)
+{
+	for (int k = 0; k < 8; ++k) buf.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+static void put_f64(std::string& buf, double d)
+{
+	unsigned long long v;
+	memcpy(&v, &d, sizeof(v));
+	put_u64(buf, v);
+}
+
+static void put_varint(std::string& buf, unsigned int v)
+{
+	while (v >= 0x80) {
+		buf.push_back((char)((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((char)v);
+}
+
+static unsigned int get_u32(const unsigned char* p)
+{
+	unsigned int v = 0;
+	for (int k = 3; k >= 0; --k) v = (v << 8) | p[k];
+	return v;
+}
+
+static unsigned long long get_u64(const unsigned char* p)
+{
+	unsigned long long v = 0;
+	for (int k = 7; k >= 0; --k) v = (v << 8) | p[k];
+	return v;
+}
+
+static double get_f64(const unsigned char* p)
+{
+	unsigned long long v = get_u64(p);
+	double d;
+	memcpy(&d, &v, sizeof(d));
+	return d;
+}
+
+static unsigned int read_varint(FILE* infile, const std::string& fileName)
+{
+	unsigned int v = 0;
+	int shift = 0;
+	int c;
+	while ((c = fgetc(infile)) != EOF) {
+		v |= (unsigned int)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return v;
+		shift += 7;
+	}
+	cerr<<"Error: truncated record in sample archive "<<fileName<<endl;
+	exit(-1);
+}
+
+static void read_exact(FILE* infile, unsigned char* buf, size_t n, const std::string& fileName)
+{
+	if (fread(buf, 1, n, infile) != n) {
+		cerr<<"Error: unexpected end of sample archive "<<fileName<<endl;
+		exit(-1);
+	}
+}
+
+void sample_archive_encode(const int* structure, int length, double energy, double probability, std::string& buf)
+{
+	int npairs = 0;
+	for (int i = 1; i <= length; ++i)
+		if (structure[i] > i) npairs++;
+
+	put_u32(buf, (unsigned int)(int)floor(energy*100 + 0.5));
+	put_f64(buf, probability);
+	put_varint(buf, npairs);
+	int prev = 0;
+	for (int i = 1; i <= length; ++i) {
+		if (structure[i] > i) {
+			put_varint(buf, i - prev);
+			put_varint(buf, structure[i] - i);
+			prev = i;
+		}
+	}
+}
+
+SampleArchiveWriter::SampleArchiveWriter() : outfile(NULL), pos(0) {}
+
+SampleArchiveWriter::~SampleArchiveWriter()
+{
+	if (outfile != NULL) close();
+}
+
+void SampleArchiveWriter::open(std::string fileName1, std::string seq, int dangles, double scaleFactor)
+{
+	fileName = fileName1;
+	outfile = fopen(fileName.c_str(), "wb");
+	if (outfile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+	std::string buf(ARCHIVE_MAGIC, 4);
+	put_u32(buf, SAMPLE_ARCHIVE_VERSION);
+	put_u32(buf, seq.length());
+	put_u32(buf, (unsigned int)dangles);
+	put_f64(buf, scaleFactor);
+	buf += seq;
+	if (fwrite(buf.data(), 1, buf.size(), outfile) != buf.size()) {
+		cerr<<"Error in writing file: "<<fileName<<endl;
+		exit(-1);
+	}
+	offsets.clear();
+	pos = buf.size();
+}
+
+void SampleArchiveWriter::append(const std::string& record)
+{
+	if (fwrite(record.data(), 1, record.size(), outfile) != record.size()) {
+		cerr<<"Error in writing file: "<<fileName<<endl;
+		exit(-1);
+	}
+	offsets.push_back(pos);
+	pos += record.size();
+}
+
+void SampleArchiveWriter::close()
+{
+	std::string buf;
+	buf.reserve(offsets.size()*8 + TRAILER_SIZE);
+	for (size_t k = 0; k < offsets.size(); ++k) put_u64(buf, offsets[k]);
+	put_u64(buf, offsets.size());
+	put_u64(buf, pos);
+	buf.append(INDEX_MAGIC, 4);
+	if (fwrite(buf.data(), 1, buf.size(), outfile) != buf.size()) {
+		cerr<<"Error in writing file: "<<fileName<<endl;
+		exit(-1);
+	}
+	fclose(outfile);
+	outfile = NULL;
+}
+
+SampleArchiveReader::SampleArchiveReader() : infile(NULL) {}
+
+SampleArchiveReader::~SampleArchiveReader()
+{
+	close();
+}
+
+void SampleArchiveReader::open(std::string fileName1)
+{
+	fileName = fileName1;
+	infile = fopen(fileName.c_str(), "rb");
+	if (infile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+
+	unsigned char fixed[4+4+4+4+8];
+	read_exact(infile, fixed, sizeof(fixed), fileName);
+	if (memcmp(fixed, ARCHIVE_MAGIC, 4) != 0) {
+		cerr<<"Error: "<<fileName<<" is not a sample archive"<<endl;
+		exit(-1);
+	}
+	hdr.version = get_u32(fixed+4);
+	if (hdr.version != SAMPLE_ARCHIVE_VERSION) {
+		cerr<<"Error: unsupported sample archive version "<<hdr.version<<" in "<<fileName<<endl;
+		exit(-1);
+	}
+	hdr.length = get_u32(fixed+8);
+	hdr.dangles = (int)get_u32(fixed+12);
+	hdr.scale_factor = get_f64(fixed+16);
+	std::vector<unsigned char> seqbuf(hdr.length);
+	if (hdr.length > 0) read_exact(infile, &seqbuf[0], hdr.length, fileName);
+	hdr.seq.assign(seqbuf.begin(), seqbuf.end());
+
+	unsigned char trailer[TRAILER_SIZE];
+	if (fseek(infile, -TRAILER_SIZE, SEEK_END) != 0) {
+		cerr<<"Error: "<<fileName<<" has no sample index"<<endl;
+		exit(-1);
+	}
+	read_exact(infile, trailer, TRAILER_SIZE, fileName);
+	if (memcmp(trailer+16, INDEX_MAGIC, 4) != 0) {
+		cerr<<"Error: "<<fileName<<" has no sample index, was sampling interrupted?"<<endl;
+		exit(-1);
+	}
+	unsigned long long nrecords = get_u64(trailer);
+	unsigned long long index_offset = get_u64(trailer+8);
+
+	std::vector<unsigned char> index(nrecords*8);
+	fseek(infile, (long)index_offset, SEEK_SET);
+	if (nrecords > 0) read_exact(infile, &index[0], index.size(), fileName);
+	offsets.resize(nrecords);
+	for (unsigned long long k = 0; k < nrecords; ++k) offsets[k] = get_u64(&index[k*8]);
+}
+
+void SampleArchiveReader::close()
+{
+	if (infile != NULL) fclose(infile);
+	infile = NULL;
+}
+
+void SampleArchiveReader::read(unsigned long long index, int* structure, double& energy, double& probability)
+{
+	if (index >= offsets.size()) {
+		cerr<<"Error: sample "<<index+1<<" is out of range, "<<fileName<<" has "<<offsets.size()<<" samples"<<endl;
+		exit(-1);
+	}
+	fseek(infile, (long)offsets[index], SEEK_SET);
+	unsigned char fixed[4+8];
+	read_exact(infile, fixed, sizeof(fixed), fileName);
+	energy = (int)get_u32(fixed)/100.0;
+	probability = get_f64(fixed+4);
+
+	for (int i = 0; i <= hdr.length; ++i) structure[i] = 0;
+	unsigned int npairs = read_varint(infile, fileName);
+	int i = 0;
+	for (unsigned int k = 0; k < npairs; ++k) {
+		i += read_varint(infile, fileName);
+		int j = i + read_varint(infile, fileName);
+		if (i < 1 || j > hdr.length) {
+			cerr<<"Error: corrupt record "<<index+1<<" in sample archive "<<fileName<<endl;
+			exit(-1);
+		}
+		structure[i] = j;
+		structure[j] = i;
+	}
+}
+
+bool is_sample_archive(std::string fileName)
+{
+	FILE* infile = fopen(fileName.c_str(), "rb");
+	if (infile == NULL) return false;
+	char magic[4];
+	bool ret = fread(magic, 1, 4, infile) == 4 && memcmp(magic, ARCHIVE_MAGIC, 4) == 0;
+	fclose(infile);
+	return ret;
+}
+
+void sample_archive_export(std::string archiveFile, unsigned long long first, unsigned long long last, std::string outFile, bool ctFormat, std::string ctDir)
+{
+	SampleArchiveReader reader;
+	reader.open(archiveFile);
+	const sample_archive_header& hdr = reader.header();
+
+	if (last == 0 || last > reader.count()) last = reader.count();
+	if (first < 1) first = 1;
+	printf("Sample archive %s: %llu samples, sequence length %d, dangle mode %d\n", archiveFile.c_str(), reader.count(), hdr.length, hdr.dangles);
+
+	FILE* outfile = NULL;
+	if (!ctFormat) {
+		outfile = fopen(outFile.c_str(), "w");
+		if (outfile == NULL) {
+			cerr<<"Error in opening file: "<<outFile<<endl;
+			exit(-1);
+		}
+		fprintf(outfile, "%s\n", hdr.seq.c_str());
+	}
+
+	std::string seqname = archiveFile.substr(archiveFile.find_last_of("/\\") + 1);
+	if (seqname.find(".") != string::npos) seqname.erase(seqname.rfind("."));
+
+	int* structure1 = new int[hdr.length+1];
+	std::string ensemble(hdr.length, '.');
+	for (unsigned long long index = first; index <= last; ++index) {
+		double energy, probability;
+		reader.read(index-1, structure1, energy, probability);
+		if (ctFormat) {
+			std::stringstream ss;
+			ss<<ctDir<<"/"<<seqname<<"_"<<index<<".ct";
+			save_ct_file(ss.str(), hdr.seq, (int)floor(energy*100 + 0.5), structure1);
+		} else {
+			for (int i = 1; i <= hdr.length; ++i) {
+				if (structure1[i] == 0) ensemble[i-1] = '.';
+				else ensemble[i-1] = structure1[i] > i ? '(' : ')';
+			}
+			fprintf(outfile, "%s\t%.2f\t%g\n", ensemble.c_str(), energy, probability);
+		}
+	}
+	delete[] structure1;
+
+	if (ctFormat) {
+		printf("Exported samples %llu to %llu as CT files under %s\n", first, last, ctDir.c_str());
+	} else {
+		fclose(outfile);
+		printf("Exported samples %llu to %llu to %s\n", first, last, outFile.c_str());
+	}
+}
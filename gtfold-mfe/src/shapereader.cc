@@ -31,6 +31,7 @@ void enable_shape(int b) {
 
 void free_shapeArray(int len){
 	free(SHAPEarray);
+	free(SHAPEenergies);
 }
 
 void print_shapeArray(int len){
@@ -46,7 +47,7 @@ void readSHAPEarray(const char* filename, int seqlength){
 	SHAPEarray = (double*)malloc(sizeof(double)*(seqlength+1));	
 	SHAPEenergies = (int*)malloc(sizeof(int)*(seqlength+1));
 
-	for(int i = 0; i<seqlength; i++){
+	for(int i = 0; i<=seqlength; i++){
 		SHAPEarray[i] = -999;	
 		SHAPEenergies[i] = 0;
 	}
@@ -9,9 +9,11 @@
 #include "loader.h"
 #include "algorithms.h"
 #include "subopt_traceback.h"
+#include "subopt_writer.h"
 #include "global.h"
 #include "utils.h"
 #include "mfe_main.h"
+#include "batch.h"
 
 using namespace std;
 
@@ -19,16 +21,28 @@ static bool SILENT = false;
 static string seqfile = "";
 static string suboptFile = "";
 static double suboptDelta = 0.0;
+static bool DELTA = false;
+static int topk = 0;
+static bool DOS = false;
+static bool BINARY = false;
+static string exportFile = "";
+static string dosFile = "";
 static string outputPrefix = "";
 static string outputFile = "";
 static string outputDir = "";
 static string paramDir = "";
 static bool PARAM_DIR = false;
 static int is_check_for_duplicates_enabled = -1;
+static int nThreads = -1;
+static bool CURSOR = false;
+static int forbidI = 0;
+static int forbidJ = 0;
 static int max_structure_count = -1;//User can optionally use --maxcount max_structure_count to restrict program to generate only that many structure and quits after that 
 static void help();
 static void detailed_help();
 static void printRunConfiguration(string seq);
+static void set_output_files();
+static void subopt_sequence(const string& seq, int threads);
 int UNIQUE_MULTILOOP_DECOMPOSITION = -1;
 
 void save_subopt_file(string outputFile, ss_map_t& ss_data, 
@@ -50,14 +64,15 @@ void save_subopt_file(string outputFile, ss_map_t& ss_data,
 	outfile.close();
 }
 
-static void write_header_subopt_file(string outputFile, const string& seq, int energy)
+static void write_header_dos_file(string outputFile, const string& seq, int energy)
 {
 	ofstream outfile;
 	outfile.open(outputFile.c_str());
 	char buff[4096];
 
-	sprintf(buff,"count\t%s\t%6.2f", seq.c_str(), energy/100.0);
+	sprintf(buff,"%s\t%6.2f", seq.c_str(), energy/100.0);
 	outfile << buff << std::endl;
+	outfile << "from\tto\tcount\tcumulative" << std::endl;
 
 	outfile.close();
 }
@@ -108,9 +123,10 @@ void parse_options(int argc, char** argv) {
           help();
       } else if(strcmp(argv[i], "--delta") == 0) {
         g_dangles = 2;
-        if(i < argc)
+        if(i < argc) {
           suboptDelta = atof(argv[++i]);
-        else
+          DELTA = true;
+        } else
           help();
       } else if(strcmp(argv[i], "-o") == 0) {
 		outputPrefix.assign(argv[++i]);
@@ -133,12 +149,59 @@ void parse_options(int argc, char** argv) {
           }
         } else
           help();
+      } else if (strcmp(argv[i], "--topk") == 0) {
+        if(i+1 < argc) {
+          topk = atoi(argv[++i]);
+          if (topk <= 0) {
+            topk = 0;
+            printf("Ignoring --topk option as it accepts only positive numbers.\n");
+          }
+        } else
+          help();
+      } else if (strcmp(argv[i], "--binary") == 0) {
+        BINARY = true;
+      } else if (strcmp(argv[i], "--exportbinary") == 0) {
+        if(i+1 < argc)
+          exportFile = argv[++i];
+        else
+          help();
+      } else if (strcmp(argv[i], "--cursor") == 0) {
+        CURSOR = true;
+      } else if (strcmp(argv[i], "--forbid") == 0) {
+        if(i+2 < argc) {
+          forbidI = atoi(argv[++i]);
+          forbidJ = atoi(argv[++i]);
+          CURSOR = true;
+          if (forbidI <= 0 || forbidJ <= forbidI) {
+            printf("--forbid needs two positions I < J.\n");
+            help();
+          }
+        } else
+          help();
+      } else if (strcmp(argv[i], "--dos") == 0) {
+        DOS = true;
+      } else if (strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "-t") == 0) {
+        if(i+1 < argc)
+          nThreads = atoi(argv[++i]);
+        else
+          help();
+      } else if (strcmp(argv[i], "--batchmem") == 0) {
+        if(i+1 < argc)
+          set_batch_memory(argv[++i]);
+        else
+          help();
       }
     } else {
       seqfile = argv[i];
     }
   }
 
+  // the binary file is read instead of a sequence
+  if(!exportFile.empty()) {
+    BINARY = false;
+    seqfile = exportFile;
+  }
+
   if(seqfile.empty()) {
     printf("Missing input file.\n");
     help();
@@ -160,26 +223,40 @@ void parse_options(int argc, char** argv) {
       outputPrefix.erase(outputPrefix.rfind("."));
   }
 
+  set_output_files();
+
+	printf("Output: %s %s %s\n", outputPrefix.c_str(), outputFile.c_str(), suboptFile.c_str());
+}
+
+static void set_output_files() {
+  outputFile = "";
+  suboptFile = "";
+  dosFile = "";
+
   // If output dir specified
   if (!outputDir.empty()) {
     outputFile += outputDir;
     outputFile += "/";
     suboptFile += outputDir;
     suboptFile += "/";
+    dosFile += outputDir;
+    dosFile += "/";
   }
   // ... and append the .ct
   outputFile += outputPrefix;
   outputFile += ".ct";
   suboptFile += outputPrefix;	
-  suboptFile += "_ss.txt";	
-
-	printf("Output: %s %s %s\n", outputPrefix.c_str(), outputFile.c_str(), suboptFile.c_str());
+  suboptFile += BINARY ? "_ss.bin" : "_ss.txt";	
+  dosFile += outputPrefix;
+  dosFile += "_dos.txt";
 }
 
 static void print_usage_developer_options() {
 	printf("\n\nDeveloper OPTIONS\n");
 	printf("   --unique [0|1]		   Set/Reset the UNIQUE_MULTILOOP_DECOMPOSITION routine which tries to ensure unique structures. By default this option will be switched on for seq len less than 2000 and switched off for more seq len.\n");
-    	printf("   --duplicatecheck [0|1]	   Set/Reset the check if duplicate structure is coming or not, if duplicate is coming then warn the user and exits. By default this option will switched off. This option will slowdown program as well as consume more memory because of need to storing all structures. Default behavior will be OFF if unique option is switched ON and it will be ON by default if unique option is OFF.\n");
+    	printf("   --cursor                Enumerate the structures through SuboptCursor instead of subopt_traceback, serially.\n");
+	printf("   --forbid I J            Enumerate through SuboptCursor and drop every structure with the pair I.J.\n");
+	printf("   --duplicatecheck [0|1]	   Set/Reset the check if duplicate structure is coming or not, if duplicate is coming then warn the user and exits. By default this option will switched off. This option will slowdown program as well as consume more memory because of need to storing all structures. Default behavior will be OFF if unique option is switched ON and it will be ON by default if unique option is OFF.\n");
     printf("\nSetting default parameter directory:\n");
     printf("\tTo run properly, GTfold requires access to a set of parameter files. If you are using one of the prepackaged binaries, you may need (or chose) to \n");
     printf("\tset the GTFOLDDATADIR environment variable to specify the directory in whihc GTfold should look to find default parameter files. In a terminal \n");
@@ -192,6 +269,7 @@ static void print_usage_developer_options() {
     printf("\t\t(1)      The directory pointed to by environment variable GTFOLDDATADIR \n");
     printf("\t\t(2)      The install directory (eg. /usr/local/share/gtfold), if (1) fails. \n");
     printf("\t\t(3)      The subdirectory 'data' of the current directory, if (1) and (2) fail. \n");
+    printf("\tUnless GTFOLDDATADIR is set, the default Turner99 and RNAParams sets are read from a copy compiled into GTfold. \n");
     printf("\n");
 }
 
@@ -199,7 +277,8 @@ static void print_usage_developer_options() {
 static void print_usage() {
     printf("Usage: gtsubopt [OPTION]... FILE\n\n");
 
-    printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n\n");
+    printf("   FILE is an RNA sequence file containing only the sequence or in FASTA format.\n");
+    printf("   Every record of a multi-record FASTA file is processed, with output files named OUTPUT_ID_ss.txt.\n\n");
 
     printf("OPTIONS\n");
     printf("   --delta DOUBLE         Calculate suboptimal structures within DOUBLE kcal/mol\n");
@@ -208,18 +287,36 @@ static void print_usage() {
     printf("   -d, --dangle INT     Restricts treatment of dangling energies (INT=2),\n");
     printf("   -o, --output NAME    Write output files with prefix given in NAME\n");
     printf("   -p  --paramdir DIR   Path to directory from which parameters are to be read\n");
+    printf("                        or a parameter snapshot file written by gtfold-compile-params\n");
     printf("   -h, --help           Output help (this message) and exit.\n");
     printf("   --detailedhelp      Output help (this message) with detailed options and examples, and exit.\n");
     printf("   -w, --workdir DIR    Path of directory where output files will be written.\n");
+    printf("   -t, --threads INT    Limit number of threads used to INT. Structures are enumerated in parallel,\n");
+    printf("                        unless --maxcount is given, and written in the same order as with one thread.\n");
     printf("   -v, --verbose        Run in verbose mode.\n");
+    printf("   --batchmem MB        Memory for the tables of the records processed at once from a\n");
+    printf("                        multi-record FASTA file, half of the physical memory by default.\n");
     printf("   --maxcount INT	    Optional option '--maxcount max_structure_count' to restrict program to generate only that many structure and quits after that. By default there is no maximum limit\n");
+    printf("   --binary             Write the structures to prefix_ss.bin as compact pair lists instead of text.\n");
+    printf("   --exportbinary FILE  Write the structures of the binary file FILE to prefix_ss.txt, as without --binary.\n");
+    printf("                        No sequence file is needed.\n");
+    printf("   --dos                Count the structures within --delta of the MFE in 0.1 kcal/mol energy bins,\n");
+    printf("                        without enumerating them, and write the histogram to prefix_dos.txt.\n");
+    printf("   --topk INT           Write the INT lowest energy structures, in increasing order of energy. If --delta\n");
+    printf("                        is also given, stop early at structures more than DOUBLE kcal/mol above the MFE.\n");
 	printf("   --detailedhelp       Display detailed help message. Includes examples and additional options useful to developers.\n");
 }
 
 static void print_examples(){
         printf("\n\nEXAMPLES:\n\n");
         printf("1. Calculate Suboptimal Structures:\n");
-        printf("gtsubopt --delta DOUBLE [-d 2] [-o outputPrefix] [--maxcount INT] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
+        printf("gtsubopt --delta DOUBLE [-d 2] [-o outputPrefix] [--maxcount INT] [-t INT] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
+        printf("2. Count the structures within DOUBLE kcal/mol of the MFE per 0.1 kcal/mol:\n");
+        printf("gtsubopt --delta DOUBLE --dos [-o outputPrefix] [-t INT] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
+        printf("3. Calculate the INT lowest energy structures, best first:\n");
+        printf("gtsubopt --topk INT [--delta DOUBLE] [-o outputPrefix] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
+        printf("4. Convert a binary subopt file to text:\n");
+        printf("gtsubopt --exportbinary outputPrefix_ss.bin [-o outputPrefix] [-w DIR]\n\n");
         printf("\n\n");
 }
 
@@ -227,6 +324,8 @@ static void print_examples_developer_options(){
         printf("\n\nDeveloper Options EXAMPLES:\n\n");
 	printf("1. Calculate Suboptimal Structures:\n");
         printf("gtsubopt --delta DOUBLE [-d 2] [-o outputPrefix] [--unique INT] [--duplicatecheck INT] [--maxcount INT] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
+	printf("2. Calculate the Suboptimal Structures without the pair I.J:\n");
+        printf("gtsubopt --delta DOUBLE --forbid I J [-o outputPrefix] [--maxcount INT] [-v] [-w DIR] [-p DIR] <seq_file>\n\n");
         printf("\n\n");
 }
 
@@ -249,10 +348,63 @@ void subopt_main(int argc, char** argv) {
 
   string seq = "";
   parse_options(argc, argv);
-  if (read_sequence_file(seqfile.c_str(), seq) == FAILURE) {
+  if (!exportFile.empty()) {
+    int count = subopt_binary_export(exportFile, suboptFile);
+    printf("Exported %d structures to %s\n", count, suboptFile.c_str());
+    return;
+  }
+  fasta_reader input;
+  fasta_record record;
+  if (input.open(seqfile.c_str()) == FAILURE) {
     printf("Failed to open sequence file: %s.\n\n", seqfile.c_str());
     exit(-1);
   }
+  input.next(record);
+  readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, 0, 1, 0);
+
+  if (!input.at_end()) {
+    // the workers process record after record
+    string prefix = outputPrefix;
+    int unique = UNIQUE_MULTILOOP_DECOMPOSITION;
+    int duplicates = is_check_for_duplicates_enabled;
+    int threads = nThreads;
+    // the MFE tables, the enumeration itself grows with --delta
+    while (batch_next(input, nThreads, 24, record, threads)) {
+      outputPrefix = batch_output_prefix(prefix, record);
+      set_output_files();
+      UNIQUE_MULTILOOP_DECOMPOSITION = unique;
+      is_check_for_duplicates_enabled = duplicates;
+      subopt_sequence(record.seq, threads);
+    }
+    if (batch_failed() > 0) exit(-1);
+    return;
+  }
+  seq.swap(record.seq);
+  input.close();
+  subopt_sequence(seq, nThreads);
+}
+
+/* threads is -t, or the share of a record of a batch */
+// state of a --cursor run, shared by its filter and visit callbacks
+struct cursor_run
+{
+  SuboptWriter* writer;
+  int count;
+};
+
+static bool drop_forbidden(const ps_t& ps, const int* structure, void* data) {
+  return structure[forbidI] != forbidJ;
+}
+
+static bool write_structure(const ps_t& ps, const int* structure, void* data) {
+  cursor_run* run = (cursor_run*)data;
+  run->writer->write(++run->count, ps);
+  return max_structure_count <= 0 || run->count < max_structure_count;
+}
+
+static void subopt_sequence(const string& seq, int threads) {
+  // the histogram counts over the unique decomposition only
+  if(DOS) UNIQUE_MULTILOOP_DECOMPOSITION = 1;
   if(UNIQUE_MULTILOOP_DECOMPOSITION==-1){
 	  if(seq.length()<=2000){
 		  UNIQUE_MULTILOOP_DECOMPOSITION = 1;
@@ -273,15 +425,41 @@ void subopt_main(int argc, char** argv) {
 
   init_fold(seq.c_str());
   g_dangles = 2;  
-  readThermodynamicParameters(paramDir.c_str(), PARAM_DIR, 0, 1, 0);
+  // init_fold() sets the one of gtmfe
+  g_nthreads = threads;
   
   printRunConfiguration(seq);
 
   int energy = calculate(seq.length()) ; 
-  write_header_subopt_file(suboptFile, seq, energy);	
+
+  if (DOS) {
+    write_header_dos_file(dosFile, seq, energy);
+    double t1 = get_seconds();
+    subopt_dos(seq.length(), 100.0*suboptDelta, dosFile);
+    t1 = get_seconds() - t1;
+    printf("Density of states running time: %9.6f seconds\n", t1);
+    printf("Histogram saved in %s\n", dosFile.c_str());
+    free_fold(seq.length());
+    printf("\n");
+    return;
+  }
+
+  SuboptWriter writer;
+  writer.open(suboptFile, seq, energy, BINARY);
   
   double t1 = get_seconds();
-  ss_map_t subopt_data = subopt_traceback(seq.length(), 100.0*suboptDelta, suboptFile, is_check_for_duplicates_enabled, max_structure_count);
+  int gap = (topk > 0 && !DELTA) ? -1 : 100.0*suboptDelta;
+  if (CURSOR) {
+    if (forbidJ > (int)seq.length()) {
+      printf("--forbid %d %d is outside the sequence of length %d.\n", forbidI, forbidJ, (int)seq.length());
+      exit(-1);
+    }
+    cursor_run run = {&writer, 0};
+    subopt_enumerate(seq.length(), gap, write_structure, &run, forbidI > 0 ? drop_forbidden : NULL);
+    printf("Counts of structure generated=%d\n", run.count);
+  } else
+    subopt_traceback(seq.length(), gap, writer, is_check_for_duplicates_enabled, max_structure_count, topk);
+  writer.close();
   t1 = get_seconds() - t1;
   
   //printf("- thermodynamic parameters: %s\n", EN_DATADIR.c_str());
@@ -312,8 +490,16 @@ static void printRunConfiguration(string seq) {
         if(!SILENT) printf("- thermodynamic parameters: %s\n", EN_DATADIR.c_str());
         if(!SILENT) printf("- input file: %s\n", seqfile.c_str());
         if(!SILENT) printf("- sequence length: %d\n", (int)seq.length());
-	if(!SILENT) printf("+ calculating suboptimal structures within %f kcal/mol of MFE\n", suboptDelta);
-	if(!SILENT) printf("+ suboptimal structures file: %s\n", suboptFile.c_str());
+	if(DOS) {
+		if(!SILENT) printf("+ counting structures within %f kcal/mol of MFE per 0.1 kcal/mol\n", suboptDelta);
+		if(!SILENT) printf("+ histogram file: %s\n", dosFile.c_str());
+	}
+	else if(topk > 0) {
+		if(!SILENT) printf("+ calculating the %d lowest energy structures, best first\n", topk);
+		if(!SILENT && DELTA) printf("+ within %f kcal/mol of MFE\n", suboptDelta);
+	}
+	else if(!SILENT) printf("+ calculating suboptimal structures within %f kcal/mol of MFE\n", suboptDelta);
+	if(!SILENT && !DOS) printf("+ suboptimal structures file: %s\n", suboptFile.c_str());
 	if(!SILENT) {
 		if(UNIQUE_MULTILOOP_DECOMPOSITION==1) printf("- UNIQUE_MULTILOOP_DECOMPOSITION: %d\n", UNIQUE_MULTILOOP_DECOMPOSITION);
 		else if(UNIQUE_MULTILOOP_DECOMPOSITION==0) printf("+ UNIQUE_MULTILOOP_DECOMPOSITION: %d\n", UNIQUE_MULTILOOP_DECOMPOSITION);
@@ -27,10 +27,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "utils.h"
 #include "global.h"
 #include "subopt_traceback.h"
+#include "subopt_writer.h"
 
 #include <iostream>
 #include <iterator>
 #include <cstdlib>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //#define DEBUG 1
 
@@ -45,11 +55,20 @@ static int delta = 0;
 static int mfe = INFINITY_;
 static int length = -1;
 static int gflag = 0;
+#ifdef _OPENMP
+#pragma omp threadprivate(gflag)
+#endif
+static int cand_generation = 0; // bumped for every traceback, invalidates the candidate caches
 
 //#ifdef UNIQUE_MULTILOOP_DECOMPOSITION
 
-static int FM1[1500][1500] = {{0}};
-static int FM[1500][1500] = {{0}};
+// FM1(i,j): multiloop segment [i,j] with exactly one branch, which starts at i
+// FM(i,j) : multiloop segment [i,j] with at least one branch
+// both are packed triangular like V, indexed through indx[]
+static int *FM1 = NULL;
+static int *FM = NULL;
+#define FM1(i,j) FM1[indx[j]+(i)]
+#define FM(i,j) FM[indx[j]+(i)]
 
 static inline int Ed5_new(int i, int j, int k) {
   return (k!=0) ? Ed3(j, i, k) : Ed3(j,i,length);
@@ -59,67 +78,349 @@ static inline int Ed3_new(int i, int j, int k) {
   return (k!=length+1)?Ed5(j, i, k) : Ed5(j, i, 1);
 }
 
-void calculate_fm1() {
+void create_fm_tables() {
+  FM1 = (int *) malloc(((length+1)*length/2 + 1) * sizeof(int));
+  FM = (int *) malloc(((length+1)*length/2 + 1) * sizeof(int));
+  if (FM1 == NULL || FM == NULL) {
+    perror("Cannot allocate variable 'FM'");
+    exit(-1);
+  }
+}
+
+void free_fm_tables() {
+  free(FM1);
+  free(FM);
+  FM1 = FM = NULL;
+}
 
-  for (int i = 1; i <= length; ++i) {
+// FM1(i,j) = min over l of V(i,l) + branch penalties + Ec*(j-l), so every row
+// follows from its previous entry, FM1(i,j) = MIN(FM1(i,j-1) + Ec, branch (i,j)).
+// Rows are independent and are filled in parallel.
+void calculate_fm1() {
+  int i;
+#ifdef _OPENMP
+#pragma omp parallel for private(i) schedule(guided)
+#endif
+  for (i = 1; i <= length; ++i) {
+    int min = INFINITY_;
+    bool has_branch = false;
     for (int j = i+1; j <= length; ++j) {
-      int min = INFINITY_;
-      for (int l = i+TURN+1; l <= j; ++l) {
-        int d5 = Ed5_new(i,l,i-1);
-        int d3 = Ed3_new(i,l,l+1);
+      if (has_branch) min += Ec;
+      if (j >= i+TURN+1) {
+        int d5 = Ed5_new(i,j,i-1);
+        int d3 = Ed3_new(i,j,j+1);
 
-        int fm1 = V(i,l) + auPenalty(i,l) + d5 + d3 + Ec*(j-l) + Eb;
+        int fm1 = V(i,j) + auPenalty(i,j) + d5 + d3 + Eb;
 
-        min = MIN(min, fm1);
+        min = has_branch ? MIN(min, fm1) : fm1;
+        has_branch = true;
       }
-      FM1[i][j] = min;
+      FM1(i,j) = min;
     }
   }
-
 }
 
+// FM is only traced back inside a closing pair, so j < length. There the dangles
+// of FM1 are those of the -d2 WM recurrence, and gtsubopt always runs in -d2
+// without constraints, so FM is exactly the WM table of the MFE fill.
 void calculate_fm() {
-
-  for (int i = 1; i <= length; ++i) {
-    for (int j = i+1; j <= length;++j) {
-      int min1 = INFINITY_;
-      for (int k = i+TURN+1; k <= j-TURN-1; ++k) {
-        int x = FM[i][k-1] + FM1[k][j];
-        min1 = MIN(min1, x);
-      }
-      int min2 = INFINITY_;
-      for (int k = i; k <= j-TURN-1; ++k) {
-        int x = FM1[k][j] + Ec*(k-i);
-        min2 = MIN(min2, x);
-      }
-      FM[i][j] = MIN(min1, min2);
-    }
+  int i;
+#ifdef _OPENMP
+#pragma omp parallel for private(i) schedule(guided)
+#endif
+  for (i = 1; i <= length; ++i) {
+    for (int j = i+1; j < length; ++j)
+      FM(i,j) = WMU(i,j);
+    if (i < length) FM(i,length) = INFINITY_;
   }
 }
 
 //#endif
 
-void process(ss_map_t& subopt_data, int len, string suboptFile, int is_check_for_duplicates_enabled, int max_structure_count) {
-	ofstream outfile;
-        outfile.open(suboptFile.c_str(), ios::out | ios::app);
-        char buff[4096];
+// replaces the top segment of ps by its decompositions within delta on gstack;
+// segments too short to trace are discarded and ps goes on with the remaining ones
+static inline void expand_partial(ps_t& ps, ps_stack_t& gstack) {
+        segment smt = ps.top();
+        ps.pop();
 
+        gflag = 0;
+        if (smt.j_ - smt.i_ > TURN) {
+                (*trace_func[smt.label_])(smt.i_, smt.j_, ps, gstack);
+        }
+        if (!gflag) gstack.push(ps);
+}
 
-        int count = 0;
-        length = len;
+#ifdef _OPENMP
+/*
+ * Parallel enumeration: every thread runs the serial depth first search on its own
+ * deque, popping from the back, and an idle thread steals from the front of another
+ * deque, which holds the oldest and usually largest open branches.
+ *
+ * A task carries a key, the rank of the branch taken at each decomposition with more
+ * than one alternative, rank 0 being the branch the serial stack pops first, so keys
+ * compare lexicographically in serial output order. Threads spool encoded records to a
+ * temporary file and start a new chunk whenever they begin a stolen task. What a thread
+ * emits from its own deque precedes everything stolen from it, hence sorting the chunks
+ * by the key of their first task restores the serial order, and structures are numbered
+ * while the chunks are merged into the output file.
+ *
+ * Threads finish structures out of serial order, so a --maxcount quota would keep other
+ * structures than a serial run does; the enumeration stays serial with --maxcount.
+ */
+struct subopt_task
+{
+	ps_t ps;
+	ps_list<int> key;
+};
+
+struct subopt_chunk
+{
+	std::vector<int> key;
+	int worker;
+	long offset;
+	long bytes;
+	int count;
+
+	bool operator < (const subopt_chunk& c) const { return key < c.key; }
+};
+
+struct subopt_worker
+{
+	std::deque<subopt_task> tasks;
+	omp_lock_t lock;
+	FILE* spool;
+	std::vector<subopt_chunk> chunks;
+};
+
+static std::vector<int> key_path(const ps_list<int>& key) {
+	std::vector<int> path;
+	for (const ps_cell<int>* c = key.begin(); c != NULL; c = c->next)
+		path.push_back(c->val);
+	std::reverse(path.begin(), path.end());
+	return path;
+}
 
-	if( UNIQUE_MULTILOOP_DECOMPOSITION == 1){
-	        calculate_fm1();
-        	calculate_fm();
+static bool next_task(std::vector<subopt_worker>& workers, int tid, subopt_task& task, bool& stolen) {
+	int nthreads = workers.size();
+	stolen = false;
+	for (int k = 0; k < nthreads; ++k) {
+		subopt_worker& w = workers[(tid+k) % nthreads];
+		bool found = false;
+		omp_set_lock(&w.lock);
+		if (!w.tasks.empty()) {
+			if (k == 0) {
+				std::swap(task, w.tasks.back());
+				w.tasks.pop_back();
+			} else {
+				std::swap(task, w.tasks.front());
+				w.tasks.pop_front();
+			}
+			found = true;
+		}
+		omp_unset_lock(&w.lock);
+		if (found) {
+			stolen = (k != 0);
+			return true;
+		}
+	}
+	return false;
+}
+
+// duplicate check, and the structure map if the caller asked for one
+static void check_structure(SuboptWriter& writer, const ps_t& ps, ss_map_t* subopt_data, int is_check_for_duplicates_enabled) {
+	if (is_check_for_duplicates_enabled == 1 && writer.seen(ps)) {
+		printf("Duplicate Structure!!!");
+		writer.close();
+		exit(1);
+	}
+	if (subopt_data != NULL) subopt_data->insert(std::make_pair(ps.str(), ps.ae_));
+}
+
+static int process_parallel(ps_t& first, SuboptWriter& writer, ss_map_t* subopt_data, int nthreads, int is_check_for_duplicates_enabled) {
+	std::vector<subopt_worker> workers(nthreads);
+	for (int t = 0; t < nthreads; ++t) {
+		omp_init_lock(&workers[t].lock);
+		workers[t].spool = tmpfile();
+		if (workers[t].spool == NULL) {
+			perror("Cannot create subopt spool file");
+			exit(-1);
+		}
+	}
+	subopt_task root;
+	root.ps = first;
+	workers[0].tasks.push_back(root);
+
+	int pending = 1; // tasks queued or being expanded
+
+#pragma omp parallel num_threads(nthreads)
+	{
+		int tid = omp_get_thread_num();
+		subopt_worker& self = workers[tid];
+		int cur = -1;
+		subopt_task task;
+		ps_stack_t gstack;
+		std::vector<ps_t> branches;
+		std::string rec;
+		bool stolen;
+
+		while (1) {
+			if (!next_task(workers, tid, task, stolen)) {
+				int left;
+#pragma omp atomic read
+				left = pending;
+				if (left == 0) break;
+				sched_yield();
+				continue;
+			}
+			if (stolen || cur < 0) {
+				subopt_chunk chunk;
+				chunk.key = key_path(task.key);
+				chunk.worker = tid;
+				chunk.offset = ftell(self.spool);
+				chunk.bytes = 0;
+				chunk.count = 0;
+				self.chunks.push_back(chunk);
+				cur = self.chunks.size() - 1;
+			}
+
+			ps_t& ps = task.ps;
+			if (ps.empty()) {
+				if (is_check_for_duplicates_enabled == 1 || subopt_data != NULL) {
+#pragma omp critical(subopt_duplicates)
+					check_structure(writer, ps, subopt_data, is_check_for_duplicates_enabled);
+				}
+				rec.clear();
+				writer.encode(ps, rec);
+				fwrite(rec.data(), 1, rec.size(), self.spool);
+				self.chunks[cur].bytes += rec.size();
+				self.chunks[cur].count++;
+			} else {
+				expand_partial(ps, gstack);
+
+				// branches[k] is the one the serial stack would pop k-th
+				branches.clear();
+				while (!gstack.empty()) {
+					branches.push_back(gstack.top());
+					gstack.pop();
+				}
+				int m = branches.size();
+#pragma omp atomic
+				pending += m;
+				omp_set_lock(&self.lock);
+				for (int k = m-1; k >= 0; --k) {
+					self.tasks.push_back(subopt_task());
+					subopt_task& t = self.tasks.back();
+					t.ps = branches[k];
+					t.key = task.key;
+					if (m > 1) t.key.push(k);
+				}
+				omp_unset_lock(&self.lock);
+			}
+#pragma omp atomic
+			pending--;
+		}
+	}
+
+	std::vector<subopt_chunk> chunks;
+	for (int t = 0; t < nthreads; ++t)
+		chunks.insert(chunks.end(), workers[t].chunks.begin(), workers[t].chunks.end());
+	std::sort(chunks.begin(), chunks.end());
+
+	// text records are single lines which get their number here, binary ones are copied as they are
+	std::vector<char> buf(MAX(length + 64, 1 << 16));
+	int n = 0;
+	for (size_t k = 0; k < chunks.size(); ++k) {
+		FILE* spool = workers[chunks[k].worker].spool;
+		fseek(spool, chunks[k].offset, SEEK_SET);
+		if (writer.isBinary()) {
+			for (long left = chunks[k].bytes; left > 0; ) {
+				size_t m = fread(&buf[0], 1, MIN(left, (long)buf.size()), spool);
+				if (m == 0) {
+					perror("Cannot read subopt spool file");
+					exit(-1);
+				}
+				writer.append(&buf[0], m);
+				left -= m;
+			}
+			n += chunks[k].count;
+			continue;
+		}
+		for (int c = 0; c < chunks[k].count; ++c) {
+			if (fgets(&buf[0], buf.size(), spool) == NULL) {
+				perror("Cannot read subopt spool file");
+				exit(-1);
+			}
+			writer.writeEncoded(++n, &buf[0], strlen(&buf[0]));
+		}
 	}
 
+	for (int t = 0; t < nthreads; ++t) {
+		fclose(workers[t].spool);
+		omp_destroy_lock(&workers[t].lock);
+	}
+	return n;
+}
+#endif
+
+/*
+ * Best-first enumeration for --topk. Partial structures are queued by their lower bound
+ * ae_+le_, which never decreases along a branch, so structures come out in increasing
+ * energy order. Every queued partial structure completes to at least one structure at
+ * its bound, so only the best (topk - count) entries can still contribute: the queue is
+ * trimmed to that size, and delta shrinks to the worst entry kept, which prunes the
+ * children of later expansions before they are built.
+ */
+static int process_best_first(ps_t& first, SuboptWriter& writer, ss_map_t* subopt_data, int topk, int is_check_for_duplicates_enabled) {
+	typedef std::multimap<int, ps_t> ps_queue_t;
+	ps_queue_t queue;
+	ps_stack_t gstack;
+	int count = 0;
+
+	queue.insert(std::make_pair(first.total(), first));
+	while (!queue.empty()) {
+		ps_t ps = queue.begin()->second;
+		queue.erase(queue.begin());
+
+		if (ps.empty()) {
+			count++;
+			check_structure(writer, ps, subopt_data, is_check_for_duplicates_enabled);
+			writer.write(count, ps);
+			if (count >= topk) break;
+			continue;
+		}
+
+		expand_partial(ps, gstack);
+
+		while (!gstack.empty()) {
+			queue.insert(std::make_pair(gstack.top().total(), gstack.top()));
+			gstack.pop();
+		}
+
+		size_t need = topk - count;
+		while (queue.size() > need) queue.erase(--queue.end());
+		if (queue.size() == need) delta = MIN(delta, (--queue.end())->first - mfe);
+	}
+	return count;
+}
+
+int process(ss_map_t* subopt_data, int len, SuboptWriter& writer, int is_check_for_duplicates_enabled, int max_structure_count, int topk) {
+
+        int count = 0;
         ps_stack_t gstack;
 
 
         // initialize the partial structure, segment stack = {[1,n]}, label = W, list_bp = {} 
         ps_t first(0, len);
         first.push(segment(1, len, lW, W[len]));	
-        gstack.push(first); // initialize the partial structure stacka
+
+        if (topk > 0)
+                count = process_best_first(first, writer, subopt_data, topk, is_check_for_duplicates_enabled);
+#ifdef _OPENMP
+        else if (omp_get_max_threads() > 1 && max_structure_count <= 0)
+                count = process_parallel(first, writer, subopt_data, omp_get_max_threads(), is_check_for_duplicates_enabled);
+#endif
+        else
+                gstack.push(first); // initialize the partial structure stacka
 
         while (1) {
                 if (gstack.empty()) break; // exit
@@ -128,45 +429,25 @@ void process(ss_map_t& subopt_data, int len, string suboptFile, int is_check_for
 
                 if (ps.empty()) {
                         count++;
-			if(is_check_for_duplicates_enabled==1){
-				pair<ss_map_t::iterator, bool> ins_result;
-				ins_result = subopt_data.insert(std::make_pair<std::string,int>(ps.str,ps.ae_));
-				if (ins_result.second == false) {
-					printf("Duplicate Structure!!!");
-					exit(1);
-				}
-			}
-                        //cout << ps.str << endl;
-			sprintf(buff,"%d\t%s\t%6.2f", count, (ps.str).c_str(), (ps.ae_)/100.0);
-			outfile << buff << std::endl;
+			check_structure(writer, ps, subopt_data, is_check_for_duplicates_enabled);
+			writer.write(count, ps);
 			if(max_structure_count>0 && count>=max_structure_count) break;//exit
                         continue;
                 }	
                 else {
-                       segment smt = ps.top();
-                        ps.pop();
-
-                        gflag = 0;
-                        if (smt.j_ - smt.i_ > TURN) {
-                                (*trace_func[smt.label_])(smt.i_, smt.j_, ps, gstack);
-                        }
-
-                        // discarded current segment, using remaining ones
-                        if (!gflag) {
-                                ps_t ps1(ps);
-                                gstack.push(ps1);
-                        }
+                        expand_partial(ps, gstack);
                 }
         }
-        outfile.close();
         printf("Counts of structure generated=%d\n", count);
 
 #ifdef DEBUG 
         //printf("# SS = %d\n", count);
 #endif
+        return count;
 }
 
-ss_map_t subopt_traceback(int len, int _delta, string suboptFile, int is_check_for_duplicates_enabled, int max_structure_count) {
+// global state of the traceback, shared by subopt_traceback and SuboptCursor
+static void subopt_init(int len, int _delta) {
         trace_func[0] = traceW;
         trace_func[1] = traceV;
         trace_func[2] = traceVBI;
@@ -179,13 +460,470 @@ ss_map_t subopt_traceback(int len, int _delta, string suboptFile, int is_check_f
 	}
 
         mfe = W[len];
-        delta = _delta;
+        cand_generation++;
+        // a negative delta only comes with --topk, the queue bound then limits the search
+        delta = _delta < 0 ? INFINITY_/2 : _delta;
         length = len;
 
-        ss_map_t subopt_data;
-        process(subopt_data, len, suboptFile, is_check_for_duplicates_enabled, max_structure_count);
+	if( UNIQUE_MULTILOOP_DECOMPOSITION == 1){
+		create_fm_tables();
+	        calculate_fm1();
+        	calculate_fm();
+	}
+}
+
+static void release_cand_caches();
+
+static void subopt_done() {
+	if( UNIQUE_MULTILOOP_DECOMPOSITION == 1) free_fm_tables();
+	release_cand_caches();
+}
+
+int subopt_traceback(int len, int _delta, SuboptWriter& writer, int is_check_for_duplicates_enabled, int max_structure_count, int topk, ss_map_t* subopt_data) {
+        subopt_init(len, _delta);
+        int count = process(subopt_data, len, writer, is_check_for_duplicates_enabled, max_structure_count, topk);
+        subopt_done();
+        return count;
+}
+
+SuboptCursor::SuboptCursor(int len, int gap, subopt_filter_t filter1, void* data1) : filter(filter1), data(data1), pairing(len + 1, 0), applied_at(len + 1, -1) {
+        subopt_init(len, gap);
+        ps_t first(0, len);
+        first.push(segment(1, len, lW, W[len]));
+        gstack.push(first);
+}
+
+SuboptCursor::~SuboptCursor() {
+        subopt_done();
+}
+
+// Brings pairing from the structure of the previous call to ps. The pair lists are
+// immutable and shared, so ps agrees with applied up to its newest cell that is
+// already there, everything above that cell is undone.
+void SuboptCursor::sync(const ps_t& ps) {
+        std::vector<const ps_cell<ps_pair>*> fresh;
+        int keep = 0;
+        for (const ps_cell<ps_pair>* c = ps.pairs.begin(); c != NULL; c = c->next) {
+                int k = applied_at[c->val.i];
+                if (k >= 0 && applied[k] == c) {
+                        keep = k + 1;
+                        break;
+                }
+                fresh.push_back(c);
+        }
+
+        while ((int)applied.size() > keep) {
+                const ps_cell<ps_pair>* c = applied.back();
+                pairing[c->val.i] = pairing[c->val.j] = 0;
+                applied_at[c->val.i] = -1;
+                applied.pop_back();
+        }
+        for (int k = (int)fresh.size() - 1; k >= 0; --k) {
+                const ps_cell<ps_pair>* c = fresh[k];
+                pairing[c->val.i] = c->val.j;
+                pairing[c->val.j] = c->val.i;
+                applied_at[c->val.i] = applied.size();
+                applied.push_back(c);
+        }
+        held = ps.pairs;
+}
+
+bool SuboptCursor::next(ps_t& structure) {
+        while (!gstack.empty()) {
+                ps_t ps = gstack.top();
+                gstack.pop();
+
+                if (filter != NULL) {
+                        sync(ps);
+                        if (!filter(ps, &pairing[0], data)) continue;
+                }
+                if (ps.empty()) {
+                        sync(ps);
+                        structure = ps;
+                        return true;
+                }
+                expand_partial(ps, gstack);
+        }
+        return false;
+}
+
+int subopt_enumerate(int len, int gap, subopt_visit_t visit, void* data, subopt_filter_t filter) {
+        SuboptCursor cursor(len, gap, filter, data);
+        ps_t ps;
+        int count = 0;
+        while (cursor.next(ps)) {
+                count++;
+                if (!visit(ps, cursor.structure(), data)) break;
+        }
+        return count;
+}
+
+/*
+ * Density of states without enumeration. The decomposition the traceback walks in
+ * unique multiloop mode (W, V with its hairpin, stack and internal loop cases, FM and
+ * FM1) becomes a set of counting recurrences: for every segment, its vector holds the
+ * number of completions at each energy e above the segment's table value. A case with
+ * excess x over that value adds its children's vectors, convolved and shifted by x.
+ *
+ * A first pass from [1,n] down records the largest excess any parent can still leave
+ * a segment within delta, so only reachable cells are counted and every vector is
+ * only as long as its budget. Vectors are sparse, energies are mostly multiples of 10.
+ */
+typedef std::vector<std::pair<int, double> > dos_vec_t;
+
+struct dos_option
+{
+	int x;
+	int nseg;
+	int lbl[2];
+	int i[2];
+	int j[2];
+};
+
+static int *dos_need[3];
+static dos_vec_t *dos_vec[3];
+static int *dos_need_w;
+static dos_vec_t *dos_vec_w;
+static const dos_vec_t dos_unit(1, std::make_pair(0, 1.0));
+
+static inline int dos_slot(int lbl) {
+	return lbl == lV ? 0 : (lbl == lM ? 1 : 2);
+}
+
+static inline int dos_energy(int lbl, int i, int j) {
+	switch (lbl) {
+		case lV: return V(i,j);
+		case lM: return FM(i,j);
+		case lM1: return FM1(i,j);
+		default: return W[j];
+	}
+}
+
+static inline int& dos_need_ref(int lbl, int i, int j) {
+	return lbl == lW ? dos_need_w[j] : dos_need[dos_slot(lbl)][indx[j]+i];
+}
+
+// segments of at most TURN bases are dropped by the traceback, they add nothing
+static inline const dos_vec_t& dos_get(int lbl, int i, int j) {
+	if (j - i <= TURN) return dos_unit;
+	return lbl == lW ? dos_vec_w[j] : dos_vec[dos_slot(lbl)][indx[j]+i];
+}
 
-        return subopt_data;
+static inline void dos_add(std::vector<dos_option>& opts, int x, int budget, int nseg,
+		int l1 = 0, int i1 = 0, int j1 = 0, int l2 = 0, int i2 = 0, int j2 = 0) {
+	if (x > budget) return;
+	dos_option o = {x, nseg, {l1, l2}, {i1, i2}, {j1, j2}};
+	opts.push_back(o);
+}
+
+// the cases of traceV, traceVBI, traceM, traceM1 and traceW, with their excess over the segment
+static void dos_options(int lbl, int i, int j, int budget, std::vector<dos_option>& opts) {
+	int base = dos_energy(lbl, i, j);
+	opts.clear();
+	if (lbl == lV) {
+		dos_add(opts, eH(i,j) - base, budget, 0);
+		dos_add(opts, eS(i,j) + V(i+1,j-1) - base, budget, 1, lV, i+1, j-1);
+		for (int p = i+1; p <= MIN(j-2-TURN,i+MAXLOOP+1) ; p++) {
+			int minq = j-i+p-MAXLOOP-2;
+			if (minq < p+1+TURN) minq = p+1+TURN;
+			int maxq = (p==(i+1))?(j-2):(j-1);
+			for (int q = minq; q <= maxq; q++)
+				dos_add(opts, V(p,q) + eL(i,j,p,q) - base, budget, 1, lV, p, q);
+		}
+		int a = Ed5(i,j,i+1) + Ed3(i,j,j-1) + auPenalty(i,j) + Ea + Eb;
+		for (int k = i+2; k <= j-TURN-1; ++k)
+			dos_add(opts, FM(i+1,k) + FM1(k+1,j-1) + a - base, budget, 2, lM, i+1, k, lM1, k+1, j-1);
+	} else if (lbl == lM1) {
+		dos_add(opts, FM1(i,j-1) + Ec - base, budget, 1, lM1, i, j-1);
+		dos_add(opts, V(i,j) + Ed5_new(i,j,i-1) + Ed3_new(i,j,j+1) + auPenalty(i,j) + Eb - base, budget, 1, lV, i, j);
+	} else if (lbl == lM) {
+		dos_add(opts, FM(i,j-1) + Ec - base, budget, 1, lM, i, j-1);
+		dos_add(opts, V(i,j) + Ed5_new(i,j,i-1) + Ed3_new(i,j,j+1) + Eb + auPenalty(i,j) - base, budget, 1, lV, i, j);
+		for (int k = i+TURN+1; k <= j-TURN-1; ++k) {
+			int a = Ed5_new(k+1,j,k) + Ed3_new(k+1,j,j+1) + Eb + auPenalty(k+1,j);
+			dos_add(opts, FM(i,k) + V(k+1,j) + a - base, budget, 2, lM, i, k, lV, k+1, j);
+		}
+		for (int k = i; k <= j-TURN-1; ++k) {
+			int a = Ed5_new(k+1,j,k) + Ed3_new(k+1,j,j+1) + Eb + Ec*(k-i+1) + auPenalty(k+1,j);
+			dos_add(opts, V(k+1,j) + a - base, budget, 1, lV, k+1, j);
+		}
+	} else {
+		for (int l = i; l < j-TURN; ++l) {
+			int wim1 = MIN(0, W[l-1]);
+			int d3 = (l>i)?Ed3(j,l,l-1):0;
+			int d5 = (j<length)?Ed5(j,l,j+1):0;
+			int x = V(l,j) + auPenalty(l,j) + d3 + d5 + wim1 - base;
+			if (wim1 == W[l-1])
+				dos_add(opts, x, budget, 2, lV, l, j, lW, i, l-1);
+			else
+				dos_add(opts, x, budget, 1, lV, l, j);
+		}
+		dos_add(opts, W[j-1] - base, budget, 1, lW, i, j-1);
+	}
+}
+
+static void dos_propagate(int lbl, int i, int j, std::vector<dos_option>& opts) {
+	int need = dos_need_ref(lbl, i, j);
+	if (need < 0) return;
+	dos_options(lbl, i, j, need, opts);
+	for (size_t k = 0; k < opts.size(); ++k)
+		for (int s = 0; s < opts[k].nseg; ++s) {
+			if (opts[k].j[s] - opts[k].i[s] <= TURN) continue;
+			int& n = dos_need_ref(opts[k].lbl[s], opts[k].i[s], opts[k].j[s]);
+			n = MAX(n, need - opts[k].x);
+		}
+}
+
+static void dos_count(int lbl, int i, int j, std::vector<dos_option>& opts, std::vector<double>& c) {
+	int need = dos_need_ref(lbl, i, j);
+	if (need < 0) return;
+	dos_options(lbl, i, j, need, opts);
+	c.assign(need+1, 0.0);
+	for (size_t k = 0; k < opts.size(); ++k) {
+		const dos_option& o = opts[k];
+		int b = need - o.x;
+		if (o.nseg == 0) {
+			c[o.x] += 1;
+			continue;
+		}
+		const dos_vec_t& a = dos_get(o.lbl[0], o.i[0], o.j[0]);
+		if (o.nseg == 1) {
+			for (size_t e = 0; e < a.size() && a[e].first <= b; ++e)
+				c[o.x + a[e].first] += a[e].second;
+			continue;
+		}
+		const dos_vec_t& s = dos_get(o.lbl[1], o.i[1], o.j[1]);
+		for (size_t e1 = 0; e1 < a.size() && a[e1].first <= b; ++e1)
+			for (size_t e2 = 0; e2 < s.size() && a[e1].first + s[e2].first <= b; ++e2)
+				c[o.x + a[e1].first + s[e2].first] += a[e1].second * s[e2].second;
+	}
+	dos_vec_t& v = lbl == lW ? dos_vec_w[j] : dos_vec[dos_slot(lbl)][indx[j]+i];
+	for (int e = 0; e <= need; ++e)
+		if (c[e] != 0) v.push_back(std::make_pair(e, c[e]));
+}
+
+void subopt_dos(int len, int _delta, string dosFile) {
+	length = len;
+	mfe = W[len];
+	delta = _delta;
+
+	create_fm_tables();
+	calculate_fm1();
+	calculate_fm();
+
+	int ncells = (len+1)*len/2 + 1;
+	for (int t = 0; t < 3; ++t) {
+		dos_need[t] = new int[ncells];
+		std::fill(dos_need[t], dos_need[t] + ncells, -1);
+		dos_vec[t] = new dos_vec_t[ncells];
+	}
+	dos_need_w = new int[len+1];
+	std::fill(dos_need_w, dos_need_w + len+1, -1);
+	dos_vec_w = new dos_vec_t[len+1];
+
+	// parents before children: larger spans first, and W, FM and FM1 before V of the same span
+	std::vector<dos_option> opts;
+	dos_need_w[len] = delta;
+	for (int d = len-1; d > TURN; --d) {
+		dos_propagate(lW, 1, d+1, opts);
+		for (int i = 1; i + d <= len; ++i) {
+			dos_propagate(lM, i, i+d, opts);
+			dos_propagate(lM1, i, i+d, opts);
+			dos_propagate(lV, i, i+d, opts);
+		}
+	}
+
+	for (int d = TURN+1; d < len; ++d) {
+		int i;
+#ifdef _OPENMP
+#pragma omp parallel for private(i) firstprivate(opts) schedule(guided)
+#endif
+		for (i = 1; i <= len-d; ++i) {
+			std::vector<double> c;
+			dos_count(lV, i, i+d, opts, c);
+			dos_count(lM1, i, i+d, opts, c);
+			dos_count(lM, i, i+d, opts, c);
+		}
+		std::vector<double> c;
+		dos_count(lW, 1, d+1, opts, c);
+	}
+
+	// 0.1 kcal/mol bins above the MFE
+	const dos_vec_t& dos = len-1 > TURN ? dos_vec_w[len] : dos_unit;
+	std::vector<double> bins(delta/10 + 1, 0.0);
+	for (size_t e = 0; e < dos.size(); ++e)
+		bins[dos[e].first/10] += dos[e].second;
+
+	ofstream outfile;
+	outfile.open(dosFile.c_str(), ios::out | ios::app);
+	char buff[256];
+	double total = 0;
+	for (size_t b = 0; b < bins.size(); ++b) {
+		total += bins[b];
+		sprintf(buff, "%6.2f\t%6.2f\t%.0f\t%.0f", (mfe + 10*(int)b)/100.0, (mfe + 10*(int)(b+1))/100.0, bins[b], total);
+		outfile << buff << std::endl;
+	}
+	outfile.close();
+	printf("Structures within %.2f kcal/mol of MFE: %.0f\n", delta/100.0, total);
+
+	for (int t = 0; t < 3; ++t) {
+		delete[] dos_need[t];
+		delete[] dos_vec[t];
+	}
+	delete[] dos_need_w;
+	delete[] dos_vec_w;
+	free_fm_tables();
+}
+
+/*
+ * Decomposition candidates of the loops in traceVBI, traceV, traceM, traceW and
+ * traceWMPrime, sorted by energy. A cell is visited again by every partial structure
+ * that reaches it, so its list is built once and kept in a per-thread LRU of at most
+ * CAND_CACHE_SIZE candidates. A visit reads only the prefix within the remaining delta
+ * and pushes it in loop order, so structures still come out in the same order. The
+ * caches of all threads are emptied when the traceback returns, the threads of the
+ * OpenMP team live on in batch workers and gtfoldd.
+ */
+enum cand_kind {cVBI = 0, cMulti, cM, cW, cWMPrime};
+
+struct trace_cand
+{
+	int en;  // energy of the decomposition, without the rest of the partial structure
+	int ord; // position in the loop order of the trace function
+	int a;
+	int b;
+};
+
+static const size_t CAND_CACHE_SIZE = 1 << 21;
+
+static inline bool cand_en_less(const trace_cand& x, const trace_cand& y) {
+	return x.en < y.en;
+}
+
+static inline bool cand_ord_less(const trace_cand& x, const trace_cand& y) {
+	return x.ord < y.ord;
+}
+
+static inline void add_cand(std::vector<trace_cand>& c, int en, int ord, int a, int b) {
+	if (en >= INFINITY_/2) return; // out of reach of any delta
+	trace_cand t = {en, ord, a, b};
+	c.push_back(t);
+}
+
+static void build_candidates(int kind, int i, int j, std::vector<trace_cand>& c) {
+	int ord = 0;
+	c.clear();
+	if (kind == cVBI) {
+		for (int p = i+1; p <= MIN(j-2-TURN,i+MAXLOOP+1) ; p++) {
+			int minq = j-i+p-MAXLOOP-2;
+			if (minq < p+1+TURN) minq = p+1+TURN;
+			int maxq = (p==(i+1))?(j-2):(j-1);
+			for (int q = minq; q <= maxq; q++)
+				add_cand(c, V(p, q) + eL(i, j, p, q), ord++, p, q);
+		}
+	} else if (kind == cMulti) {
+		int kenergy2 = Ed5(i, j, i+1) + Ed3(i, j, j-1) + auPenalty(i,j) + Ea + Eb;
+		for (int k = i+2; k <= j-TURN-1; ++k)
+			add_cand(c, FM(i+1,k) + FM1(k+1,j-1) + kenergy2, ord++, k, 0);
+	} else if (kind == cM) {
+		for (int k = i+TURN+1; k <= j-TURN-1; ++k)
+			add_cand(c, FM(i,k) + V(k+1,j) + Ed5_new(k+1, j, k) + Ed3_new(k+1, j, j+1) + Eb + auPenalty(k+1, j), ord++, k, 1);
+		for (int k = i; k <= j-TURN-1; ++k)
+			add_cand(c, V(k+1,j) + Ed5_new(k+1, j, k) + Ed3_new(k+1, j, j+1) + Eb + Ec*(k-i+1) + auPenalty(k+1, j), ord++, k, 2);
+	} else if (kind == cW) {
+		for (int l = i; l < j-TURN; ++l) {
+			int d3 = (l>i)?Ed3(j,l,l-1):0;
+			int d5 = (j<length)?Ed5(j,l,j+1):0;
+			add_cand(c, V(l,j) + auPenalty(l, j) + d3 + d5 + MIN(0, W[l-1]), ord++, l, 0);
+		}
+	} else {
+		for (int h = i+TURN+1 ; h <= j-TURN-2; h++)
+			add_cand(c, WM(i,h-1) + WM(h,j), ord++, h, 0);
+	}
+	std::sort(c.begin(), c.end(), cand_en_less);
+}
+
+class cand_cache;
+static std::vector<cand_cache*> cand_caches; // of every thread, for release_cand_caches()
+static std::mutex cand_caches_lock;
+
+class cand_cache
+{
+	public:
+		cand_cache() : total(0), generation(-1)
+		{
+			std::lock_guard<std::mutex> lk(cand_caches_lock);
+			cand_caches.push_back(this);
+		}
+
+		~cand_cache()
+		{
+			std::lock_guard<std::mutex> lk(cand_caches_lock);
+			cand_caches.erase(std::find(cand_caches.begin(), cand_caches.end(), this));
+		}
+
+		// frees the candidates, not to be called while the thread uses the cache
+		void release()
+		{
+			lru.clear();
+			std::unordered_map<long long, std::list<entry>::iterator>().swap(index);
+			total = 0;
+			generation = -1;
+		}
+
+		const std::vector<trace_cand>& get(int kind, int i, int j)
+		{
+			if (generation != cand_generation) {
+				lru.clear();
+				index.clear();
+				total = 0;
+				generation = cand_generation;
+			}
+			long long key = ((long long)kind*(length+1) + i)*(length+1) + j;
+			std::unordered_map<long long, std::list<entry>::iterator>::iterator it = index.find(key);
+			if (it != index.end()) {
+				lru.splice(lru.begin(), lru, it->second);
+				return it->second->c;
+			}
+			lru.push_front(entry());
+			lru.front().key = key;
+			build_candidates(kind, i, j, lru.front().c);
+			total += lru.front().c.size();
+			index[key] = lru.begin();
+			while (total > CAND_CACHE_SIZE && lru.size() > 1) {
+				total -= lru.back().c.size();
+				index.erase(lru.back().key);
+				lru.pop_back();
+			}
+			return lru.front().c;
+		}
+
+	private:
+		struct entry
+		{
+			long long key;
+			std::vector<trace_cand> c;
+		};
+		std::list<entry> lru;
+		std::unordered_map<long long, std::list<entry>::iterator> index;
+		size_t total;
+		int generation;
+};
+
+static void release_cand_caches() {
+	std::lock_guard<std::mutex> lk(cand_caches_lock);
+	for (size_t k = 0; k < cand_caches.size(); ++k)
+		cand_caches[k]->release();
+}
+
+// candidates of kind at (i,j) with energy at most limit, in loop order
+static void select_candidates(int kind, int i, int j, int limit, std::vector<trace_cand>& sel) {
+	static thread_local cand_cache cache;
+	const std::vector<trace_cand>& c = cache.get(kind, i, j);
+	sel.clear();
+	for (size_t k = 0; k < c.size() && c[k].en <= limit; ++k)
+		sel.push_back(c[k]);
+	if (sel.size() > 1) std::sort(sel.begin(), sel.end(), cand_ord_less);
 }
 
 void traceV(int i, int j, ps_t& ps, ps_stack_t& gstack) {
@@ -213,24 +951,21 @@ void traceV(int i, int j, ps_t& ps, ps_stack_t& gstack) {
         }
 
 	if( UNIQUE_MULTILOOP_DECOMPOSITION == 1){
-		int k;
-
-		for (k = i+2; k <= j-TURN-1; ++k) {
-
-			int kenergy1 = FM[i+1][k] + FM1[k+1][j-1];
-			int d5 = Ed5(i, j, i+1);
-			int d3 = Ed3(i, j, j-1);
-			int aup = auPenalty(i,j);
-			int kenergy2 = d5 + d3 + aup + Ea + Eb;
-			int kenergy_total = kenergy1 + kenergy2;
-			if (kenergy_total + ps.total() <= mfe + delta) {
-				ps_t ps1(ps);
-				ps1.push(segment(i+1,k, lM, FM[i+1][k]));
-				ps1.push(segment(k+1,j-1, lM1, FM1[k+1][j-1]));
-				ps1.accumulate(kenergy2);
-				ps1.update(i,j,'(',')');
-				push_to_gstack(gstack, ps1);
-			}
+		static thread_local std::vector<trace_cand> sel;
+		int d5 = Ed5(i, j, i+1);
+		int d3 = Ed3(i, j, j-1);
+		int aup = auPenalty(i,j);
+		int kenergy2 = d5 + d3 + aup + Ea + Eb;
+
+		select_candidates(cMulti, i, j, mfe + delta - ps.total(), sel);
+		for (size_t c = 0; c < sel.size(); ++c) {
+			int k = sel[c].a;
+			ps_t ps1(ps);
+			ps1.push(segment(i+1,k, lM, FM(i+1,k)));
+			ps1.push(segment(k+1,j-1, lM1, FM1(k+1,j-1)));
+			ps1.accumulate(kenergy2);
+			ps1.update(i,j,'(',')');
+			push_to_gstack(gstack, ps1);
 		}
 	}
 	else{
@@ -247,39 +982,35 @@ void traceV(int i, int j, ps_t& ps, ps_stack_t& gstack) {
 }
 
 void traceVBI(int i, int j, ps_t& ps, ps_stack_t& gstack) {
-        int p,q;
-
-        for (p = i+1; p <= MIN(j-2-TURN,i+MAXLOOP+1) ; p++) {
-                int minq = j-i+p-MAXLOOP-2;
-                if (minq < p+1+TURN) minq = p+1+TURN;
-                int maxq = (p==(i+1))?(j-2):(j-1);
-                for (q = minq; q <= maxq; q++) {
-                        if (V(p, q) + eL(i, j, p, q) + ps.total() <= mfe + delta) {
-                                ps_t ps1(ps);
-                                ps1.push(segment(p, q, lV, V(p, q)));
-                                ps1.update(i, j , '(', ')');
-                                ps1.accumulate(eL(i, j, p, q));
-                                push_to_gstack(gstack, ps1);
-                        }
-                }
+        static thread_local std::vector<trace_cand> sel;
+
+        select_candidates(cVBI, i, j, mfe + delta - ps.total(), sel);
+        for (size_t c = 0; c < sel.size(); ++c) {
+                int p = sel[c].a;
+                int q = sel[c].b;
+                ps_t ps1(ps);
+                ps1.push(segment(p, q, lV, V(p, q)));
+                ps1.update(i, j , '(', ')');
+                ps1.accumulate(eL(i, j, p, q));
+                push_to_gstack(gstack, ps1);
         }
 }
 
 void traceW(int i, int j, ps_t& ps, ps_stack_t& gstack) {
+        static thread_local std::vector<trace_cand> sel;
 
-        for (int l = i; l < j-TURN; ++l) {
+        select_candidates(cW, i, j, mfe + delta - ps.total(), sel);
+        for (size_t c = 0; c < sel.size(); ++c) {
+                int l = sel[c].a;
                 int wim1 =  MIN(0, W[l-1]);
                 int d3 = (l>i)?Ed3(j,l,l-1):0;
                 int d5 = (j<length)?Ed5(j,l,j+1):0;
 
-                int Wij = V(l,j) + auPenalty(l, j) + d3 + d5 + wim1;
-                if (Wij + ps.total() <= mfe + delta ) {
-                        ps_t ps1(ps);
-                        ps1.push(segment(l, j, lV, V(l,j)));
-                        if (wim1 == W[l-1]) ps1.push(segment(i, l-1, lW, W[l-1]));
-                        ps1.accumulate(auPenalty(l, j) + d3 + d5);
-                        push_to_gstack(gstack, ps1);
-                }
+                ps_t ps1(ps);
+                ps1.push(segment(l, j, lV, V(l,j)));
+                if (wim1 == W[l-1]) ps1.push(segment(i, l-1, lW, W[l-1]));
+                ps1.accumulate(auPenalty(l, j) + d3 + d5);
+                push_to_gstack(gstack, ps1);
         }
 
         if (W[j-1] + ps.total() <= mfe + delta) {
@@ -292,9 +1023,9 @@ void traceW(int i, int j, ps_t& ps, ps_stack_t& gstack) {
 //#ifdef UNIQUE_MULTILOOP_DECOMPOSITION
 void traceM1(int i, int j, ps_t& ps, ps_stack_t& gstack) {
 
-  if (FM1[i][j-1] + Ec + ps.total() <= mfe + delta) {
+  if (FM1(i,j-1) + Ec + ps.total() <= mfe + delta) {
     ps_t ps1(ps);
-    ps1.push(segment(i, j-1, lM1, FM1[i][j-1]));
+    ps1.push(segment(i, j-1, lM1, FM1(i,j-1)));
     ps1.accumulate(Ec);
     push_to_gstack(gstack, ps1);
   }
@@ -322,9 +1053,9 @@ void traceM(int i, int j, ps_t& ps, ps_stack_t& gstack) {
   int d5, d3;
   int aup;
 
-  if (FM[i][j-1] + Ec + ps.total() <= mfe + delta) {
+  if (FM(i,j-1) + Ec + ps.total() <= mfe + delta) {
     ps_t ps1(ps);
-    ps1.push(segment(i, j-1, lM, FM[i][j-1]));
+    ps1.push(segment(i, j-1, lM, FM(i,j-1)));
     ps1.accumulate(Ec);
     push_to_gstack(gstack, ps1);
   }
@@ -343,37 +1074,27 @@ void traceM(int i, int j, ps_t& ps, ps_stack_t& gstack) {
   }
 
 
-  for (int k = i+TURN+1; k <= j-TURN-1; ++k) {
+  // the splits with a branch (k+1,j) after FM(i,k), then those after unpaired bases i..k
+  static thread_local std::vector<trace_cand> sel;
+  select_candidates(cM, i, j, mfe + delta - ps.total(), sel);
+  for (size_t c = 0; c < sel.size(); ++c) {
+    int k = sel[c].a;
 
     d5 = Ed5_new(k+1, j, k);
     d3 = Ed3_new(k+1, j, j+1);
     aup = auPenalty(k+1, j);
 
-    if (FM[i][k] + V(k+1,j) + d5 + d3
-         + Eb + aup + ps.total() <= mfe + delta) {
-      ps_t ps1(ps);
-      ps1.push(segment(i, k, lM, FM[i][k]));
+    ps_t ps1(ps);
+    if (sel[c].b == 1) {
+      ps1.push(segment(i, k, lM, FM(i,k)));
       ps1.push(segment(k+1, j, lV, V(k+1,j)));
       ps1.accumulate(d5 + d3 + Eb + aup);
-      ps1.update(k+1,j,'(',')');
-      push_to_gstack(gstack, ps1);
-    }
-  }
-
-  for (int k = i; k <= j-TURN-1; ++k) {
-
-    d5 = Ed5_new(k+1, j, k);
-    d3 = Ed3_new(k+1, j, j+1);
-    aup = auPenalty(k+1, j);
-
-    if (V(k+1,j) + d5 + d3
-         + Eb + Ec*(k-i+1) + aup + ps.total() <= mfe+delta) {
-      ps_t ps1(ps);
+    } else {
       ps1.push(segment(k+1, j, lV, V(k+1,j)));
       ps1.accumulate(d5 + d3 + Eb + Ec*(k-i+1) + aup);
-      ps1.update(k+1, j, '(', ')');
-      push_to_gstack(gstack, ps1);
     }
+    ps1.update(k+1, j, '(', ')');
+    push_to_gstack(gstack, ps1);
   }
 }
 
@@ -412,13 +1133,15 @@ void traceWM(int i, int j, ps_t& ps, ps_stack_t& gstack) {
 }
 
 void traceWMPrime(int i, int j, ps_t& ps, ps_stack_t& gstack) {
-        for (int h = i+TURN+1 ; h <= j-TURN-2; h++) {
-                if (WM(i,h-1) + WM(h,j) + ps.total() <= mfe + delta) {
-                        ps_t ps_new(ps);
-                        ps_new.push(segment(i,h-1, lWM, WM(i,h-1)));
-                        ps_new.push(segment(h,j, lWM, WM(h,j)));
-                        push_to_gstack(gstack, ps_new);
-                }
+        static thread_local std::vector<trace_cand> sel;
+
+        select_candidates(cWMPrime, i, j, mfe + delta - ps.total(), sel);
+        for (size_t c = 0; c < sel.size(); ++c) {
+                int h = sel[c].a;
+                ps_t ps_new(ps);
+                ps_new.push(segment(i,h-1, lWM, WM(i,h-1)));
+                ps_new.push(segment(h,j, lWM, WM(h,j)));
+                push_to_gstack(gstack, ps_new);
         }
 }
 
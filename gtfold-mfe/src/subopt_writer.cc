@@ -0,0 +1,329 @@
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "subopt_writer.h"
+
+using namespace std;
+
+static const char SUBOPT_MAGIC[4] = {'G','T','S','S'};
+
+static void put_u32(std::string& buf, unsigned int v)
+{
+	for (int k = 0; k < 4; ++k) buf.push_back((char)((v >> (8*k)) & 0xff));
+}
+
+static void put_varint(std::string& buf, unsigned int v)
+{
+	while (v >= 0x80) {
+		buf.push_back((char)((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((char)v);
+}
+
+// pairs of a partial structure, ordered by their 5' base, in a per-thread buffer
+static const std::vector<std::pair<int,int> >& sorted_pairs(const pstruct& ps)
+{
+	static thread_local std::vector<std::pair<int,int> > pairs;
+	pairs.clear();
+	for (const ps_cell<ps_pair>* c = ps.pairs.begin(); c != NULL; c = c->next)
+		pairs.push_back(std::make_pair(c->val.i, c->val.j));
+	std::sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+static inline unsigned long long mix64(unsigned long long h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+SuboptWriter::SuboptWriter() : outfile(NULL), binary(false), has_pending(false), stop(false), table_used(0) {}
+
+SuboptWriter::~SuboptWriter()
+{
+	if (outfile != NULL) close();
+}
+
+void SuboptWriter::open(std::string fileName1, std::string seq, int mfe, bool binary1)
+{
+	fileName = fileName1;
+	binary = binary1;
+	outfile = fopen(fileName.c_str(), binary ? "wb" : "w");
+	if (outfile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+
+	if (binary) {
+		cur.assign(SUBOPT_MAGIC, 4);
+		put_u32(cur, SUBOPT_BINARY_VERSION);
+		put_u32(cur, seq.length());
+		put_u32(cur, (unsigned int)mfe);
+		cur += seq;
+	} else {
+		char buff[64];
+		sprintf(buff, "\t%6.2f\n", mfe/100.0);
+		cur = "count\t" + seq + buff;
+	}
+
+	table.clear();
+	table_used = 0;
+	has_pending = false;
+	stop = false;
+	flusher = std::thread(&SuboptWriter::flush_loop, this);
+}
+
+void SuboptWriter::encode(const pstruct& ps, std::string& rec) const
+{
+	if (binary) {
+		const std::vector<std::pair<int,int> >& pairs = sorted_pairs(ps);
+		put_u32(rec, (unsigned int)ps.ae_);
+		put_varint(rec, pairs.size());
+		int prev = 0;
+		for (size_t k = 0; k < pairs.size(); ++k) {
+			put_varint(rec, pairs[k].first - prev);
+			put_varint(rec, pairs[k].second - pairs[k].first);
+			prev = pairs[k].first;
+		}
+	} else {
+		char buff[64];
+		sprintf(buff, "\t%6.2f\n", (ps.ae_)/100.0);
+		rec += ps.str();
+		rec += buff;
+	}
+}
+
+void SuboptWriter::write(int count, const pstruct& ps)
+{
+	scratch.clear();
+	encode(ps, scratch);
+	writeEncoded(count, scratch.data(), scratch.size());
+}
+
+void SuboptWriter::writeEncoded(int count, const char* rec, size_t n)
+{
+	if (!binary) {
+		char buff[32];
+		int len = sprintf(buff, "%d\t", count);
+		cur.append(buff, len);
+	}
+	append(rec, n);
+}
+
+void SuboptWriter::append(const char* data, size_t n)
+{
+	cur.append(data, n);
+	if (cur.size() >= FLUSH_SIZE) handoff();
+}
+
+// hands the filled buffer to the flush thread, once it is done with the previous one
+void SuboptWriter::handoff()
+{
+	std::unique_lock<std::mutex> lk(lock);
+	cv.wait(lk, [this]{ return !has_pending; });
+	pending.swap(cur);
+	has_pending = true;
+	cv.notify_all();
+	lk.unlock();
+	cur.clear();
+}
+
+void SuboptWriter::flush_loop()
+{
+	std::unique_lock<std::mutex> lk(lock);
+	while (1) {
+		cv.wait(lk, [this]{ return has_pending || stop; });
+		if (has_pending) {
+			lk.unlock();
+			if (fwrite(pending.data(), 1, pending.size(), outfile) != pending.size()) {
+				cerr<<"Error in writing file: "<<fileName<<endl;
+				exit(-1);
+			}
+			lk.lock();
+			has_pending = false;
+			cv.notify_all();
+		} else {
+			break;
+		}
+	}
+}
+
+void SuboptWriter::close()
+{
+	handoff();
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		cv.wait(lk, [this]{ return !has_pending; });
+		stop = true;
+		cv.notify_all();
+	}
+	flusher.join();
+	fclose(outfile);
+	outfile = NULL;
+	std::vector<subopt_fingerprint>().swap(table);
+}
+
+bool SuboptWriter::seen(const pstruct& ps)
+{
+	const std::vector<std::pair<int,int> >& pairs = sorted_pairs(ps);
+	subopt_fingerprint f = {0x9e3779b97f4a7c15ULL, 0x6a09e667f3bcc909ULL};
+	for (size_t k = 0; k < pairs.size(); ++k) {
+		unsigned long long v = ((unsigned long long)pairs[k].first << 32) | (unsigned int)pairs[k].second;
+		f.hi = mix64(f.hi ^ v) + k;
+		f.lo = mix64(f.lo + v * 0x9e3779b97f4a7c15ULL) ^ f.hi;
+	}
+	f.lo |= 1; // zero marks an empty slot
+
+	if (table.empty()) table.assign(1 << 16, subopt_fingerprint());
+	if (4*(table_used+1) > 3*table.size()) grow_table();
+	size_t mask = table.size() - 1;
+	for (size_t h = f.hi & mask; ; h = (h+1) & mask) {
+		if (table[h].lo == 0) {
+			table[h] = f;
+			table_used++;
+			return false;
+		}
+		if (table[h].lo == f.lo && table[h].hi == f.hi) return true;
+	}
+}
+
+void SuboptWriter::grow_table()
+{
+	std::vector<subopt_fingerprint> old(2*table.size(), subopt_fingerprint());
+	old.swap(table);
+	size_t mask = table.size() - 1;
+	for (size_t k = 0; k < old.size(); ++k) {
+		if (old[k].lo == 0) continue;
+		size_t h = old[k].hi & mask;
+		while (table[h].lo != 0) h = (h+1) & mask;
+		table[h] = old[k];
+	}
+}
+
+SuboptReader::SuboptReader() : infile(NULL), mfe_(0) {}
+
+SuboptReader::~SuboptReader()
+{
+	if (infile != NULL) close();
+}
+
+void SuboptReader::truncated()
+{
+	cerr<<"Truncated subopt file: "<<fileName<<endl;
+	exit(-1);
+}
+
+unsigned int SuboptReader::get_u32()
+{
+	unsigned char b[4];
+	if (fread(b, 1, 4, infile) != 4) truncated();
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+}
+
+// false at the end of the file
+bool SuboptReader::get_varint(unsigned int& v)
+{
+	v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		int c = getc(infile);
+		if (c == EOF) {
+			if (shift > 0) truncated();
+			return false;
+		}
+		v |= (unsigned int)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	truncated();
+	return false;
+}
+
+void SuboptReader::open(std::string fileName1)
+{
+	char magic[4];
+	fileName = fileName1;
+	infile = fopen(fileName.c_str(), "rb");
+	if (infile == NULL) {
+		cerr<<"Error in opening file: "<<fileName<<endl;
+		exit(-1);
+	}
+	if (fread(magic, 1, 4, infile) != 4 || memcmp(magic, SUBOPT_MAGIC, 4) != 0) {
+		cerr<<"Not a binary subopt file: "<<fileName<<endl;
+		exit(-1);
+	}
+	unsigned int version = get_u32();
+	if (version != SUBOPT_BINARY_VERSION) {
+		cerr<<"Unsupported binary subopt file version "<<version<<": "<<fileName<<endl;
+		exit(-1);
+	}
+	unsigned int length = get_u32();
+	mfe_ = (int)get_u32();
+	seq.resize(length);
+	if (length > 0 && fread(&seq[0], 1, length, infile) != length) truncated();
+}
+
+void SuboptReader::close()
+{
+	fclose(infile);
+	infile = NULL;
+}
+
+bool SuboptReader::next(int* structure, int& energy)
+{
+	unsigned char b[4];
+	size_t n = fread(b, 1, 4, infile);
+	if (n == 0) return false;
+	if (n != 4) truncated();
+	energy = (int)(b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24));
+
+	int len = seq.length();
+	unsigned int npairs, di, dj;
+	int i = 0;
+	for (int k = 0; k <= len; ++k) structure[k] = 0;
+	if (!get_varint(npairs)) truncated();
+	for (unsigned int k = 0; k < npairs; ++k) {
+		if (!get_varint(di) || !get_varint(dj)) truncated();
+		i += di;
+		int j = i + dj;
+		if (i < 1 || j > len || j <= i) {
+			cerr<<"Invalid pair in subopt file: "<<fileName<<endl;
+			exit(-1);
+		}
+		structure[i] = j;
+		structure[j] = i;
+	}
+	return true;
+}
+
+int subopt_binary_export(std::string binFile, std::string outFile)
+{
+	SuboptReader reader;
+	reader.open(binFile);
+	const std::string& seq = reader.sequence();
+	int len = seq.length();
+
+	FILE* outfile = fopen(outFile.c_str(), "w");
+	if (outfile == NULL) {
+		cerr<<"Error in opening file: "<<outFile<<endl;
+		exit(-1);
+	}
+	fprintf(outfile, "count\t%s\t%6.2f\n", seq.c_str(), reader.mfe()/100.0);
+
+	std::vector<int> structure(len+1);
+	std::string db(len, '.');
+	int energy, count = 0;
+	while (reader.next(&structure[0], energy)) {
+		for (int i = 1; i <= len; ++i)
+			db[i-1] = structure[i] == 0 ? '.' : structure[i] > i ? '(' : ')';
+		fprintf(outfile, "%d\t%s\t%6.2f\n", ++count, db.c_str(), energy/100.0);
+	}
+	fclose(outfile);
+	return count;
+}
@@ -49,6 +49,7 @@ void trace(int len, int print_energy_decompose1, const char* energy_decompose_ou
 	
 	int i;
 	for (i = 0; i <= len; i++) structure[i] = 0;
+	total_en = total_ex = 0;
 
 	length = len;
 	if (W[len] >= MAXENG) {
@@ -0,0 +1,57 @@
+#!/usr/bin/perl
+package CompareParams;
+use strict;
+use warnings;
+
+# gtmfe --compare default,Turner99,RNAParams must save the structures of separate runs
+# without -p and with -p for each directory. Every set is saved under the last component
+# of its path, a repeated name gets a -2 suffix, and default is the built-in Turner99.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $datadir = $Config{"L_COMPAREPARAMS_DATA_DIR"};
+
+  if (not(defined($datadir))) {
+    $datadir = "$gtdir/../data/";
+  }
+
+  my %sets = ("Turner99" => "", "Turner99-2" => "-p $datadir/Turner99", "RNAParams" => "-p $datadir/RNAParams");
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $compareout = "$seqname-compare";
+
+    my $result = system("$gtdir/gtmfe --compare default,$datadir/Turner99,$datadir/RNAParams -w $workdir -o $compareout $seqfile > /dev/null 2>&1");
+    if ($result != 0) {
+      $logger->error("TEST FAILED: $seqname: gtmfe --compare did not run");
+      next;
+    }
+
+    my $ok = 1;
+    foreach my $set (sort(keys(%sets))) {
+      my $singleout = "$seqname-$set";
+      system("$gtdir/gtmfe $sets{$set} -w $workdir -o $singleout $seqfile > /dev/null 2>&1");
+      if (system("cmp -s $workdir$compareout\_$set.ct $workdir$singleout.ct") != 0) {
+        $logger->error("TEST FAILED: $seqname: $workdir$compareout\_$set.ct differs from the gtmfe $sets{$set} run");
+        $ok = 0;
+      }
+    }
+
+    if ($ok) {
+      $logger->info("TEST PASSED: $seqname: --compare matches separate -p runs");
+    }
+  }
+}
+1;
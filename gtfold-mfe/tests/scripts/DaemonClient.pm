@@ -0,0 +1,167 @@
+#!/usr/bin/perl
+package DaemonClient;
+use strict;
+use warnings;
+use POSIX ":sys_wait_h";
+
+# workers of gtfoldd, the children of its process
+sub workers
+{
+  my($pid) = @_;
+  my @pids = grep { /\d/ } split(/\s+/, `ps -o pid= --ppid $pid`);
+  return @pids;
+}
+
+# Starts gtfoldd on a socket in the work directory and runs gtmfe command lines through
+# gtfold-client. The structures must be the ones of direct gtmfe runs, command lines that
+# differ only in the sequence file must share one worker, the exit status of a failed run
+# must reach the client, and a client that goes away must not leave its run behind.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $longlen = $Config{"L_DAEMONCLIENT_LONG_LENGTH"};
+
+  if (not(defined($longlen))) {
+    $longlen = 3000;
+  }
+
+  my $sock = "$workdir" . "gtfoldd-test.sock";
+  my $clientdir = "$workdir" . "daemon-client/";
+  my $directdir = "$workdir" . "daemon-direct/";
+  mkdir($clientdir);
+  mkdir($directdir);
+  unlink($sock);
+
+  my $daemon = fork();
+  if ($daemon == 0) {
+    open(STDOUT, ">$workdir" . "gtfoldd.log");
+    open(STDERR, ">&STDOUT");
+    exec("$gtdir/gtfoldd", "--socket", $sock, "--workers", "2");
+    exit(127);
+  }
+  for (my $k = 0; $k < 100 && ! -S $sock; $k++) {
+    select(undef, undef, undef, 0.1);
+  }
+  if (! -S $sock) {
+    $logger->error("TEST FAILED: gtfoldd did not listen on $sock");
+    kill('TERM', $daemon);
+    waitpid($daemon, 0);
+    return;
+  }
+
+  my $client = "$gtdir/gtfold-client --socket $sock";
+  my $ok = 1;
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+    my $seqname = $key;
+    my $seqfile = $value;
+
+    my $result = system("$client gtmfe -w $clientdir $seqfile > /dev/null 2>&1");
+    system("$gtdir/gtmfe -w $directdir $seqfile > /dev/null 2>&1");
+    if ($result != 0) {
+      $logger->error("TEST FAILED: $seqname: gtfold-client gtmfe exited with " . ($result >> 8));
+      $ok = 0;
+    }
+    elsif (system("cmp -s $clientdir$seqname.ct $directdir$seqname.ct") != 0) {
+      $logger->error("TEST FAILED: $seqname: $clientdir$seqname.ct differs from the direct gtmfe run");
+      $ok = 0;
+    }
+    else {
+      $logger->info("TEST PASSED: $seqname: gtfold-client gtmfe matches gtmfe");
+    }
+  }
+
+  # every command line above differs only in the sequence file
+  my @workers = workers($daemon);
+  if (scalar(@workers) != 1) {
+    $logger->error("TEST FAILED: gtfoldd runs " . scalar(@workers) . " workers for one set of options");
+    $ok = 0;
+  }
+
+  # a failed run, and a tool gtfoldd does not run
+  my $missing = "$workdir" . "daemon-missing.seq";
+  my $direct = system("$gtdir/gtmfe -w $directdir $missing > /dev/null 2>&1") >> 8;
+  my $relayed = system("$client gtmfe -w $clientdir $missing > /dev/null 2>&1") >> 8;
+  if ($direct == 0 || $relayed != $direct) {
+    $logger->error("TEST FAILED: gtfold-client exited with $relayed for a missing sequence file, gtmfe with $direct");
+    $ok = 0;
+  }
+  if ((system("$client gtsubopt --delta 1 $missing > /dev/null 2>&1") >> 8) == 0) {
+    $logger->error("TEST FAILED: gtfold-client gtsubopt did not fail");
+    $ok = 0;
+  }
+
+  # a client killed during a long fold, its worker must be stopped
+  my $longseq = "$workdir" . "daemon-long.seq";
+  srand($longlen);
+  open(LONG, ">$longseq") or die("Cannot write $longseq");
+  for (my $i = 0; $i < $longlen; $i++) {
+    print LONG (("A", "C", "G", "U")[int(rand(4))]);
+  }
+  print LONG ("\n");
+  close(LONG);
+
+  my %before = map { $_ => 1 } workers($daemon);
+  my $long = fork();
+  if ($long == 0) {
+    open(STDOUT, ">/dev/null");
+    open(STDERR, ">&STDOUT");
+    exec("$gtdir/gtfold-client", "--socket", $sock, "gtmfe", "-d", "2", "-w", $clientdir, $longseq);
+    exit(127);
+  }
+  my @running = ();
+  for (my $k = 0; $k < 50 && scalar(@running) == 0; $k++) {
+    select(undef, undef, undef, 0.1);
+    @running = grep { !$before{$_} } workers($daemon);
+  }
+  kill('KILL', $long);
+  waitpid($long, 0);
+  if (scalar(@running) == 0) {
+    $logger->error("TEST FAILED: gtfoldd did not start a worker for the long fold");
+    $ok = 0;
+  }
+  else {
+    # far less than the fold takes
+    my $gone = 0;
+    for (my $k = 0; $k < 30 && !$gone; $k++) {
+      select(undef, undef, undef, 0.1);
+      $gone = !grep { $_ == $running[0] } workers($daemon);
+    }
+    if (!$gone) {
+      $logger->error("TEST FAILED: the worker of a client that went away is still running");
+      $ok = 0;
+    }
+  }
+
+  # gtfoldd still serves requests afterwards
+  my ($seqname) = sort(keys(%local_sequences));
+  if (defined($seqname)) {
+    unlink("$clientdir$seqname.ct");
+    if (system("$client gtmfe -w $clientdir $local_sequences{$seqname} > /dev/null 2>&1") != 0
+        || system("cmp -s $clientdir$seqname.ct $directdir$seqname.ct") != 0) {
+      $logger->error("TEST FAILED: $seqname: gtfoldd does not fold correctly after a client went away");
+      $ok = 0;
+    }
+  }
+
+  kill('TERM', $daemon);
+  waitpid($daemon, 0);
+  if (-e $sock) {
+    $logger->error("TEST FAILED: gtfoldd left $sock behind");
+    $ok = 0;
+  }
+
+  if ($ok) {
+    $logger->info("TEST PASSED: gtfoldd reuses workers, relays exit statuses and stops the runs of clients that went away");
+  }
+}
+1;
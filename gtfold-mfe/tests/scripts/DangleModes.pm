@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+package DangleModes;
+use strict;
+use warnings;
+
+# gtmfe --dangle-modes 0,1,2,m must save the structures of separate runs with -d 0, the
+# default treatment, -d 2 and -m. A list naming a treatment twice, or an empty one, is
+# rejected.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+
+  my %modes = ("d0" => "-d 0", "d1" => "", "d2" => "-d 2", "m" => "-m");
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $sweepout = "$seqname-modes";
+
+    my $result = system("$gtdir/gtmfe --dangle-modes 0,1,2,m -w $workdir -o $sweepout $seqfile > /dev/null 2>&1");
+    if ($result != 0) {
+      $logger->error("TEST FAILED: $seqname: gtmfe --dangle-modes did not run");
+      next;
+    }
+
+    my $ok = 1;
+    foreach my $mode (sort(keys(%modes))) {
+      my $singleout = "$seqname-$mode";
+      system("$gtdir/gtmfe $modes{$mode} -w $workdir -o $singleout $seqfile > /dev/null 2>&1");
+      if (system("cmp -s $workdir$sweepout\_$mode.ct $workdir$singleout.ct") != 0) {
+        $logger->error("TEST FAILED: $seqname: $workdir$sweepout\_$mode.ct differs from the gtmfe $modes{$mode} run");
+        $ok = 0;
+      }
+    }
+
+    foreach my $list ("0,0", "2,m,2", "''") {
+      if (system("$gtdir/gtmfe --dangle-modes $list -w $workdir -o $seqname-bad $seqfile > /dev/null 2>&1") == 0) {
+        $logger->error("TEST FAILED: $seqname: gtmfe --dangle-modes $list was not rejected");
+        $ok = 0;
+      }
+    }
+
+    if ($ok) {
+      $logger->info("TEST PASSED: $seqname: --dangle-modes 0,1,2,m matches separate runs");
+    }
+  }
+}
+1;
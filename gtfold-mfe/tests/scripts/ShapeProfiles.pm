@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+package ShapeProfiles;
+use strict;
+use warnings;
+
+# gtmfe --shape-profiles must save the structures of separate --useSHAPE runs with each
+# profile. The profiles are random reactivities written for every sequence; with more of
+# them than the 64 table sets filled together, the sweep takes several passes.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $count = $Config{"L_SHAPEPROFILES_COUNT"};
+
+  if (not(defined($count))) {
+    $count = 70;
+  }
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $sweepout = "$seqname-profiles";
+
+    open(SEQ, "<$seqfile") or die("Cannot open $seqfile");
+    my $seq = "";
+    while (my $line = <SEQ>) {
+      next if ($line =~ /^>/);
+      $line =~ s/\s//g;
+      $seq .= $line;
+    }
+    close(SEQ);
+    my $len = length($seq);
+
+    srand($len);
+    my @profiles;
+    for (my $k = 0; $k < $count; $k++) {
+      my $file = "$workdir$seqname-shape$k.txt";
+      open(SHAPE, ">$file") or die("Cannot write $file");
+      for (my $i = 1; $i <= $len; $i++) {
+        printf SHAPE ("%d %.3f\n", $i, rand(2.0));
+      }
+      close(SHAPE);
+      push(@profiles, $file);
+    }
+
+    my $list = join(",", @profiles);
+    my $result = system("$gtdir/gtmfe --shape-profiles $list -w $workdir -o $sweepout $seqfile > /dev/null 2>&1");
+    if ($result != 0) {
+      $logger->error("TEST FAILED: $seqname: gtmfe --shape-profiles did not run");
+      next;
+    }
+
+    my $ok = 1;
+    for (my $k = 0; $k < $count; $k++) {
+      my $label = "$seqname-shape$k";
+      system("$gtdir/gtmfe --useSHAPE $profiles[$k] -w $workdir -o $label $seqfile > /dev/null 2>&1");
+      if (system("cmp -s $workdir$sweepout\_$label.ct $workdir$label.ct") != 0) {
+        $logger->error("TEST FAILED: $seqname: $workdir$sweepout\_$label.ct differs from the gtmfe --useSHAPE $profiles[$k] run");
+        $ok = 0;
+      }
+    }
+
+    if ($ok) {
+      $logger->info("TEST PASSED: $seqname: --shape-profiles with $count profiles matches separate --useSHAPE runs");
+    }
+  }
+}
+1;
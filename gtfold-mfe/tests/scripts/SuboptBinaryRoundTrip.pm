@@ -0,0 +1,50 @@
+#!/usr/bin/perl
+package SuboptBinaryRoundTrip;
+use strict;
+use warnings;
+
+# gtsubopt --binary followed by gtsubopt --exportbinary must give exactly the
+# text file of a gtsubopt run without --binary.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $delta = $Config{"L_SUBOPTBINARYROUNDTRIP_DELTA"};
+
+  if (not(defined($delta))) {
+    $delta = 3;
+  }
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $textout = "$seqname-text";
+    my $binout = "$seqname-bin";
+    my $exportout = "$seqname-export";
+
+    system("$gtdir/gtsubopt --delta $delta -w $workdir -o $textout $seqfile > /dev/null 2>&1");
+    system("$gtdir/gtsubopt --delta $delta --binary -w $workdir -o $binout $seqfile > /dev/null 2>&1");
+    my $result = system("$gtdir/gtsubopt --exportbinary $workdir$binout\_ss.bin -w $workdir -o $exportout > /dev/null 2>&1");
+
+    if ($result != 0 || ! -s "$workdir$textout\_ss.txt") {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: gtsubopt did not run");
+    }
+    elsif (system("cmp -s $workdir$textout\_ss.txt $workdir$exportout\_ss.txt") == 0) {
+      $logger->info("TEST PASSED: $seqname: delta = $delta: binary output exported to the text output");
+    }
+    else {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: $workdir$exportout\_ss.txt differs from $workdir$textout\_ss.txt");
+    }
+  }
+}
+1;
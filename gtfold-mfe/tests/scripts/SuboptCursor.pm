@@ -0,0 +1,109 @@
+#!/usr/bin/perl
+package SuboptCursor;
+use strict;
+use warnings;
+
+# pair partner of every opening bracket of a dot bracket string
+sub pairs
+{
+  my($db) = @_;
+  my @stack;
+  my %pair;
+  for (my $k = 1; $k <= length($db); $k++) {
+    my $c = substr($db, $k - 1, 1);
+    if ($c eq '(') {
+      push(@stack, $k);
+    }
+    elsif ($c eq ')') {
+      $pair{pop(@stack)} = $k;
+    }
+  }
+  return %pair;
+}
+
+# gtsubopt --cursor must write exactly the structures of a serial gtsubopt run, and
+# gtsubopt --forbid I J the same structures without the ones that pair I with J.
+# The pair forbidden is the least frequent one of the first structure, so the filter
+# drops some structures and keeps others.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $delta = $Config{"L_SUBOPTCURSOR_DELTA"};
+
+  if (not(defined($delta))) {
+    $delta = 3;
+  }
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $textout = "$seqname-serial";
+    my $cursorout = "$seqname-cursor";
+    my $forbidout = "$seqname-forbid";
+
+    system("$gtdir/gtsubopt --delta $delta -t 1 -w $workdir -o $textout $seqfile > /dev/null 2>&1");
+    my $result = system("$gtdir/gtsubopt --delta $delta --cursor -w $workdir -o $cursorout $seqfile > /dev/null 2>&1");
+
+    if ($result != 0 || ! -s "$workdir$textout\_ss.txt") {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: gtsubopt did not run");
+      next;
+    }
+    if (system("cmp -s $workdir$textout\_ss.txt $workdir$cursorout\_ss.txt") != 0) {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: $workdir$cursorout\_ss.txt differs from $workdir$textout\_ss.txt");
+      next;
+    }
+
+    open(SERIAL, "<$workdir$textout\_ss.txt") or die("Cannot open $workdir$textout\_ss.txt");
+    my @lines = <SERIAL>;
+    close(SERIAL);
+    my $header = shift(@lines);
+    my %first = pairs((split(/\t/, $lines[0]))[1]);
+    my %seen;
+    foreach my $line (@lines) {
+      my %pair = pairs((split(/\t/, $line))[1]);
+      foreach my $k (keys(%pair)) {
+        $seen{"$k.$pair{$k}"}++;
+      }
+    }
+    my ($i) = sort { $seen{"$a.$first{$a}"} <=> $seen{"$b.$first{$b}"} or $a <=> $b } keys(%first);
+    if (not(defined($i))) {
+      $logger->info("TEST PASSED: $seqname: delta = $delta: cursor output matches, open chain MFE so --forbid is not tested");
+      next;
+    }
+    my $j = $first{$i};
+
+    my @expected = ($header);
+    my $count = 0;
+    foreach my $line (@lines) {
+      my ($n, $db, $energy) = split(/\t/, $line);
+      my %pair = pairs($db);
+      next if (defined($pair{$i}) && $pair{$i} == $j);
+      $count++;
+      push(@expected, "$count\t$db\t$energy");
+    }
+
+    system("$gtdir/gtsubopt --delta $delta --forbid $i $j -w $workdir -o $forbidout $seqfile > /dev/null 2>&1");
+    open(FORBID, "<$workdir$forbidout\_ss.txt") or die("Cannot open $workdir$forbidout\_ss.txt");
+    my @got = <FORBID>;
+    close(FORBID);
+
+    if (join("", @got) eq join("", @expected)) {
+      $logger->info("TEST PASSED: $seqname: delta = $delta: cursor output matches, $count of " . scalar(@lines) . " structures without $i.$j");
+    }
+    else {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: $workdir$forbidout\_ss.txt is not the serial output without the pair $i.$j");
+    }
+  }
+}
+1;
@@ -0,0 +1,82 @@
+#!/usr/bin/perl
+package SuboptDos;
+use strict;
+use warnings;
+
+# gtsubopt --dos must count, in every 0.1 kcal/mol bin above the MFE, the structures
+# that gtsubopt enumerates with the unique multiloop decomposition it counts over.
+sub test()
+{
+  my(%Config) = %{$_[1]};
+  my(%Sequences) = %{$_[2]};
+  my(%local_sequences) = %{$_[3]};
+  my $logger = $_[4];
+
+  my $gtdir = $Config{"G_GTFOLD_DIR"};
+  my $workdir = $Config{"G_WORK_DIR"};
+  my $delta = $Config{"L_SUBOPTDOS_DELTA"};
+
+  if (not(defined($delta))) {
+    $delta = 6;
+  }
+
+  my $key;
+  my $value;
+  my %new_hash = (%local_sequences);
+
+  while (($key, $value) = each(%new_hash)) {
+
+    my $seqname = $key;
+    my $seqfile = $value;
+    my $dosout = "$seqname-dos";
+    my $textout = "$seqname-subopt";
+
+    my $result = system("$gtdir/gtsubopt --delta $delta --dos -w $workdir -o $dosout $seqfile > /dev/null 2>&1");
+    system("$gtdir/gtsubopt --delta $delta --unique 1 -w $workdir -o $textout $seqfile > /dev/null 2>&1");
+
+    if ($result != 0 || ! -s "$workdir$dosout\_dos.txt" || ! -s "$workdir$textout\_ss.txt") {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: gtsubopt did not run");
+      next;
+    }
+
+    # energies in 10 cal/mol, the unit the histogram is binned in
+    open(SUBOPT, "<$workdir$textout\_ss.txt") or die("Cannot open $workdir$textout\_ss.txt");
+    my @lines = <SUBOPT>;
+    close(SUBOPT);
+    chomp(@lines);
+    my $header = shift(@lines);
+    my $mfe = sprintf("%.0f", (split(/\t/, $header))[2] * 100);
+    my @expected;
+    foreach my $line (@lines) {
+      my ($n, $db, $energy) = split(/\t/, $line);
+      my $bin = int((sprintf("%.0f", $energy * 100) - $mfe) / 10);
+      $expected[$bin]++;
+    }
+
+    open(DOS, "<$workdir$dosout\_dos.txt") or die("Cannot open $workdir$dosout\_dos.txt");
+    my @bins = <DOS>;
+    close(DOS);
+    chomp(@bins);
+    splice(@bins, 0, 2);
+
+    my $mismatch;
+    my $total = 0;
+    for (my $b = 0; $b < @bins || $b < @expected; $b++) {
+      my ($from, $to, $count, $cumulative) = defined($bins[$b]) ? split(/\t/, $bins[$b]) : ("", "", 0, 0);
+      my $want = defined($expected[$b]) ? $expected[$b] : 0;
+      $total += $want;
+      if ($count != $want || $cumulative != $total) {
+        $mismatch = "bin $b ($from to $to): $count structures counted, $want enumerated";
+        last;
+      }
+    }
+
+    if (defined($mismatch)) {
+      $logger->error("TEST FAILED: $seqname: delta = $delta: $workdir$dosout\_dos.txt $mismatch");
+    }
+    else {
+      $logger->info("TEST PASSED: $seqname: delta = $delta: " . scalar(@bins) . " bins match the $total structures enumerated");
+    }
+  }
+}
+1;